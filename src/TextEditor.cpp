@@ -1,10 +1,19 @@
 #include <algorithm>
+#include <array>
 #include <chrono>
 #include <cmath>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
 #include <regex>
 #include <string>
 
 #include "TextEditor.h"
+#include "atomicfile.h"
+#include "jobs.h"
+#include "mappedfile.h"
+#include "search.h"
+#include "symbols.h"
 #define IMGUI_DEFINE_MATH_OPERATORS
 #include "imgui.h" // for imGui::GetCurrentWindow()
 
@@ -24,28 +33,562 @@ bool equals(InputIt1 first1, InputIt1 last1, InputIt2 first2, InputIt2 last2,
 	return first1 == last1 && first2 == last2;
 }
 
+TextEditor::Line::Line(std::string aText) : mText(std::move(aText)) {
+	if (!mText.empty())
+		mSpans.push_back({StyledSize(), (Style)PaletteIndex::Default});
+}
+
+void TextEditor::Line::insert(size_t aAt, const char *aText, size_t aCount) {
+	assert(aAt <= mText.size());
+	if (aCount == 0)
+		return;
+
+	mText.insert(aAt, aText, aCount);
+	if (mSpans.empty()) {
+		mSpans.push_back({StyledSize(), (Style)PaletteIndex::Default});
+		return;
+	}
+
+	// the run the new text lands in grows and every run after it moves
+	// along, those pushed past the limit end up empty and are dropped
+	auto it = std::lower_bound(
+		mSpans.begin(), mSpans.end(), (uint32_t)aAt,
+		[](const ColorSpan &span, uint32_t at) { return span.mEnd < at; });
+	for (; it != mSpans.end(); ++it)
+		it->mEnd = (uint32_t)std::min(it->mEnd + aCount,
+									  (size_t)MaxStyledBytes);
+	if (mSpans.back().mEnd == MaxStyledBytes)
+		Compact();
+}
+
+void TextEditor::Line::append(const Line &aOther, size_t aFrom) {
+	if (aFrom >= aOther.size())
+		return;
+
+	const size_t offset = mText.size();
+	mText.append(aOther.mText, aFrom, std::string::npos);
+	for (auto &span : aOther.mSpans)
+		if (span.mEnd > aFrom)
+			mSpans.push_back(
+				{(uint32_t)std::min(span.mEnd - aFrom + offset,
+									(size_t)MaxStyledBytes),
+				 span.mStyle});
+	FillTail();
+	Compact();
+}
+
+void TextEditor::Line::erase(size_t aFirst, size_t aLast) {
+	assert(aFirst <= aLast && aLast <= mText.size());
+	if (aFirst == aLast)
+		return;
+
+	const uint32_t count = (uint32_t)(aLast - aFirst);
+	mText.erase(aFirst, count);
+	for (auto &span : mSpans) {
+		if (span.mEnd >= aLast)
+			span.mEnd -= count;
+		else if (span.mEnd > aFirst)
+			span.mEnd = (uint32_t)aFirst;
+	}
+	FillTail();
+	Compact();
+}
+
+TextEditor::Style TextEditor::Line::GetStyle(size_t aIndex) const {
+	auto it = std::upper_bound(
+		mSpans.begin(), mSpans.end(), (uint32_t)aIndex,
+		[](uint32_t index, const ColorSpan &span) { return index < span.mEnd; });
+	return it == mSpans.end() ? (Style)PaletteIndex::Default : it->mStyle;
+}
+
+void TextEditor::Line::GetStyles(std::vector<Style> &aStyles) const {
+	aStyles.resize(mText.size());
+	uint32_t start = 0;
+	for (auto &span : mSpans) {
+		assert(start <= span.mEnd && span.mEnd <= mText.size());
+		std::fill(aStyles.begin() + start, aStyles.begin() + span.mEnd,
+				  span.mStyle);
+		start = span.mEnd;
+	}
+	std::fill(aStyles.begin() + start, aStyles.end(),
+			  (Style)PaletteIndex::Default);
+}
+
+void TextEditor::Line::SetStyles(const Style *aStyles) {
+	const uint32_t size = StyledSize();
+	size_t count = size > 0 ? 1 : 0;
+	for (uint32_t i = 1; i < size; ++i)
+		count += aStyles[i] != aStyles[i - 1];
+
+	// most lines are recolored with the same number of runs, so only
+	// reallocate when the count actually changes
+	if (count != mSpans.size()) {
+		mSpans.clear();
+		mSpans.shrink_to_fit();
+		mSpans.reserve(count);
+	}
+	mSpans.clear();
+	for (uint32_t i = 0; i < size; ++i) {
+		if (!mSpans.empty() && mSpans.back().mStyle == aStyles[i])
+			mSpans.back().mEnd = i + 1;
+		else
+			mSpans.push_back({i + 1, aStyles[i]});
+	}
+}
+
+void TextEditor::Line::SetColors(const PaletteIndex *aColors) {
+	thread_local std::vector<Style> styles;
+	GetStyles(styles);
+	for (size_t i = 0; i < styles.size(); ++i)
+		styles[i] = (styles[i] & ~StyleColorMask) | (Style)aColors[i];
+	SetStyles(styles.data());
+}
+
+uint32_t TextEditor::Line::StyledSize() const {
+	return (uint32_t)std::min(mText.size(), (size_t)MaxStyledBytes);
+}
+
+void TextEditor::Line::FillTail() {
+	// bytes that moved within the limit from past it, or were appended
+	// without runs of their own, take the default style
+	const uint32_t covered = mSpans.empty() ? 0 : mSpans.back().mEnd;
+	if (covered < StyledSize())
+		mSpans.push_back({StyledSize(), (Style)PaletteIndex::Default});
+}
+
+void TextEditor::Line::Compact() {
+	// drop runs that became empty and merge neighbours of the same style
+	size_t count = 0;
+	uint32_t previousEnd = 0;
+	for (auto &span : mSpans) {
+		if (span.mEnd == previousEnd)
+			continue;
+		previousEnd = span.mEnd;
+		if (count > 0 && mSpans[count - 1].mStyle == span.mStyle)
+			mSpans[count - 1].mEnd = span.mEnd;
+		else
+			mSpans[count++] = span;
+	}
+	mSpans.resize(count);
+}
+
+// undo history kept per editor before the oldest steps are dropped
+static constexpr size_t defaultUndoMemoryLimit = 16 * 1024 * 1024;
+
+// replaces bigger than this only keep the part of the text that changed
+static constexpr size_t undoDeltaSize = 4096;
+
+// candidates kept for the autocomplete popup, and how many of them show
+static constexpr size_t maxCompletions = 50;
+static constexpr int visibleCompletions = 10;
+
+// typing this much of a word opens the autocomplete popup by itself
+static constexpr int minCompletionPrefix = 2;
+
+// lines per chunk when a document is loaded, chunks split once they grow to
+// twice this and merge with a neighbour once they shrink below an eighth
+static constexpr size_t linesChunkSize = 512;
+
+size_t TextEditor::Lines::FindChunk(size_t aIndex) const {
+	assert(aIndex < mSize);
+	if (mLastChunk < mChunks.size() && aIndex >= mStarts[mLastChunk] &&
+		aIndex < mStarts[mLastChunk] + mChunks[mLastChunk]->size())
+		return mLastChunk;
+
+	mLastChunk = std::upper_bound(mStarts.begin(), mStarts.end(), aIndex) -
+				 mStarts.begin() - 1;
+	return mLastChunk;
+}
+
+TextEditor::Lines::Chunk &TextEditor::Lines::MutableChunk(size_t aChunk) {
+	// copy on write, a snapshot may still be reading the shared chunk
+	auto &chunk = mChunks[aChunk];
+	if (chunk.use_count() > 1)
+		chunk = std::make_shared<Chunk>(*chunk);
+	return *chunk;
+}
+
+void TextEditor::Lines::SplitChunk(size_t aChunk, size_t aAt) {
+	auto &chunk = MutableChunk(aChunk);
+	assert(aAt > 0 && aAt < chunk.size());
+
+	auto tail = std::make_shared<Chunk>(
+		std::make_move_iterator(chunk.begin() + aAt),
+		std::make_move_iterator(chunk.end()));
+	chunk.erase(chunk.begin() + aAt, chunk.end());
+	mChunks.insert(mChunks.begin() + aChunk + 1, std::move(tail));
+	mStarts.insert(mStarts.begin() + aChunk + 1, 0);
+	UpdateStarts(aChunk + 1);
+}
+
+void TextEditor::Lines::UpdateStarts(size_t aFromChunk) {
+	for (size_t i = std::max<size_t>(aFromChunk, 1); i < mChunks.size(); ++i)
+		mStarts[i] = mStarts[i - 1] + mChunks[i - 1]->size();
+	if (!mStarts.empty())
+		mStarts[0] = 0;
+}
+
+TextEditor::Line &TextEditor::Lines::operator[](size_t aIndex) {
+	const size_t chunk = FindChunk(aIndex);
+	return MutableChunk(chunk)[aIndex - mStarts[chunk]];
+}
+
+const TextEditor::Line &TextEditor::Lines::operator[](size_t aIndex) const {
+	const size_t chunk = FindChunk(aIndex);
+	return (*mChunks[chunk])[aIndex - mStarts[chunk]];
+}
+
+TextEditor::Line &TextEditor::Lines::at(size_t aIndex) {
+	if (aIndex >= mSize)
+		throw std::out_of_range("TextEditor::Lines::at");
+	return (*this)[aIndex];
+}
+
+const TextEditor::Line &TextEditor::Lines::at(size_t aIndex) const {
+	if (aIndex >= mSize)
+		throw std::out_of_range("TextEditor::Lines::at");
+	return (*this)[aIndex];
+}
+
+TextEditor::Line &TextEditor::Lines::insert(size_t aIndex, Line aLine) {
+	assert(aIndex <= mSize);
+
+	if (mChunks.empty()) {
+		mChunks.push_back(std::make_shared<Chunk>());
+		mStarts.push_back(0);
+	}
+
+	const size_t chunk =
+		aIndex == mSize ? mChunks.size() - 1 : FindChunk(aIndex);
+	auto &lines = MutableChunk(chunk);
+	lines.insert(lines.begin() + (aIndex - mStarts[chunk]), std::move(aLine));
+	++mSize;
+	UpdateStarts(chunk + 1);
+
+	if (lines.size() >= linesChunkSize * 2)
+		SplitChunk(chunk, lines.size() / 2);
+
+	return (*this)[aIndex];
+}
+
+void TextEditor::Lines::insert(size_t aIndex, std::vector<Line> &&aLines) {
+	assert(aIndex <= mSize);
+	if (aLines.empty())
+		return;
+
+	// small insertions go into the chunk that is already there
+	if (aIndex < mSize && aLines.size() < linesChunkSize) {
+		const size_t chunk = FindChunk(aIndex);
+		auto &lines = MutableChunk(chunk);
+		if (lines.size() + aLines.size() < linesChunkSize * 2) {
+			lines.insert(lines.begin() + (aIndex - mStarts[chunk]),
+						 std::make_move_iterator(aLines.begin()),
+						 std::make_move_iterator(aLines.end()));
+			mSize += aLines.size();
+			UpdateStarts(chunk + 1);
+			return;
+		}
+	}
+
+	// otherwise split the chunk at aIndex and slot whole new chunks in
+	size_t position = mChunks.size();
+	if (aIndex < mSize) {
+		const size_t chunk = FindChunk(aIndex);
+		const size_t offset = aIndex - mStarts[chunk];
+		if (offset > 0)
+			SplitChunk(chunk, offset);
+		position = offset > 0 ? chunk + 1 : chunk;
+	}
+
+	std::vector<std::shared_ptr<Chunk>> chunks;
+	for (size_t i = 0; i < aLines.size(); i += linesChunkSize) {
+		const auto first = aLines.begin() + i;
+		const auto last =
+			aLines.begin() + std::min(aLines.size(), i + linesChunkSize);
+		chunks.push_back(
+			std::make_shared<Chunk>(std::make_move_iterator(first),
+									std::make_move_iterator(last)));
+	}
+
+	mChunks.insert(mChunks.begin() + position, chunks.begin(), chunks.end());
+	mStarts.insert(mStarts.begin() + position, chunks.size(), 0);
+	mSize += aLines.size();
+	UpdateStarts(position);
+}
+
+void TextEditor::Lines::erase(size_t aFirst, size_t aLast) {
+	assert(aFirst <= aLast && aLast <= mSize);
+
+	while (aFirst < aLast) {
+		const size_t chunk = FindChunk(aFirst);
+		const size_t offset = aFirst - mStarts[chunk];
+		const size_t count =
+			std::min(aLast - aFirst, mChunks[chunk]->size() - offset);
+
+		if (count == mChunks[chunk]->size()) {
+			mChunks.erase(mChunks.begin() + chunk);
+			mStarts.erase(mStarts.begin() + chunk);
+		} else {
+			auto &lines = MutableChunk(chunk);
+			lines.erase(lines.begin() + offset,
+						lines.begin() + offset + count);
+
+			// fold a nearly empty chunk into the one after it
+			if (lines.size() < linesChunkSize / 8 &&
+				chunk + 1 < mChunks.size() &&
+				lines.size() + mChunks[chunk + 1]->size() <
+					linesChunkSize * 2) {
+				auto &next = MutableChunk(chunk + 1);
+				next.insert(next.begin(),
+							std::make_move_iterator(lines.begin()),
+							std::make_move_iterator(lines.end()));
+				mChunks.erase(mChunks.begin() + chunk);
+				mStarts.erase(mStarts.begin() + chunk);
+			}
+		}
+
+		mSize -= count;
+		aLast -= count;
+		UpdateStarts(chunk);
+	}
+	mLastChunk = 0;
+}
+
+void TextEditor::Lines::assign(std::vector<Line> &&aLines) {
+	clear();
+	insert(0, std::move(aLines));
+}
+
+void TextEditor::Lines::clear() {
+	mChunks.clear();
+	mStarts.clear();
+	mSize = 0;
+	mLastChunk = 0;
+}
+
+// What a run of lines leaves unpaired followed by what the next run does
+TextEditor::BracketBalance
+TextEditor::BracketTree::Combine(const BracketBalance &aFirst,
+								 const BracketBalance &aSecond) {
+	BracketBalance balance;
+	balance.mCloses =
+		aFirst.mCloses + std::max(0, aSecond.mCloses - aFirst.mOpens);
+	balance.mOpens =
+		aSecond.mOpens + std::max(0, aFirst.mOpens - aSecond.mCloses);
+	return balance;
+}
+
+TextEditor::BracketBalance
+TextEditor::BracketTree::LineBalance(const LineState &aState, int aKind) {
+	BracketBalance balance;
+	balance.mCloses = aState.mCloses[aKind];
+	balance.mOpens = aState.mOpens[aKind];
+	return balance;
+}
+
+void TextEditor::BracketTree::Build(const LineStates &aStates) {
+	const int groups =
+		std::max(1, ((int)aStates.size() + linesPerLeaf - 1) / linesPerLeaf);
+	mLeaves = 1;
+	while (mLeaves < groups)
+		mLeaves *= 2;
+	mNodes.assign(mLeaves * 2 * BracketKinds, BracketBalance());
+	mLines = (int)aStates.size();
+
+	for (int leaf = 0; leaf < groups; ++leaf)
+		UpdateLeaf(aStates, leaf);
+	for (int node = mLeaves - 1; node > 0; --node)
+		for (int kind = 0; kind < BracketKinds; ++kind)
+			Node(node, kind) = Combine(Node(node * 2, kind),
+											   Node(node * 2 + 1, kind));
+}
+
+void TextEditor::BracketTree::UpdateLeaf(const LineStates &aStates,
+										 int aLeaf) {
+	const int first = aLeaf * linesPerLeaf;
+	const int last = std::min((int)aStates.size(), first + linesPerLeaf);
+	for (int kind = 0; kind < BracketKinds; ++kind) {
+		BracketBalance balance;
+		for (int line = first; line < last; ++line)
+			balance = Combine(balance, LineBalance(aStates[line], kind));
+		Node(mLeaves + aLeaf, kind) = balance;
+	}
+}
+
+void TextEditor::BracketTree::Update(const LineStates &aStates, int aLine) {
+	const int leaf = aLine / linesPerLeaf;
+	UpdateLeaf(aStates, leaf);
+	for (int node = (mLeaves + leaf) / 2; node > 0; node /= 2)
+		for (int kind = 0; kind < BracketKinds; ++kind)
+			Node(node, kind) = Combine(Node(node * 2, kind),
+											   Node(node * 2 + 1, kind));
+}
+
+// Walks the leaves from aFrom on, letting each pair off what it can of the
+// opens still waiting, and returns the one that closes the last of them
+int TextEditor::BracketTree::FindCloseLeaf(int aNode, int aLow, int aHigh,
+										   int aFrom, int aKind,
+										   int &aDepth) const {
+	if (aHigh < aFrom)
+		return -1;
+	const auto &balance = Node(aNode, aKind);
+	if (aLow >= aFrom && balance.mCloses < aDepth) {
+		aDepth += balance.mOpens - balance.mCloses;
+		return -1;
+	}
+	if (aLow == aHigh)
+		return aLow;
+	const int middle = (aLow + aHigh) / 2;
+	const int leaf =
+		FindCloseLeaf(aNode * 2, aLow, middle, aFrom, aKind, aDepth);
+	if (leaf >= 0)
+		return leaf;
+	return FindCloseLeaf(aNode * 2 + 1, middle + 1, aHigh, aFrom, aKind,
+						 aDepth);
+}
+
+int TextEditor::BracketTree::FindOpenLeaf(int aNode, int aLow, int aHigh,
+										  int aTo, int aKind,
+										  int &aDepth) const {
+	if (aLow > aTo)
+		return -1;
+	const auto &balance = Node(aNode, aKind);
+	if (aHigh <= aTo && balance.mOpens < aDepth) {
+		aDepth += balance.mCloses - balance.mOpens;
+		return -1;
+	}
+	if (aLow == aHigh)
+		return aLow;
+	const int middle = (aLow + aHigh) / 2;
+	const int leaf =
+		FindOpenLeaf(aNode * 2 + 1, middle + 1, aHigh, aTo, aKind, aDepth);
+	if (leaf >= 0)
+		return leaf;
+	return FindOpenLeaf(aNode * 2, aLow, middle, aTo, aKind, aDepth);
+}
+
+int TextEditor::BracketTree::FindClose(const LineStates &aStates, int aLine,
+									   int aKind, int &aDepth) const {
+	// the rest of the leaf aLine is in, then the leaves, then the lines of
+	// the leaf that was found
+	const int count = (int)aStates.size();
+	int line = aLine + 1;
+	for (; line < count && line % linesPerLeaf != 0; ++line) {
+		const auto balance = LineBalance(aStates[line], aKind);
+		if (balance.mCloses >= aDepth)
+			return line;
+		aDepth += balance.mOpens - balance.mCloses;
+	}
+	if (line >= count)
+		return -1;
+	const int leaf = FindCloseLeaf(1, 0, mLeaves - 1, line / linesPerLeaf,
+								   aKind, aDepth);
+	if (leaf < 0)
+		return -1;
+	const int last = std::min(count, (leaf + 1) * linesPerLeaf);
+	for (line = leaf * linesPerLeaf; line < last; ++line) {
+		const auto balance = LineBalance(aStates[line], aKind);
+		if (balance.mCloses >= aDepth)
+			return line;
+		aDepth += balance.mOpens - balance.mCloses;
+	}
+	return -1;
+}
+
+int TextEditor::BracketTree::FindOpen(const LineStates &aStates, int aLine,
+									  int aKind, int &aDepth) const {
+	int line = aLine - 1;
+	for (; line >= 0 && (line + 1) % linesPerLeaf != 0; --line) {
+		const auto balance = LineBalance(aStates[line], aKind);
+		if (balance.mOpens >= aDepth)
+			return line;
+		aDepth += balance.mCloses - balance.mOpens;
+	}
+	if (line < 0)
+		return -1;
+	const int leaf = FindOpenLeaf(1, 0, mLeaves - 1, line / linesPerLeaf,
+								  aKind, aDepth);
+	if (leaf < 0)
+		return -1;
+	const int first = leaf * linesPerLeaf;
+	for (line = std::min(line, first + linesPerLeaf - 1); line >= first;
+		 --line) {
+		const auto balance = LineBalance(aStates[line], aKind);
+		if (balance.mOpens >= aDepth)
+			return line;
+		aDepth += balance.mCloses - balance.mOpens;
+	}
+	return -1;
+}
+
+void TextEditor::BracketTree::GetPrefixLeaves(int aNode, int aLow, int aHigh,
+											  int aEnd, int aKind,
+											  BracketBalance &aBalance) const {
+	if (aLow >= aEnd)
+		return;
+	if (aHigh < aEnd) {
+		aBalance = Combine(aBalance, Node(aNode, aKind));
+		return;
+	}
+	const int middle = (aLow + aHigh) / 2;
+	GetPrefixLeaves(aNode * 2, aLow, middle, aEnd, aKind, aBalance);
+	GetPrefixLeaves(aNode * 2 + 1, middle + 1, aHigh, aEnd, aKind, aBalance);
+}
+
+TextEditor::BracketBalance
+TextEditor::BracketTree::GetPrefix(const LineStates &aStates, int aEnd,
+								   int aKind) const {
+	BracketBalance balance;
+	const int leaves = aEnd / linesPerLeaf;
+	GetPrefixLeaves(1, 0, mLeaves - 1, leaves, aKind, balance);
+	for (int line = leaves * linesPerLeaf; line < aEnd; ++line)
+		balance = Combine(balance, LineBalance(aStates[line], aKind));
+	return balance;
+}
+
 TextEditor::TextEditor()
-	: mLineSpacing(1.0f), mUndoIndex(0), mTabSize(4), mOverwrite(false),
+	: mLineSpacing(1.0f), mUndoIndex(0), mUndoMemory(0),
+	  mUndoMemoryLimit(defaultUndoMemoryLimit), mTabSize(4), mOverwrite(false),
 	  mReadOnly(false), mWithinRender(false), mScrollToCursor(false),
 	  mScrollToTop(false), mTextChanged(false), mColorizerEnabled(true),
 	  mTextStart(20.0f), mLeftMargin(10), mCursorPositionChanged(false),
 	  mColorRangeMin(0), mColorRangeMax(0),
-	  mSelectionMode(SelectionMode::Normal), mCheckComments(true),
+	  mSelectionMode(SelectionMode::Normal),
+	  mStateDirtyLine(0), mStateDirtyEnd(0), mBracketVersion(0),
+	  mBracketFound(false), mFunctionVersion(0), mTextVersion(1),
+	  mBackgroundVersion(0), mBackgroundMin(std::numeric_limits<int>::max()),
+	  mBackgroundMax(0),
+	  mBackgroundColorizer(std::make_shared<BackgroundColorizer>()),
+	  mColorizeTask(std::make_unique<QuakePrism::Jobs::Task>()),
+	  mLoading(false), mLoadTask(std::make_unique<QuakePrism::Jobs::Task>()),
+	  mSaveState(SaveState::Idle), mSavePending(false),
+	  mSaveTask(std::make_unique<QuakePrism::Jobs::Task>()),
+	  mRecordEdits(false),
+	  mFindVersion(0), mCompletionOpen(false), mCompletionIndex(0),
 	  mLastClick(-1.0f), mHandleKeyboardInputs(true), mHandleMouseInputs(true),
 	  mIgnoreImGuiChild(false), mShowWhitespaces(true),
 	  mStartTime(std::chrono::duration_cast<std::chrono::milliseconds>(
 					 std::chrono::system_clock::now().time_since_epoch())
 					 .count()) {
 	SetPalette(GetDarkPalette());
-	SetLanguageDefinition(LanguageDefinition::HLSL());
+	// every editor in quake prism is a QuakeC editor, setting it here means
+	// the language is only set up once and no regexes need compiling
+	SetLanguageDefinition(LanguageDefinition::QuakeC());
 	mLines.push_back(Line());
+	mLineStates.push_back(LineState());
 	mUnsaved = false;
 }
 
+TextEditor::TextEditor(TextEditor &&) = default;
+
+TextEditor &TextEditor::operator=(TextEditor &&) = default;
+
 TextEditor::~TextEditor() {}
 
 void TextEditor::SetLanguageDefinition(const LanguageDefinition &aLanguageDef) {
 	mLanguageDefinition = aLanguageDef;
+	mBackgroundLanguage =
+		std::make_shared<const LanguageDefinition>(aLanguageDef);
 	mRegexList.clear();
 
 	for (auto &r : mLanguageDefinition.mTokenRegexStrings)
@@ -77,20 +620,15 @@ std::string TextEditor::GetText(const Coordinates &aStart,
 
 	result.reserve(s + s / 8);
 
-	while (istart < iend || lstart < lend) {
-		if (lstart >= (int)mLines.size())
-			break;
-
+	for (; lstart < lend && lstart < (int)mLines.size(); ++lstart) {
 		auto &line = mLines[lstart];
-		if (istart < (int)line.size()) {
-			result += line[istart].mChar;
-			istart++;
-		} else {
-			istart = 0;
-			++lstart;
-			result += '\n';
-		}
+		if (istart < (int)line.size())
+			result.append(line.GetText(), istart, std::string::npos);
+		result += '\n';
+		istart = 0;
 	}
+	if (lstart == lend && lstart < (int)mLines.size() && istart < iend)
+		result.append(mLines[lstart].GetText(), istart, iend - istart);
 
 	return result;
 }
@@ -177,7 +715,7 @@ void TextEditor::Advance(Coordinates &aCoordinates) const {
 		auto cindex = GetCharacterIndex(aCoordinates);
 
 		if (cindex + 1 < (int)line.size()) {
-			auto delta = UTF8CharLength(line[cindex].mChar);
+			auto delta = UTF8CharLength(line[cindex]);
 			cindex = std::min(cindex + delta, (int)line.size() - 1);
 		} else {
 			++aCoordinates.mLine;
@@ -205,18 +743,17 @@ void TextEditor::DeleteRange(const Coordinates &aStart,
 		auto &line = mLines[aStart.mLine];
 		auto n = GetLineMaxColumn(aStart.mLine);
 		if (aEnd.mColumn >= n)
-			line.erase(line.begin() + start, line.end());
+			line.erase(start, line.size());
 		else
-			line.erase(line.begin() + start, line.begin() + end);
+			line.erase(start, end);
 	} else {
 		auto &firstLine = mLines[aStart.mLine];
 		auto &lastLine = mLines[aEnd.mLine];
 
-		firstLine.erase(firstLine.begin() + start, firstLine.end());
-		lastLine.erase(lastLine.begin(), lastLine.begin() + end);
+		firstLine.erase(start, firstLine.size());
 
 		if (aStart.mLine < aEnd.mLine)
-			firstLine.insert(firstLine.end(), lastLine.begin(), lastLine.end());
+			firstLine.append(lastLine, end);
 
 		if (aStart.mLine < aEnd.mLine)
 			RemoveLine(aStart.mLine + 1, aEnd.mLine + 1);
@@ -229,39 +766,45 @@ void TextEditor::DeleteRange(const Coordinates &aStart,
 int TextEditor::InsertTextAt(Coordinates & /* inout */ aWhere,
 							 const char *aValue) {
 	assert(!mReadOnly);
+	assert(!mLines.empty());
+
+	// split the text up front so a multi-line paste is one insertion into
+	// mLines rather than one per line
+	std::vector<std::string> newText;
+	std::string head;
+	std::string *target = &head;
+	for (; *aValue != '\0'; ++aValue) {
+		if (*aValue == '\r')
+			continue;
+		if (*aValue == '\n') {
+			newText.emplace_back();
+			target = &newText.back();
+		} else
+			target->push_back(*aValue);
+	}
+	std::vector<Line> newLines(std::make_move_iterator(newText.begin()),
+							   std::make_move_iterator(newText.end()));
 
 	int cindex = GetCharacterIndex(aWhere);
-	int totalLines = 0;
-	while (*aValue != '\0') {
-		assert(!mLines.empty());
-
-		if (*aValue == '\r') {
-			// skip
-			++aValue;
-		} else if (*aValue == '\n') {
-			if (cindex < (int)mLines[aWhere.mLine].size()) {
-				auto &newLine = InsertLine(aWhere.mLine + 1);
-				auto &line = mLines[aWhere.mLine];
-				newLine.insert(newLine.begin(), line.begin() + cindex,
-							   line.end());
-				line.erase(line.begin() + cindex, line.end());
-			} else {
-				InsertLine(aWhere.mLine + 1);
-			}
-			++aWhere.mLine;
-			aWhere.mColumn = 0;
-			cindex = 0;
-			++totalLines;
-			++aValue;
-		} else {
-			auto &line = mLines[aWhere.mLine];
-			auto d = UTF8CharLength(*aValue);
-			while (d-- > 0 && *aValue != '\0')
-				line.insert(line.begin() + cindex++,
-							Glyph(*aValue++, PaletteIndex::Default));
-			++aWhere.mColumn;
-		}
+	auto &line = mLines[aWhere.mLine];
+	const int totalLines = (int)newLines.size();
+	if (totalLines == 0) {
+		line.insert(cindex, head);
+		cindex += (int)head.size();
+	} else {
+		// the rest of the current line moves to the end of the last new one
+		auto &last = newLines.back();
+		const int lastSize = (int)last.size();
+		last.append(line, cindex);
+		line.erase(cindex, line.size());
+		line.insert(line.size(), head);
+		cindex = lastSize;
+		InsertLines(aWhere.mLine + 1, std::move(newLines));
+		aWhere.mLine += totalLines;
+	}
+	aWhere.mColumn = GetCharacterColumn(aWhere.mLine, cindex);
 
+	if (totalLines > 0 || !head.empty()) {
 		mTextChanged = true;
 		mUnsaved = true;
 	}
@@ -282,9 +825,30 @@ void TextEditor::AddUndo(UndoRecord &aValue) {
 	// aValue.mAfter.mCursorPosition.mColumn
 	//	);
 
-	mUndoBuffer.resize((size_t)(mUndoIndex + 1));
-	mUndoBuffer.back() = aValue;
+	// anything past the current step can no longer be redone
+	while ((int)mUndoBuffer.size() > mUndoIndex) {
+		mUndoMemory -= mUndoBuffer.back().GetMemory();
+		mUndoBuffer.pop_back();
+	}
+
+	if (!mUndoBuffer.empty()) {
+		auto &previous = mUndoBuffer.back();
+		mUndoMemory -= previous.GetMemory();
+		const bool coalesced = CoalesceUndo(previous, aValue);
+		mUndoMemory += previous.GetMemory();
+		if (coalesced) {
+			RecordEdit(aValue, false);
+			return;
+		}
+	}
+
+	StoreUndoDelta(aValue);
+	RecordEdit(aValue, false);
+	mUndoMemory += aValue.GetMemory();
+	mUndoBuffer.push_back(std::move(aValue));
 	++mUndoIndex;
+
+	EvictUndo();
 }
 
 TextEditor::Coordinates
@@ -292,7 +856,8 @@ TextEditor::ScreenPosToCoordinates(const ImVec2 &aPosition) const {
 	ImVec2 origin = ImGui::GetCursorScreenPos();
 	ImVec2 local(aPosition.x - origin.x, aPosition.y - origin.y);
 
-	int lineNo = std::max(0, (int)floor(local.y / mCharAdvance.y));
+	int lineNo =
+		RowToLine(std::max(0, (int)floor(local.y / mCharAdvance.y)));
 
 	int columnCoord = 0;
 
@@ -305,7 +870,7 @@ TextEditor::ScreenPosToCoordinates(const ImVec2 &aPosition) const {
 		while ((size_t)columnIndex < line.size()) {
 			float columnWidth = 0.0f;
 
-			if (line[columnIndex].mChar == '\t') {
+			if (line[columnIndex] == '\t') {
 				float spaceSize = ImGui::GetFont()
 									  ->CalcTextSizeA(ImGui::GetFontSize(),
 													  FLT_MAX, -1.0f, " ")
@@ -323,10 +888,10 @@ TextEditor::ScreenPosToCoordinates(const ImVec2 &aPosition) const {
 				columnIndex++;
 			} else {
 				char buf[7];
-				auto d = UTF8CharLength(line[columnIndex].mChar);
+				auto d = UTF8CharLength(line[columnIndex]);
 				int i = 0;
 				while (i < 6 && d-- > 0)
-					buf[i++] = line[columnIndex++].mChar;
+					buf[i++] = line[columnIndex++];
 				buf[i] = '\0';
 				columnWidth = ImGui::GetFont()
 								  ->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX,
@@ -355,19 +920,19 @@ TextEditor::FindWordStart(const Coordinates &aFrom) const {
 	if (cindex >= (int)line.size())
 		return at;
 
-	while (cindex > 0 && isspace(line[cindex].mChar))
+	while (cindex > 0 && isspace(line[cindex]))
 		--cindex;
 
-	auto cstart = (PaletteIndex)line[cindex].mColorIndex;
+	auto cstart = line.GetColorIndex(cindex);
 	while (cindex > 0) {
-		auto c = line[cindex].mChar;
+		auto c = line[cindex];
 		if ((c & 0xC0) != 0x80) // not UTF code sequence 10xxxxxx
 		{
 			if (c <= 32 && isspace(c)) {
 				cindex++;
 				break;
 			}
-			if (cstart != (PaletteIndex)line[size_t(cindex - 1)].mColorIndex)
+			if (cstart != line.GetColorIndex(cindex - 1))
 				break;
 		}
 		--cindex;
@@ -387,17 +952,17 @@ TextEditor::FindWordEnd(const Coordinates &aFrom) const {
 	if (cindex >= (int)line.size())
 		return at;
 
-	bool prevspace = (bool)isspace(line[cindex].mChar);
-	auto cstart = (PaletteIndex)line[cindex].mColorIndex;
+	bool prevspace = (bool)isspace(line[cindex]);
+	auto cstart = line.GetColorIndex(cindex);
 	while (cindex < (int)line.size()) {
-		auto c = line[cindex].mChar;
+		auto c = line[cindex];
 		auto d = UTF8CharLength(c);
-		if (cstart != (PaletteIndex)line[cindex].mColorIndex)
+		if (cstart != line.GetColorIndex(cindex))
 			break;
 
 		if (prevspace != !!isspace(c)) {
 			if (isspace(c))
-				while (cindex < (int)line.size() && isspace(line[cindex].mChar))
+				while (cindex < (int)line.size() && isspace(line[cindex]))
 					++cindex;
 			break;
 		}
@@ -418,7 +983,7 @@ TextEditor::FindNextWord(const Coordinates &aFrom) const {
 	bool skip = false;
 	if (cindex < (int)mLines[at.mLine].size()) {
 		auto &line = mLines[at.mLine];
-		isword = isalnum(line[cindex].mChar);
+		isword = isalnum(line[cindex]);
 		skip = isword;
 	}
 
@@ -430,7 +995,7 @@ TextEditor::FindNextWord(const Coordinates &aFrom) const {
 
 		auto &line = mLines[at.mLine];
 		if (cindex < (int)line.size()) {
-			isword = isalnum(line[cindex].mChar);
+			isword = isalnum(line[cindex]);
 
 			if (isword && !skip)
 				return Coordinates(at.mLine,
@@ -458,11 +1023,11 @@ int TextEditor::GetCharacterIndex(const Coordinates &aCoordinates) const {
 	int c = 0;
 	int i = 0;
 	for (; i < line.size() && c < aCoordinates.mColumn;) {
-		if (line[i].mChar == '\t')
+		if (line[i] == '\t')
 			c = (c / mTabSize) * mTabSize + mTabSize;
 		else
 			++c;
-		i += UTF8CharLength(line[i].mChar);
+		i += UTF8CharLength(line[i]);
 	}
 	return i;
 }
@@ -474,7 +1039,7 @@ int TextEditor::GetCharacterColumn(int aLine, int aIndex) const {
 	int col = 0;
 	int i = 0;
 	while (i < aIndex && i < (int)line.size()) {
-		auto c = line[i].mChar;
+		auto c = line[i];
 		i += UTF8CharLength(c);
 		if (c == '\t')
 			col = (col / mTabSize) * mTabSize + mTabSize;
@@ -490,7 +1055,7 @@ int TextEditor::GetLineCharacterCount(int aLine) const {
 	auto &line = mLines[aLine];
 	int c = 0;
 	for (unsigned i = 0; i < line.size(); c++)
-		i += UTF8CharLength(line[i].mChar);
+		i += UTF8CharLength(line[i]);
 	return c;
 }
 
@@ -500,7 +1065,7 @@ int TextEditor::GetLineMaxColumn(int aLine) const {
 	auto &line = mLines[aLine];
 	int col = 0;
 	for (unsigned i = 0; i < line.size();) {
-		auto c = line[i].mChar;
+		auto c = line[i];
 		if (c == '\t')
 			col = (col / mTabSize) * mTabSize + mTabSize;
 		else
@@ -520,9 +1085,9 @@ bool TextEditor::IsOnWordBoundary(const Coordinates &aAt) const {
 		return true;
 
 	if (mColorizerEnabled)
-		return line[cindex].mColorIndex != line[size_t(cindex - 1)].mColorIndex;
+		return line.GetColorIndex(cindex) != line.GetColorIndex(cindex - 1);
 
-	return isspace(line[cindex].mChar) != isspace(line[cindex - 1].mChar);
+	return isspace(line[cindex]) != isspace(line[cindex - 1]);
 }
 
 void TextEditor::RemoveLine(int aStart, int aEnd) {
@@ -548,7 +1113,18 @@ void TextEditor::RemoveLine(int aStart, int aEnd) {
 	}
 	mBreakpoints = std::move(btmp);
 
-	mLines.erase(mLines.begin() + aStart, mLines.begin() + aEnd);
+	Folds ftmp;
+	for (auto i : mFolds) {
+		if (i >= aStart && i < aEnd)
+			continue;
+		ftmp.insert(i >= aEnd ? i - (aEnd - aStart) : i);
+	}
+	mFolds = std::move(ftmp);
+
+	mLines.erase(aStart, aEnd);
+	mLineStates.erase(mLineStates.begin() + aStart,
+					  mLineStates.begin() + aEnd);
+	mBracketTree.Clear();
 	assert(!mLines.empty());
 
 	mTextChanged = true;
@@ -577,7 +1153,17 @@ void TextEditor::RemoveLine(int aIndex) {
 	}
 	mBreakpoints = std::move(btmp);
 
-	mLines.erase(mLines.begin() + aIndex);
+	Folds ftmp;
+	for (auto i : mFolds) {
+		if (i == aIndex)
+			continue;
+		ftmp.insert(i >= aIndex ? i - 1 : i);
+	}
+	mFolds = std::move(ftmp);
+
+	mLines.erase(aIndex);
+	mLineStates.erase(mLineStates.begin() + aIndex);
+	mBracketTree.Clear();
 	assert(!mLines.empty());
 
 	mTextChanged = true;
@@ -587,7 +1173,9 @@ void TextEditor::RemoveLine(int aIndex) {
 TextEditor::Line &TextEditor::InsertLine(int aIndex) {
 	assert(!mReadOnly);
 
-	auto &result = *mLines.insert(mLines.begin() + aIndex, Line());
+	auto &result = mLines.insert(aIndex, Line());
+	mLineStates.insert(mLineStates.begin() + aIndex, LineState());
+	mBracketTree.Clear();
 
 	ErrorMarkers etmp;
 	for (auto &i : mErrorMarkers)
@@ -600,9 +1188,39 @@ TextEditor::Line &TextEditor::InsertLine(int aIndex) {
 		btmp.insert(i >= aIndex ? i + 1 : i);
 	mBreakpoints = std::move(btmp);
 
+	Folds ftmp;
+	for (auto i : mFolds)
+		ftmp.insert(i >= aIndex ? i + 1 : i);
+	mFolds = std::move(ftmp);
+
 	return result;
 }
 
+void TextEditor::InsertLines(int aIndex, std::vector<Line> &&aLines) {
+	assert(!mReadOnly);
+
+	const int count = (int)aLines.size();
+	mLines.insert(aIndex, std::move(aLines));
+	mLineStates.insert(mLineStates.begin() + aIndex, count, LineState());
+	mBracketTree.Clear();
+
+	ErrorMarkers etmp;
+	for (auto &i : mErrorMarkers)
+		etmp.insert(ErrorMarkers::value_type(
+			i.first >= aIndex ? i.first + count : i.first, i.second));
+	mErrorMarkers = std::move(etmp);
+
+	Breakpoints btmp;
+	for (auto i : mBreakpoints)
+		btmp.insert(i >= aIndex ? i + count : i);
+	mBreakpoints = std::move(btmp);
+
+	Folds ftmp;
+	for (auto i : mFolds)
+		ftmp.insert(i >= aIndex ? i + count : i);
+	mFolds = std::move(ftmp);
+}
+
 std::string TextEditor::GetWordUnderCursor() const {
 	auto c = GetCursorPosition();
 	return GetWordAt(c);
@@ -618,20 +1236,20 @@ std::string TextEditor::GetWordAt(const Coordinates &aCoords) const {
 	auto iend = GetCharacterIndex(end);
 
 	for (auto it = istart; it < iend; ++it)
-		r.push_back(mLines[aCoords.mLine][it].mChar);
+		r.push_back(mLines[aCoords.mLine][it]);
 
 	return r;
 }
 
-ImU32 TextEditor::GetGlyphColor(const Glyph &aGlyph) const {
+ImU32 TextEditor::GetStyleColor(Style aStyle) const {
 	if (!mColorizerEnabled)
 		return mPalette[(int)PaletteIndex::Default];
-	if (aGlyph.mComment)
+	if (aStyle & StyleComment)
 		return mPalette[(int)PaletteIndex::Comment];
-	if (aGlyph.mMultiLineComment)
+	if (aStyle & StyleMultiLineComment)
 		return mPalette[(int)PaletteIndex::MultiLineComment];
-	auto const color = mPalette[(int)aGlyph.mColorIndex];
-	if (aGlyph.mPreprocessor) {
+	auto const color = mPalette[aStyle & StyleColorMask];
+	if (aStyle & StylePreprocessor) {
 		const auto ppcolor = mPalette[(int)PaletteIndex::Preprocessor];
 		const int c0 = ((ppcolor & 0xff) + (color & 0xff)) / 2;
 		const int c1 = (((ppcolor >> 8) & 0xff) + ((color >> 8) & 0xff)) / 2;
@@ -642,6 +1260,10 @@ ImU32 TextEditor::GetGlyphColor(const Glyph &aGlyph) const {
 	return color;
 }
 
+static bool IsIdentifierChar(const ImWchar c) {
+	return c < 128 && (isalnum(c) || c == '_');
+}
+
 void TextEditor::HandleKeyboardInputs() {
 	ImGuiIO &io = ImGui::GetIO();
 	auto shift = io.KeyShift;
@@ -656,7 +1278,29 @@ void TextEditor::HandleKeyboardInputs() {
 		io.WantCaptureKeyboard = true;
 		io.WantTextInput = true;
 
-		if (!IsReadOnly() && ctrl && !shift && !alt &&
+		// the popup takes the keys it needs before the text does
+		if (mCompletionOpen && ImGui::IsKeyPressed(ImGuiKey_Escape))
+			mCompletionOpen = false;
+		else if (mCompletionOpen && !ctrl && !alt &&
+				 ImGui::IsKeyPressed(ImGuiKey_UpArrow))
+			MoveCompletion(-1);
+		else if (mCompletionOpen && !ctrl && !alt &&
+				 ImGui::IsKeyPressed(ImGuiKey_DownArrow))
+			MoveCompletion(1);
+		else if (mCompletionOpen && !ctrl && !alt &&
+				 ImGui::IsKeyPressed(ImGuiKey_PageUp))
+			MoveCompletion(-visibleCompletions);
+		else if (mCompletionOpen && !ctrl && !alt &&
+				 ImGui::IsKeyPressed(ImGuiKey_PageDown))
+			MoveCompletion(visibleCompletions);
+		else if (mCompletionOpen && !ctrl && !shift && !alt &&
+				 (ImGui::IsKeyPressed(ImGuiKey_Enter) ||
+				  ImGui::IsKeyPressed(ImGuiKey_Tab)))
+			AcceptCompletion();
+		else if (!IsReadOnly() && ctrl && !shift && !alt &&
+				 ImGui::IsKeyPressed(ImGuiKey_Space))
+			UpdateCompletion(1);
+		else if (!IsReadOnly() && ctrl && !shift && !alt &&
 			ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_Z)))
 			Undo();
 		else if (!IsReadOnly() && !ctrl && !shift && alt &&
@@ -725,9 +1369,18 @@ void TextEditor::HandleKeyboardInputs() {
 		else if (ctrl && !shift && !alt &&
 				 ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_F)))
 			QuakePrism::isFindOpen = !QuakePrism::isFindOpen;
+		else if (ctrl && shift && !alt &&
+				 ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_F)))
+			QuakePrism::isFindInFilesOpen = true;
+		else if (!ctrl && !shift && !alt && ImGui::IsKeyPressed(ImGuiKey_F12))
+			QuakePrism::GoToDefinition(GetWordUnderCursor());
+		else if (!ctrl && shift && !alt && ImGui::IsKeyPressed(ImGuiKey_F12))
+			QuakePrism::ShowReferences(GetWordUnderCursor());
+		else if (ctrl && shift && !alt &&
+				 ImGui::IsKeyPressed(ImGuiKey_LeftBracket))
+			ToggleFold(GetActualCursorCoordinates().mLine);
 		else if (ctrl && !shift && !alt && ImGui::IsKeyPressed(ImGuiKey_S)) {
 			QuakePrism::SaveFromEditor(this);
-			mUnsaved = false;
 		} else if (ctrl && !shift && !alt &&
 				   ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_A)))
 			SelectAll();
@@ -739,14 +1392,24 @@ void TextEditor::HandleKeyboardInputs() {
 			EnterCharacter('\t', shift);
 
 		if (!IsReadOnly() && !io.InputQueueCharacters.empty()) {
+			bool word = false;
 			for (int i = 0; i < io.InputQueueCharacters.Size; i++) {
 				auto c = io.InputQueueCharacters[i];
-				if (c != 0 && (c == '\n' || c >= 32))
+				if (c != 0 && (c == '\n' || c >= 32)) {
 					EnterCharacter(c, shift);
+					word = IsIdentifierChar(c);
+				}
 			}
 			io.InputQueueCharacters.resize(0);
+
+			// typing a name offers completions, anything else ends them
+			if (word)
+				UpdateCompletion(minCompletionPrefix);
+			else
+				mCompletionOpen = false;
 		}
-	}
+	} else
+		mCompletionOpen = false;
 }
 
 void TextEditor::HandleMouseInputs() {
@@ -805,6 +1468,14 @@ void TextEditor::HandleMouseInputs() {
 			Left mouse button click
 			*/
 			else if (click) {
+				// the fold markers sit in the two spaces before the text
+				const float x =
+					ImGui::GetMousePos().x - ImGui::GetCursorScreenPos().x;
+				if (x < mTextStart && x >= mTextStart - 2.0f * mCharAdvance.x &&
+					ToggleFold(
+						ScreenPosToCoordinates(ImGui::GetMousePos()).mLine))
+					return;
+
 				mState.mCursorPosition = mInteractiveStart = mInteractiveEnd =
 					ScreenPosToCoordinates(ImGui::GetMousePos());
 				if (ctrl)
@@ -844,7 +1515,6 @@ void TextEditor::Render() {
 		mPalette[i] = ImGui::ColorConvertFloat4ToU32(color);
 	}
 
-	assert(mLineBuffer.empty());
 
 	auto contentSize = ImGui::GetWindowContentRegionMax();
 	auto drawList = ImGui::GetWindowDrawList();
@@ -859,12 +1529,15 @@ void TextEditor::Render() {
 	auto scrollX = ImGui::GetScrollX();
 	auto scrollY = ImGui::GetScrollY();
 
-	auto lineNo = (int)floor(scrollY / mCharAdvance.y);
+	// folded blocks take no rows, so lines are reached through rows
+	UpdateFolds();
+	auto row = (int)floor(scrollY / mCharAdvance.y);
+	auto lineNo = RowToLine(row);
 	auto globalLineMax = (int)mLines.size();
-	auto lineMax =
-		std::max(0, std::min((int)mLines.size() - 1,
-							 lineNo + (int)floor((scrollY + contentSize.y) /
-												 mCharAdvance.y)));
+	auto lineMax = std::max(
+		0, std::min((int)mLines.size() - 1,
+					RowToLine(row + (int)floor((scrollY + contentSize.y) /
+											   mCharAdvance.y))));
 
 	// Deduce mTextStart by evaluating mLines size (global lineMax) plus two
 	// spaces as text width
@@ -877,14 +1550,28 @@ void TextEditor::Render() {
 				 mLeftMargin;
 
 	if (!mLines.empty()) {
+		RenderFindMatches(lineNo, lineMax, cursorScreenPos);
+
 		float spaceSize = ImGui::GetFont()
 							  ->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX,
 											  -1.0f, " ", nullptr, nullptr)
 							  .x;
 
+		// the bracket pair around the cursor, found again after edits or
+		// once the cursor moves
+		const auto cursor = GetActualCursorCoordinates();
+		if (mBracketVersion != mTextVersion || mBracketCursor != cursor) {
+			mBracketFound =
+				FindMatchingBracket(cursor, mBracketStart, mBracketMatch);
+			if (mBracketFound || IsBracketIndexReady()) {
+				mBracketVersion = mTextVersion;
+				mBracketCursor = cursor;
+			}
+		}
+
 		while (lineNo <= lineMax) {
 			ImVec2 lineStartScreenPos = ImVec2(
-				cursorScreenPos.x, cursorScreenPos.y + lineNo * mCharAdvance.y);
+				cursorScreenPos.x, cursorScreenPos.y + row * mCharAdvance.y);
 			ImVec2 textScreenPos =
 				ImVec2(lineStartScreenPos.x + mTextStart, lineStartScreenPos.y);
 
@@ -893,7 +1580,6 @@ void TextEditor::Render() {
 				std::max(mTextStart + TextDistanceToLineStart(Coordinates(
 										  lineNo, GetLineMaxColumn(lineNo))),
 						 longest);
-			auto columnNo = 0;
 			Coordinates lineStartCoord(lineNo, 0);
 			Coordinates lineEndCoord(lineNo, GetLineMaxColumn(lineNo));
 
@@ -972,6 +1658,46 @@ void TextEditor::Render() {
 					   lineStartScreenPos.y),
 				mPalette[(int)PaletteIndex::LineNumber], buf);
 
+			// Draw the fold marker of blocks that can be folded
+			const bool folded = IsFolded(lineNo);
+			if (folded || (mLineStates[lineNo].mOpens[BracketCurly] > 0 &&
+						   FindFoldEnd(lineNo) >= 0)) {
+				const float s = ImGui::GetFontSize() * 0.25f;
+				const ImVec2 center(
+					lineStartScreenPos.x + mTextStart - spaceSize,
+					lineStartScreenPos.y + mCharAdvance.y * 0.5f);
+				if (folded)
+					drawList->AddTriangleFilled(
+						ImVec2(center.x - s * 0.5f, center.y - s),
+						ImVec2(center.x - s * 0.5f, center.y + s),
+						ImVec2(center.x + s * 0.5f, center.y),
+						mPalette[(int)PaletteIndex::LineNumber]);
+				else
+					drawList->AddTriangleFilled(
+						ImVec2(center.x - s, center.y - s * 0.5f),
+						ImVec2(center.x + s, center.y - s * 0.5f),
+						ImVec2(center.x, center.y + s * 0.5f),
+						mPalette[(int)PaletteIndex::LineNumber]);
+			}
+
+			// Draw the bracket at the cursor and the one it pairs with
+			if (mBracketFound) {
+				for (const auto &bracket : {mBracketStart, mBracketMatch}) {
+					if (bracket.mLine != lineNo)
+						continue;
+					const float x = TextDistanceToLineStart(bracket);
+					const ImVec2 bstart(textScreenPos.x + x,
+										lineStartScreenPos.y);
+					const ImVec2 bend(
+						textScreenPos.x +
+							TextDistanceToLineStart(Coordinates(
+								bracket.mLine, bracket.mColumn + 1)),
+						lineStartScreenPos.y + mCharAdvance.y);
+					drawList->AddRect(bstart, bend,
+									  mPalette[(int)PaletteIndex::Punctuation]);
+				}
+			}
+
 			if (mState.mCursorPosition.mLine == lineNo) {
 				auto focused = ImGui::IsWindowFocused();
 
@@ -1004,7 +1730,7 @@ void TextEditor::Render() {
 							TextDistanceToLineStart(mState.mCursorPosition);
 
 						if (mOverwrite && cindex < (int)line.size()) {
-							auto c = line[cindex].mChar;
+							auto c = line[cindex];
 							if (c == '\t') {
 								auto x = (1.0f + std::floor((1.0f + cx) /
 															(float(mTabSize) *
@@ -1013,7 +1739,7 @@ void TextEditor::Render() {
 								width = x - cx;
 							} else {
 								char buf2[2];
-								buf2[0] = line[cindex].mChar;
+								buf2[0] = line[cindex];
 								buf2[1] = '\0';
 								width =
 									ImGui::GetFont()
@@ -1034,88 +1760,103 @@ void TextEditor::Render() {
 				}
 			}
 
-			// Render colorized text
-			auto prevColor = line.empty() ? mPalette[(int)PaletteIndex::Default]
-										  : GetGlyphColor(line[0]);
+			// Render colorized text, one draw call per run of same colored
+			// characters between whitespace, straight out of the line's bytes
+			const char *text = line.GetText().data();
 			ImVec2 bufferOffset;
-
-			for (int i = 0; i < line.size();) {
-				auto &glyph = line[i];
-				auto color = GetGlyphColor(glyph);
-
-				if ((color != prevColor || glyph.mChar == '\t' ||
-					 glyph.mChar == ' ') &&
-					!mLineBuffer.empty()) {
-					const ImVec2 newOffset(textScreenPos.x + bufferOffset.x,
-										   textScreenPos.y + bufferOffset.y);
-					drawList->AddText(newOffset, prevColor,
-									  mLineBuffer.c_str());
-					auto textSize = ImGui::GetFont()->CalcTextSizeA(
-						ImGui::GetFontSize(), FLT_MAX, -1.0f,
-						mLineBuffer.c_str(), nullptr, nullptr);
-					bufferOffset.x += textSize.x;
-					mLineBuffer.clear();
-				}
-				prevColor = color;
-
-				if (glyph.mChar == '\t') {
-					auto oldX = bufferOffset.x;
-					bufferOffset.x =
-						(1.0f + std::floor((1.0f + bufferOffset.x) /
-										   (float(mTabSize) * spaceSize))) *
-						(float(mTabSize) * spaceSize);
-					++i;
-
-					if (mShowWhitespaces) {
-						const auto s = ImGui::GetFontSize();
-						const auto x1 = textScreenPos.x + oldX + 1.0f;
-						const auto x2 = textScreenPos.x + bufferOffset.x - 1.0f;
-						const auto y =
-							textScreenPos.y + bufferOffset.y + s * 0.5f;
-						const ImVec2 p1(x1, y);
-						const ImVec2 p2(x2, y);
-						const ImVec2 p3(x2 - s * 0.2f, y - s * 0.2f);
-						const ImVec2 p4(x2 - s * 0.2f, y + s * 0.2f);
-						drawList->AddLine(p1, p2, 0x90909090);
-						drawList->AddLine(p2, p3, 0x90909090);
-						drawList->AddLine(p2, p4, 0x90909090);
-					}
-				} else if (glyph.mChar == ' ') {
-					if (mShowWhitespaces) {
-						const auto s = ImGui::GetFontSize();
-						const auto x =
-							textScreenPos.x + bufferOffset.x + spaceSize * 0.5f;
-						const auto y =
-							textScreenPos.y + bufferOffset.y + s * 0.5f;
-						drawList->AddCircleFilled(ImVec2(x, y), 1.5f,
-												  0x80808080, 4);
+			uint32_t spanStart = 0;
+			for (auto &span : line.GetSpans()) {
+				const auto color = GetStyleColor(span.mStyle);
+
+				for (uint32_t i = spanStart; i < span.mEnd;) {
+					const auto c = line[i];
+					if (c == '\t') {
+						auto oldX = bufferOffset.x;
+						bufferOffset.x =
+							(1.0f + std::floor((1.0f + bufferOffset.x) /
+											   (float(mTabSize) * spaceSize))) *
+							(float(mTabSize) * spaceSize);
+						++i;
+
+						if (mShowWhitespaces) {
+							const auto s = ImGui::GetFontSize();
+							const auto x1 = textScreenPos.x + oldX + 1.0f;
+							const auto x2 =
+								textScreenPos.x + bufferOffset.x - 1.0f;
+							const auto y =
+								textScreenPos.y + bufferOffset.y + s * 0.5f;
+							const ImVec2 p1(x1, y);
+							const ImVec2 p2(x2, y);
+							const ImVec2 p3(x2 - s * 0.2f, y - s * 0.2f);
+							const ImVec2 p4(x2 - s * 0.2f, y + s * 0.2f);
+							drawList->AddLine(p1, p2, 0x90909090);
+							drawList->AddLine(p2, p3, 0x90909090);
+							drawList->AddLine(p2, p4, 0x90909090);
+						}
+					} else if (c == ' ') {
+						if (mShowWhitespaces) {
+							const auto s = ImGui::GetFontSize();
+							const auto x = textScreenPos.x + bufferOffset.x +
+										   spaceSize * 0.5f;
+							const auto y =
+								textScreenPos.y + bufferOffset.y + s * 0.5f;
+							drawList->AddCircleFilled(ImVec2(x, y), 1.5f,
+													  0x80808080, 4);
+						}
+						bufferOffset.x += spaceSize;
+						++i;
+					} else {
+						auto end = i + 1;
+						while (end < span.mEnd && line[end] != '\t' &&
+							   line[end] != ' ')
+							++end;
+
+						const ImVec2 newOffset(textScreenPos.x + bufferOffset.x,
+											   textScreenPos.y +
+												   bufferOffset.y);
+						drawList->AddText(newOffset, color, text + i,
+										  text + end);
+						bufferOffset.x +=
+							ImGui::GetFont()
+								->CalcTextSizeA(ImGui::GetFontSize(), FLT_MAX,
+												-1.0f, text + i, text + end,
+												nullptr)
+								.x;
+						i = end;
 					}
-					bufferOffset.x += spaceSize;
-					i++;
-				} else {
-					auto l = UTF8CharLength(glyph.mChar);
-					while (l-- > 0)
-						mLineBuffer.push_back(line[i++].mChar);
 				}
-				++columnNo;
+				spanStart = span.mEnd;
 			}
 
-			if (!mLineBuffer.empty()) {
-				const ImVec2 newOffset(textScreenPos.x + bufferOffset.x,
-									   textScreenPos.y + bufferOffset.y);
-				drawList->AddText(newOffset, prevColor, mLineBuffer.c_str());
-				mLineBuffer.clear();
+			// Mark where a folded block's lines went
+			if (folded) {
+				const ImVec2 foldPos(textScreenPos.x + bufferOffset.x +
+										 spaceSize,
+									 textScreenPos.y);
+				drawList->AddText(foldPos,
+								  mPalette[(int)PaletteIndex::LineNumber],
+								  "...");
 			}
 
-			++lineNo;
+			lineNo = RowToLine(++row);
 		}
 
-		// Draw a tooltip on known identifiers/preprocessor symbols
-		if (ImGui::IsMousePosValid()) {
+		// Draw a tooltip on project symbols and known identifiers/preprocessor
+		// symbols
+		if (ImGui::IsMousePosValid() && ImGui::IsWindowHovered() &&
+			!mCompletionOpen) {
 			auto id = GetWordAt(ScreenPosToCoordinates(ImGui::GetMousePos()));
 			if (!id.empty()) {
+				QuakePrism::Symbols::symbol_t symbol;
 				auto it = mLanguageDefinition.mIdentifiers.find(id);
-				if (it != mLanguageDefinition.mIdentifiers.end()) {
+				if (QuakePrism::Symbols::FindDefinition(id, symbol)) {
+					ImGui::BeginTooltip();
+					ImGui::TextUnformatted(symbol.declaration.c_str());
+					ImGui::TextDisabled("%s:%d",
+										symbol.file.filename().string().c_str(),
+										symbol.line + 1);
+					ImGui::EndTooltip();
+				} else if (it != mLanguageDefinition.mIdentifiers.end()) {
 					ImGui::BeginTooltip();
 					ImGui::TextUnformatted(it->second.mDeclaration.c_str());
 					ImGui::EndTooltip();
@@ -1131,7 +1872,9 @@ void TextEditor::Render() {
 		}
 	}
 
-	ImGui::Dummy(ImVec2((longest + 2), mLines.size() * mCharAdvance.y));
+	ImGui::Dummy(ImVec2((longest + 2), GetTotalRows() * mCharAdvance.y));
+	RenderFindTicks();
+	RenderCompletion(cursorScreenPos);
 
 	if (mScrollToCursor) {
 		EnsureCursorVisible();
@@ -1155,6 +1898,9 @@ void TextEditor::Render(const char *aTitle, const ImVec2 &aSize, bool aBorder) {
 							  ImGuiWindowFlags_AlwaysHorizontalScrollbar |
 							  ImGuiWindowFlags_NoMove);
 
+	if (mLoading && !mLoadTask->IsRunning())
+		FinishLoading();
+
 	if (mHandleKeyboardInputs) {
 		HandleKeyboardInputs();
 		ImGui::PushAllowKeyboardFocus(true);
@@ -1163,6 +1909,9 @@ void TextEditor::Render(const char *aTitle, const ImVec2 &aSize, bool aBorder) {
 	if (mHandleMouseInputs)
 		HandleMouseInputs();
 
+	// clicking or moving away from the word closes the popup
+	UpdateCompletion(0);
+
 	ColorizeInternal();
 	Render();
 
@@ -1178,50 +1927,218 @@ void TextEditor::Render(const char *aTitle, const ImVec2 &aSize, bool aBorder) {
 	mWithinRender = false;
 }
 
-void TextEditor::SetText(const std::string &aText) {
-	mLines.clear();
-	mLines.emplace_back(Line());
-	for (auto chr : aText) {
-		if (chr == '\r') {
-			// ignore the carriage return character
-		} else if (chr == '\n')
-			mLines.emplace_back(Line());
-		else {
-			mLines.back().emplace_back(Glyph(chr, PaletteIndex::Default));
-		}
+// Appends the lines of [aBegin, aEnd) to aLines, an empty range being one
+// empty line just like the text after a trailing newline
+void TextEditor::SplitLines(const char *aBegin, const char *aEnd,
+							std::vector<Line> &aLines) {
+	size_t count = 1;
+	for (const char *p = aBegin;
+		 (p = (const char *)memchr(p, '\n', aEnd - p)) != nullptr; ++p)
+		++count;
+	aLines.reserve(aLines.size() + count);
+
+	for (const char *start = aBegin;;) {
+		const char *end = (const char *)memchr(start, '\n', aEnd - start);
+		const char *last = end == nullptr ? aEnd : end;
+		std::string text(start, last);
+		// ignore the carriage return characters
+		if (memchr(text.data(), '\r', text.size()) != nullptr)
+			text.erase(std::remove(text.begin(), text.end(), '\r'),
+					   text.end());
+		aLines.emplace_back(std::move(text));
+		if (end == nullptr)
+			break;
+		start = end + 1;
 	}
+}
+
+void TextEditor::SetText(const std::string &aText) {
+	SetText(aText.data(), aText.data() + aText.size());
+}
+
+void TextEditor::SetText(const char *aBegin, const char *aEnd) {
+	CancelLoading();
+
+	std::vector<Line> lines;
+	SplitLines(aBegin, aEnd, lines);
+	mLines.assign(std::move(lines));
+
+	mLineStates.assign(mLines.size(), LineState());
+	mBracketTree.Clear();
+	mFolds.clear();
 
 	mTextChanged = true;
 	mScrollToTop = true;
+	// the new text is what the file holds, or will once it is saved
+	mUnsaved = false;
 
-	mUndoBuffer.clear();
-	mUndoIndex = 0;
+	ClearUndo();
+	mEdits.clear();
 
 	Colorize();
 }
 
-void TextEditor::SetTextLines(const std::vector<std::string> &aLines) {
-	mLines.clear();
+// Shared with the load task, which hands the lines it split back through here
+// once it is done
+struct TextEditor::BackgroundLoader {
+	std::vector<Line> mLines;
+};
 
-	if (aLines.empty()) {
-		mLines.emplace_back(Line());
-	} else {
-		mLines.resize(aLines.size());
+bool TextEditor::LoadFile(const std::string &aPath) {
+	auto file = std::make_shared<QuakePrism::MappedFile>();
+	if (!file->Open(aPath))
+		return false;
+
+	if (file->Size() == 0) {
+		SetText(std::string());
+		return true;
+	}
+	const char *begin = (const char *)file->Data();
+	const char *end = begin + file->Size();
+
+	// enough lines to fill the first screen are split right away and the rest
+	// of a big file is left to the load task
+	constexpr int firstLoadLines = 1000;
+	const char *split = begin;
+	for (int i = 0; i < firstLoadLines && split != nullptr; ++i) {
+		split = (const char *)memchr(split, '\n', end - split);
+		if (split != nullptr)
+			++split;
+	}
+	if (split == nullptr || split == end) {
+		SetText(begin, end);
+		return true;
+	}
+
+	SetText(begin, split - 1);
+	mLoading = true;
+	mBackgroundLoader = std::make_shared<BackgroundLoader>();
+	mLoadTask->Start([file, loader = mBackgroundLoader, split,
+					  end](QuakePrism::Jobs::Task &) {
+		SplitLines(split, end, loader->mLines);
+	});
+	return true;
+}
+
+void TextEditor::FinishLoading() {
+	if (!mLoading)
+		return;
+	mLoadTask->Wait();
+	mLoading = false;
+
+	// the loaded lines always follow whatever the first screen was edited to
+	auto &loaded = mBackgroundLoader->mLines;
+	const int first = (int)mLines.size();
+	const int count = (int)loaded.size();
+	mLines.insert(first, std::move(loaded));
+	mLineStates.insert(mLineStates.end(), count, LineState());
+	mBracketTree.Clear();
+	mBackgroundLoader.reset();
+
+	mTextChanged = true;
+	Colorize(first, count);
+}
 
-		for (size_t i = 0; i < aLines.size(); ++i) {
-			const std::string &aLine = aLines[i];
+void TextEditor::CancelLoading() {
+	if (!mLoading)
+		return;
+	mLoadTask->Wait();
+	mLoading = false;
+	mBackgroundLoader.reset();
+}
+
+// Shared with the save task, which reports back through here whether the
+// file made it to disk
+struct TextEditor::BackgroundSaver {
+	bool mWritten = false;
+};
+
+void TextEditor::SaveFile(const std::string &aPath) {
+	mSavePath = aPath;
+	// a save asked for while one is being written follows it with the newer
+	// text
+	if (mSaveTask->IsRunning()) {
+		mSavePending = true;
+		return;
+	}
+	StartSave();
+}
+
+void TextEditor::StartSave() {
+	// the whole file has to be there before any of it is written
+	FinishLoading();
 
-			mLines[i].reserve(aLine.size());
-			for (size_t j = 0; j < aLine.size(); ++j)
-				mLines[i].emplace_back(Glyph(aLine[j], PaletteIndex::Default));
+	mSavePending = false;
+	mSaveState = SaveState::Saving;
+	// an edit made while the file is written marks it unsaved again
+	mUnsaved = false;
+
+	auto lines = std::make_shared<const Lines>(mLines);
+	mBackgroundSaver = std::make_shared<BackgroundSaver>();
+	mSaveTask->Start([lines, saver = mBackgroundSaver,
+					  path = mSavePath](QuakePrism::Jobs::Task &) {
+		size_t size = 0;
+		for (size_t i = 0; i < lines->size(); ++i)
+			size += (*lines)[i].size() + 1;
+		std::string text;
+		text.reserve(size);
+		for (size_t i = 0; i < lines->size(); ++i) {
+			if (i > 0)
+				text.push_back('\n');
+			text.append((*lines)[i].GetText());
 		}
+		// trailing whitespace and blank lines are dropped
+		const size_t end = text.find_last_not_of(" \t\n\r");
+		text.resize(end == std::string::npos ? 0 : end + 1);
+
+		saver->mWritten =
+			QuakePrism::WriteFileAtomic(path, text.data(), text.size());
+	});
+}
+
+bool TextEditor::PollSave() {
+	if (mSaveState != SaveState::Saving || mSaveTask->IsRunning())
+		return false;
+	mSaveTask->Wait();
+	const bool written = mBackgroundSaver->mWritten;
+	mBackgroundSaver.reset();
+
+	if (written && mSavePending) {
+		StartSave();
+		return false;
 	}
+	mSavePending = false;
+	mSaveState = written ? SaveState::Saved : SaveState::Failed;
+	if (!written)
+		mUnsaved = true;
+	return true;
+}
+
+void TextEditor::WaitForSave() {
+	while (mSaveState == SaveState::Saving) {
+		mSaveTask->Wait();
+		// a failed write drops the queued save, PollSave reports both
+		if (!mSavePending || !mBackgroundSaver->mWritten)
+			return;
+		PollSave(); // starts the queued save
+	}
+}
+
+void TextEditor::SetTextLines(const std::vector<std::string> &aLines) {
+	std::vector<Line> lines(aLines.begin(), aLines.end());
+	if (lines.empty())
+		lines.emplace_back();
+	mLines.assign(std::move(lines));
+
+	mLineStates.assign(mLines.size(), LineState());
+	mBracketTree.Clear();
+	mFolds.clear();
 
 	mTextChanged = true;
 	mScrollToTop = true;
+	mUnsaved = false;
 
-	mUndoBuffer.clear();
-	mUndoIndex = 0;
+	ClearUndo();
 
 	Colorize();
 }
@@ -1265,22 +2182,20 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift) {
 				auto &line = mLines[i];
 				if (aShift) {
 					if (!line.empty()) {
-						if (line.front().mChar == '\t') {
-							line.erase(line.begin());
+						if (line[0] == '\t') {
+							line.erase(0, 1);
 							modified = true;
 						} else {
 							for (int j = 0; j < mTabSize && !line.empty() &&
-											line.front().mChar == ' ';
+											line[0] == ' ';
 								 j++) {
-								line.erase(line.begin());
+								line.erase(0, 1);
 								modified = true;
 							}
 						}
 					}
 				} else {
-					line.insert(
-						line.begin(),
-						Glyph('\t', TextEditor::PaletteIndex::Background));
+					line.insert(0, "\t", 1);
 					modified = true;
 				}
 			}
@@ -1310,6 +2225,7 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift) {
 
 				mTextChanged = true;
 				mUnsaved = true;
+				Colorize(start.mLine, end.mLine - start.mLine + 1);
 
 				EnsureCursorVisible();
 			}
@@ -1334,16 +2250,17 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift) {
 		auto &line = mLines[coord.mLine];
 		auto &newLine = mLines[coord.mLine + 1];
 
+		size_t whitespaceSize = 0;
 		if (mLanguageDefinition.mAutoIndentation)
-			for (size_t it = 0; it < line.size() && isascii(line[it].mChar) &&
-								isblank(line[it].mChar);
-				 ++it)
-				newLine.push_back(line[it]);
+			while (whitespaceSize < line.size() &&
+				   isascii(line[whitespaceSize]) &&
+				   isblank(line[whitespaceSize]))
+				++whitespaceSize;
+		newLine.insert(0, line.GetText().data(), whitespaceSize);
 
-		const size_t whitespaceSize = newLine.size();
 		auto cindex = GetCharacterIndex(coord);
-		newLine.insert(newLine.end(), line.begin() + cindex, line.end());
-		line.erase(line.begin() + cindex, line.begin() + line.size());
+		newLine.append(line, cindex);
+		line.erase(cindex, line.size());
 		SetCursorPosition(Coordinates(
 			coord.mLine + 1,
 			GetCharacterColumn(coord.mLine + 1, (int)whitespaceSize)));
@@ -1357,21 +2274,19 @@ void TextEditor::EnterCharacter(ImWchar aChar, bool aShift) {
 			auto cindex = GetCharacterIndex(coord);
 
 			if (mOverwrite && cindex < (int)line.size()) {
-				auto d = UTF8CharLength(line[cindex].mChar);
+				auto d = UTF8CharLength(line[cindex]);
 
 				u.mRemovedStart = mState.mCursorPosition;
 				u.mRemovedEnd = Coordinates(
 					coord.mLine, GetCharacterColumn(coord.mLine, cindex + d));
 
-				while (d-- > 0 && cindex < (int)line.size()) {
-					u.mRemoved += line[cindex].mChar;
-					line.erase(line.begin() + cindex);
-				}
+				d = std::min(d, (int)line.size() - cindex);
+				u.mRemoved.append(line.GetText(), cindex, d);
+				line.erase(cindex, cindex + d);
 			}
 
-			for (auto p = buf; *p != '\0'; p++, ++cindex)
-				line.insert(line.begin() + cindex,
-							Glyph(*p, PaletteIndex::Default));
+			line.insert(cindex, buf, e);
+			cindex += e;
 			u.mAdded = buf;
 
 			SetCursorPosition(Coordinates(
@@ -1404,6 +2319,14 @@ void TextEditor::SetCursorPosition(const Coordinates &aPosition) {
 	}
 }
 
+TextEditor::Coordinates TextEditor::IndexToCoordinates(int aLine,
+													   int aIndex) const {
+	if (mLines.empty())
+		return Coordinates();
+	aLine = std::max(0, std::min(aLine, (int)mLines.size() - 1));
+	return Coordinates(aLine, GetCharacterColumn(aLine, std::max(0, aIndex)));
+}
+
 void TextEditor::SetSelectionStart(const Coordinates &aPosition) {
 	mState.mSelectionStart = SanitizeCoordinates(aPosition);
 	if (mState.mSelectionStart > mState.mSelectionEnd)
@@ -1491,8 +2414,8 @@ void TextEditor::DeleteSelection() {
 
 void TextEditor::MoveUp(int aAmount, bool aSelect) {
 	auto oldPos = mState.mCursorPosition;
-	mState.mCursorPosition.mLine =
-		std::max(0, mState.mCursorPosition.mLine - aAmount);
+	mState.mCursorPosition.mLine = RowToLine(
+		std::max(0, LineToRow(mState.mCursorPosition.mLine) - aAmount));
 	if (oldPos != mState.mCursorPosition) {
 		if (aSelect) {
 			if (oldPos == mInteractiveStart)
@@ -1514,9 +2437,9 @@ void TextEditor::MoveUp(int aAmount, bool aSelect) {
 void TextEditor::MoveDown(int aAmount, bool aSelect) {
 	assert(mState.mCursorPosition.mColumn >= 0);
 	auto oldPos = mState.mCursorPosition;
-	mState.mCursorPosition.mLine =
-		std::max(0, std::min((int)mLines.size() - 1,
-							 mState.mCursorPosition.mLine + aAmount));
+	mState.mCursorPosition.mLine = RowToLine(std::max(
+		0, std::min(GetTotalRows() - 1,
+					LineToRow(mState.mCursorPosition.mLine) + aAmount)));
 
 	if (mState.mCursorPosition != oldPos) {
 		if (aSelect) {
@@ -1561,7 +2484,7 @@ void TextEditor::MoveLeft(int aAmount, bool aSelect, bool aWordMode) {
 			if (cindex > 0) {
 				if ((int)mLines.size() > line) {
 					while (cindex > 0 &&
-						   IsUTFSequence(mLines[line][cindex].mChar))
+						   IsUTFSequence(mLines[line][cindex]))
 						--cindex;
 				}
 			}
@@ -1617,7 +2540,7 @@ void TextEditor::MoveRight(int aAmount, bool aSelect, bool aWordMode) {
 			} else
 				return;
 		} else {
-			cindex += UTF8CharLength(line[cindex].mChar);
+			cindex += UTF8CharLength(line[cindex]);
 			mState.mCursorPosition =
 				Coordinates(lindex, GetCharacterColumn(lindex, cindex));
 			if (aWordMode)
@@ -1739,7 +2662,7 @@ void TextEditor::Delete() {
 			Advance(u.mRemovedEnd);
 
 			auto &nextLine = mLines[pos.mLine + 1];
-			line.insert(line.end(), nextLine.begin(), nextLine.end());
+			line.append(nextLine);
 			RemoveLine(pos.mLine + 1);
 		} else {
 			auto cindex = GetCharacterIndex(pos);
@@ -1747,9 +2670,8 @@ void TextEditor::Delete() {
 			u.mRemovedEnd.mColumn++;
 			u.mRemoved = GetText(u.mRemovedStart, u.mRemovedEnd);
 
-			auto d = UTF8CharLength(line[cindex].mChar);
-			while (d-- > 0 && cindex < (int)line.size())
-				line.erase(line.begin() + cindex);
+			auto d = UTF8CharLength(line[cindex]);
+			line.erase(cindex, std::min(cindex + d, (int)line.size()));
 		}
 
 		mTextChanged = true;
@@ -1793,7 +2715,7 @@ void TextEditor::Backspace() {
 			auto &line = mLines[mState.mCursorPosition.mLine];
 			auto &prevLine = mLines[mState.mCursorPosition.mLine - 1];
 			auto prevSize = GetLineMaxColumn(mState.mCursorPosition.mLine - 1);
-			prevLine.insert(prevLine.end(), line.begin(), line.end());
+			prevLine.append(line);
 
 			ErrorMarkers etmp;
 			for (auto &i : mErrorMarkers)
@@ -1810,19 +2732,20 @@ void TextEditor::Backspace() {
 			auto &line = mLines[mState.mCursorPosition.mLine];
 			auto cindex = GetCharacterIndex(pos) - 1;
 			auto cend = cindex + 1;
-			while (cindex > 0 && IsUTFSequence(line[cindex].mChar))
+			while (cindex > 0 && IsUTFSequence(line[cindex]))
 				--cindex;
 
-			// if (cindex > 0 && UTF8CharLength(line[cindex].mChar) > 1)
+			// if (cindex > 0 && UTF8CharLength(line[cindex]) > 1)
 			//	--cindex;
 
 			u.mRemovedStart = u.mRemovedEnd = GetActualCursorCoordinates();
 			--u.mRemovedStart.mColumn;
 			--mState.mCursorPosition.mColumn;
 
-			while (cindex < line.size() && cend-- > cindex) {
-				u.mRemoved += line[cindex].mChar;
-				line.erase(line.begin() + cindex);
+			cend = std::min(cend, (int)line.size());
+			if (cindex < cend) {
+				u.mRemoved.append(line.GetText(), cindex, cend - cindex);
+				line.erase(cindex, cend);
 			}
 		}
 
@@ -1886,7 +2809,7 @@ bool TextEditor::FindNextOccurrence(const char *aText, int aTextSize,
 						break;
 				} else {
 					char toCompareA =
-						mLines[fline + lineOffset][currentCharIndex].mChar;
+						mLines[fline + lineOffset][currentCharIndex];
 					char toCompareB = aText[i];
 					toCompareA = (toCompareA >= 'A' && toCompareA <= 'Z')
 									 ? toCompareA - 'A' + 'a'
@@ -1931,16 +2854,379 @@ bool TextEditor::FindNextOccurrence(const char *aText, int aTextSize,
 	return false;
 }
 
+static bool IsFindMatchBefore(const TextEditor::FindMatch &aLeft,
+							  const TextEditor::FindMatch &aRight) {
+	if (aLeft.mLine != aRight.mLine)
+		return aLeft.mLine < aRight.mLine;
+	return aLeft.mStart < aRight.mStart;
+}
+
+void TextEditor::SetFindQuery(const std::string &aPattern,
+							  const FindOptions &aOptions) {
+	if (aPattern == mFindPattern && aOptions == mFindOptions)
+		return;
+
+	mFindPattern = aPattern;
+	mFindOptions = aOptions;
+	mFindError.clear();
+	mFindMatches.clear();
+	mFindVersion = 0;
+
+	if (mFindOptions.mRegex && !mFindPattern.empty()) {
+		auto flags = std::regex_constants::ECMAScript |
+					 std::regex_constants::optimize;
+		if (!mFindOptions.mCaseSensitive)
+			flags |= std::regex_constants::icase;
+		try {
+			mFindRegex.assign(mFindPattern, flags);
+		} catch (const std::regex_error &e) {
+			mFindError = e.what();
+		}
+	}
+}
+
+const TextEditor::FindMatches &TextEditor::GetFindMatches() {
+	UpdateFindMatches();
+	return mFindMatches;
+}
+
+void TextEditor::UpdateFindMatches() {
+	if (mFindVersion == mTextVersion)
+		return;
+	mFindVersion = mTextVersion;
+	mFindMatches.clear();
+	if (mFindPattern.empty() || !mFindError.empty())
+		return;
+
+	const bool wholeWord = mFindOptions.mWholeWord;
+	auto addMatch = [&](int aLine, const std::string &aText, size_t aStart,
+						size_t aEnd) {
+		const char *text = aText.data();
+		if (aStart == aEnd)
+			return false;
+		if (wholeWord &&
+			!QuakePrism::Search::IsWholeWord(text, text + aText.size(),
+											 text + aStart, text + aEnd))
+			return false;
+		mFindMatches.push_back({aLine, (int)aStart, (int)aEnd});
+		return true;
+	};
+
+	const int lineCount = (int)mLines.size();
+	if (mFindOptions.mRegex) {
+		for (int i = 0; i < lineCount; ++i) {
+			const auto &text = mLines[i].GetText();
+			const char *begin = text.data();
+			std::cregex_iterator it(begin, begin + text.size(), mFindRegex);
+			for (; it != std::cregex_iterator(); ++it)
+				addMatch(i, text, it->position(),
+						 it->position() + it->length());
+		}
+		return;
+	}
+
+	const QuakePrism::Search::LiteralFinder finder(
+		mFindPattern, mFindOptions.mCaseSensitive);
+	const size_t size = mFindPattern.size();
+	for (int i = 0; i < lineCount; ++i) {
+		const auto &text = mLines[i].GetText();
+		const char *begin = text.data();
+		const char *end = begin + text.size();
+		for (const char *p = begin; (p = finder.Find(p, end)) != nullptr;)
+			p += addMatch(i, text, p - begin, p - begin + size) ? size : 1;
+	}
+}
+
+TextEditor::Coordinates
+TextEditor::FindMatchStart(const FindMatch &aMatch) const {
+	return Coordinates(aMatch.mLine,
+					   GetCharacterColumn(aMatch.mLine, aMatch.mStart));
+}
+
+TextEditor::Coordinates
+TextEditor::FindMatchEnd(const FindMatch &aMatch) const {
+	return Coordinates(aMatch.mLine,
+					   GetCharacterColumn(aMatch.mLine, aMatch.mEnd));
+}
+
+int TextEditor::GetCurrentFindMatch() {
+	UpdateFindMatches();
+	if (!HasSelection())
+		return -1;
+
+	const auto &start = mState.mSelectionStart;
+	const FindMatch key = {start.mLine, GetCharacterIndex(start), 0};
+	auto it = std::lower_bound(mFindMatches.begin(), mFindMatches.end(), key,
+							   IsFindMatchBefore);
+	if (it == mFindMatches.end() || it->mLine != key.mLine ||
+		it->mStart != key.mStart || FindMatchEnd(*it) != mState.mSelectionEnd)
+		return -1;
+	return (int)(it - mFindMatches.begin());
+}
+
+bool TextEditor::SelectNextMatch(bool aBackwards, bool aKeepCurrent) {
+	UpdateFindMatches();
+	if (mFindMatches.empty())
+		return false;
+
+	auto from = GetActualCursorCoordinates();
+	if (HasSelection() && (aBackwards || aKeepCurrent))
+		from = mState.mSelectionStart;
+	const FindMatch key = {from.mLine, GetCharacterIndex(from), 0};
+	auto it = std::lower_bound(mFindMatches.begin(), mFindMatches.end(), key,
+							   IsFindMatchBefore);
+
+	if (aBackwards) {
+		if (it == mFindMatches.begin())
+			it = mFindMatches.end();
+		--it;
+	} else if (it == mFindMatches.end())
+		it = mFindMatches.begin();
+
+	const auto start = FindMatchStart(*it);
+	const auto end = FindMatchEnd(*it);
+	SetSelection(start, end);
+	SetCursorPosition(end);
+	EnsureCursorVisible();
+	return true;
+}
+
+void TextEditor::RenderFindMatches(int aFirstLine, int aLastLine,
+								   const ImVec2 &aScreenPos) {
+	if (mFindPattern.empty())
+		return;
+	UpdateFindMatches();
+
+	auto drawList = ImGui::GetWindowDrawList();
+	auto it = std::lower_bound(
+		mFindMatches.begin(), mFindMatches.end(), aFirstLine,
+		[](const FindMatch &match, int line) { return match.mLine < line; });
+	for (; it != mFindMatches.end() && it->mLine <= aLastLine; ++it) {
+		const int row = LineToRow(it->mLine);
+		if (RowToLine(row) != it->mLine)
+			continue; // folded away
+		const float x = aScreenPos.x + mTextStart;
+		const float y = aScreenPos.y + row * mCharAdvance.y;
+		const ImVec2 start(x + TextDistanceToLineStart(FindMatchStart(*it)),
+						   y);
+		const ImVec2 end(x + TextDistanceToLineStart(FindMatchEnd(*it)),
+						 y + mCharAdvance.y);
+		drawList->AddRectFilled(start, end,
+								mPalette[(int)PaletteIndex::FindMatch]);
+	}
+}
+
+void TextEditor::RenderFindTicks() {
+	if (mFindPattern.empty() || mFindMatches.empty() || mLines.empty())
+		return;
+
+	// the ticks sit on the vertical scrollbar, above the horizontal one
+	const auto pos = ImGui::GetWindowPos();
+	const auto size = ImGui::GetWindowSize();
+	const float barSize = ImGui::GetStyle().ScrollbarSize;
+	const float left = pos.x + size.x - barSize;
+	const float right = pos.x + size.x;
+	const float height = size.y - barSize;
+	if (height <= 0.0f)
+		return;
+
+	auto drawList = ImGui::GetWindowDrawList();
+	const ImU32 color =
+		mPalette[(int)PaletteIndex::FindMatch] | IM_COL32_A_MASK;
+	drawList->PushClipRect(ImVec2(left, pos.y), ImVec2(right, pos.y + height),
+						   false);
+
+	// one tick per pixel row however many matches land on it, so huge match
+	// counts cost no more than the height of the window
+	const float lineCount = (float)mLines.size();
+	auto it = mFindMatches.begin();
+	while (it != mFindMatches.end()) {
+		const int row = (int)(height * it->mLine / lineCount);
+		const float y = pos.y + row;
+		drawList->AddRectFilled(ImVec2(left + 2.0f, y),
+								ImVec2(right - 2.0f, y + 2.0f), color);
+
+		const int nextLine = (int)std::ceil((row + 1) * lineCount / height);
+		it = std::lower_bound(it, mFindMatches.end(),
+							  std::max(nextLine, it->mLine + 1),
+							  [](const FindMatch &match, int line) {
+								  return match.mLine < line;
+							  });
+	}
+	drawList->PopClipRect();
+}
+
+static const char *
+SymbolKindName(const QuakePrism::Symbols::symbolkind_t aKind) {
+	switch (aKind) {
+	case QuakePrism::Symbols::SYMBOL_CONSTANT:
+		return "constant";
+	case QuakePrism::Symbols::SYMBOL_FIELD:
+		return "field";
+	case QuakePrism::Symbols::SYMBOL_FUNCTION:
+		return "function";
+	case QuakePrism::Symbols::SYMBOL_FRAME:
+		return "frame";
+	default:
+		return "global";
+	}
+}
+
+void TextEditor::UpdateCompletion(int aOpenPrefix) {
+	if (!mCompletionOpen && aOpenPrefix <= 0)
+		return;
+
+	const auto cursor = GetActualCursorCoordinates();
+	const auto &text = mLines[cursor.mLine].GetText();
+	const int end = GetCharacterIndex(cursor);
+	int start = end;
+	while (start > 0 && IsIdentifierChar((unsigned char)text[start - 1]))
+		--start;
+	const Coordinates wordStart(cursor.mLine,
+								GetCharacterColumn(cursor.mLine, start));
+
+	if (mCompletionOpen && wordStart != mCompletionStart)
+		mCompletionOpen = false;
+	if (HasSelection() || start == end || isdigit((unsigned char)text[start])) {
+		mCompletionOpen = false;
+		return;
+	}
+
+	const std::string prefix = text.substr(start, end - start);
+	if (!mCompletionOpen) {
+		if (aOpenPrefix <= 0 || (int)prefix.size() < aOpenPrefix)
+			return;
+		mCompletionOpen = true;
+		mCompletionPrefix.clear();
+	}
+	if (prefix == mCompletionPrefix)
+		return;
+	mCompletionStart = wordStart;
+	mCompletionPrefix = prefix;
+	mCompletionIndex = 0;
+
+	// project symbols, builtins from defs.qc among them, and the keywords
+	mCompletions.clear();
+	for (auto &completion :
+		 QuakePrism::Symbols::Complete(prefix, maxCompletions))
+		mCompletions.push_back({std::move(completion.name),
+								SymbolKindName(completion.kind),
+								completion.score});
+	for (auto &keyword : mLanguageDefinition.mKeywords) {
+		const int score = QuakePrism::Search::FuzzyScore(prefix, keyword);
+		if (score >= 0)
+			mCompletions.push_back({keyword, "keyword", score});
+	}
+	std::sort(mCompletions.begin(), mCompletions.end(),
+			  [](const Completion &a, const Completion &b) {
+				  return a.mScore != b.mScore ? a.mScore > b.mScore
+											  : a.mName < b.mName;
+			  });
+	if (mCompletions.size() > maxCompletions)
+		mCompletions.resize(maxCompletions);
+
+	// nothing to offer but the word that is already there
+	if (mCompletions.empty() ||
+		(mCompletions.size() == 1 && mCompletions[0].mName == prefix))
+		mCompletionOpen = false;
+}
+
+void TextEditor::MoveCompletion(int aAmount) {
+	const int last = (int)mCompletions.size() - 1;
+	mCompletionIndex = std::max(0, std::min(last, mCompletionIndex + aAmount));
+}
+
+void TextEditor::AcceptCompletion() {
+	mCompletionOpen = false;
+	if (IsReadOnly() || mCompletionIndex >= (int)mCompletions.size())
+		return;
+
+	// the rest of the word after the cursor is replaced as well
+	const auto cursor = GetActualCursorCoordinates();
+	const auto &text = mLines[cursor.mLine].GetText();
+	int end = GetCharacterIndex(cursor);
+	while (end < (int)text.size() && IsIdentifierChar((unsigned char)text[end]))
+		++end;
+	SetSelection(mCompletionStart, Coordinates(cursor.mLine,
+											   GetCharacterColumn(cursor.mLine,
+																  end)));
+
+	UndoRecord u;
+	u.mBefore = mState;
+	u.mRemoved = GetSelectedText();
+	u.mRemovedStart = mState.mSelectionStart;
+	u.mRemovedEnd = mState.mSelectionEnd;
+	DeleteSelection();
+
+	u.mAdded = mCompletions[mCompletionIndex].mName;
+	u.mAddedStart = GetActualCursorCoordinates();
+	InsertText(u.mAdded);
+	u.mAddedEnd = GetActualCursorCoordinates();
+	u.mAfter = mState;
+	AddUndo(u);
+}
+
+void TextEditor::RenderCompletion(const ImVec2 &aScreenPos) {
+	if (!mCompletionOpen || mCompletions.empty())
+		return;
+
+	// the selected row is kept in the middle of the visible ones
+	const int count = (int)mCompletions.size();
+	const int visible = std::min(count, visibleCompletions);
+	const int first =
+		std::max(0, std::min(count - visible,
+							 mCompletionIndex - visible / 2));
+
+	float nameWidth = 0.0f;
+	float kindWidth = 0.0f;
+	for (int i = first; i < first + visible; ++i) {
+		nameWidth = std::max(
+			nameWidth, ImGui::CalcTextSize(mCompletions[i].mName.c_str()).x);
+		kindWidth =
+			std::max(kindWidth, ImGui::CalcTextSize(mCompletions[i].mKind).x);
+	}
+	const ImVec2 padding = ImGui::GetStyle().FramePadding;
+	const ImVec2 size(nameWidth + kindWidth + mCharAdvance.x * 2 +
+						  padding.x * 2,
+					  visible * mCharAdvance.y + padding.y * 2);
+
+	// under the word being typed, or over it if there is no room below
+	ImVec2 pos(aScreenPos.x + mTextStart +
+				   TextDistanceToLineStart(mCompletionStart),
+			   aScreenPos.y +
+				   (LineToRow(mCompletionStart.mLine) + 1) * mCharAdvance.y);
+	if (pos.y + size.y > ImGui::GetWindowPos().y + ImGui::GetWindowHeight())
+		pos.y -= size.y + mCharAdvance.y;
+
+	// drawn on top of every window without taking focus from the editor
+	auto drawList = ImGui::GetForegroundDrawList();
+	const ImVec2 end(pos.x + size.x, pos.y + size.y);
+	drawList->AddRectFilled(
+		pos, end, mPalette[(int)PaletteIndex::Background] | IM_COL32_A_MASK);
+	drawList->AddRect(pos, end, mPalette[(int)PaletteIndex::LineNumber]);
+	for (int i = 0; i < visible; ++i) {
+		const auto &completion = mCompletions[first + i];
+		const float y = pos.y + padding.y + i * mCharAdvance.y;
+		if (first + i == mCompletionIndex)
+			drawList->AddRectFilled(ImVec2(pos.x + 1.0f, y),
+									ImVec2(end.x - 1.0f, y + mCharAdvance.y),
+									mPalette[(int)PaletteIndex::Selection]);
+		drawList->AddText(ImVec2(pos.x + padding.x, y),
+						  mPalette[(int)PaletteIndex::Default],
+						  completion.mName.c_str());
+		drawList->AddText(ImVec2(end.x - padding.x - kindWidth, y),
+						  mPalette[(int)PaletteIndex::Comment],
+						  completion.mKind);
+	}
+}
+
 void TextEditor::Copy() {
 	if (HasSelection()) {
 		ImGui::SetClipboardText(GetSelectedText().c_str());
 	} else {
 		if (!mLines.empty()) {
-			std::string str;
 			auto &line = mLines[GetActualCursorCoordinates().mLine];
-			for (auto &g : line)
-				str.push_back(g.mChar);
-			ImGui::SetClipboardText(str.c_str());
+			ImGui::SetClipboardText(line.GetText().c_str());
 		}
 	}
 }
@@ -1992,20 +3278,229 @@ void TextEditor::Paste() {
 	}
 }
 
+void TextEditor::ReplaceText(const std::string &aText) {
+	if (IsReadOnly())
+		return;
+	FinishLoading();
+
+	UndoRecord u;
+	u.mBefore = mState;
+
+	SelectAll();
+	if (HasSelection()) {
+		u.mRemoved = GetSelectedText();
+		u.mRemovedStart = mState.mSelectionStart;
+		u.mRemovedEnd = mState.mSelectionEnd;
+		DeleteSelection();
+	}
+
+	u.mAdded = aText;
+	u.mAddedStart = GetActualCursorCoordinates();
+
+	InsertText(aText);
+
+	u.mAddedEnd = GetActualCursorCoordinates();
+	u.mAfter = mState;
+	AddUndo(u);
+}
+
 bool TextEditor::CanUndo() const { return !mReadOnly && mUndoIndex > 0; }
 
 bool TextEditor::CanRedo() const {
 	return !mReadOnly && mUndoIndex < (int)mUndoBuffer.size();
 }
 
-void TextEditor::Undo(int aSteps) {
-	while (CanUndo() && aSteps-- > 0)
-		mUndoBuffer[--mUndoIndex].Undo(this);
+void TextEditor::Undo(int aSteps) {
+	while (CanUndo() && aSteps-- > 0) {
+		auto &record = mUndoBuffer[--mUndoIndex];
+		record.Undo(this);
+		RecordEdit(record, true);
+	}
+}
+
+void TextEditor::Redo(int aSteps) {
+	while (CanRedo() && aSteps-- > 0) {
+		auto &record = mUndoBuffer[mUndoIndex++];
+		record.Redo(this);
+		RecordEdit(record, false);
+	}
+}
+
+void TextEditor::RecordEdit(const UndoRecord &aValue, bool aUndo) {
+	if (!mRecordEdits)
+		return;
+	mEdits.push_back({aUndo, aValue.mAdded, aValue.mAddedStart,
+					  aValue.mAddedEnd, aValue.mRemoved, aValue.mRemovedStart,
+					  aValue.mRemovedEnd});
+}
+
+void TextEditor::SetRecordEdits(bool aValue) {
+	mRecordEdits = aValue;
+	if (!mRecordEdits)
+		mEdits.clear();
+}
+
+void TextEditor::TakeEdits(Edits &aEdits) {
+	aEdits.clear();
+	aEdits.swap(mEdits);
+}
+
+void TextEditor::ApplyEdits(const Edits &aEdits) {
+	for (const auto &edit : aEdits) {
+		// undoing a change takes out what it added and puts back what it
+		// removed
+		const auto &removed = edit.mUndo ? edit.mAdded : edit.mRemoved;
+		const auto removedStart = SanitizeCoordinates(
+			edit.mUndo ? edit.mAddedStart : edit.mRemovedStart);
+		const auto removedEnd = SanitizeCoordinates(
+			edit.mUndo ? edit.mAddedEnd : edit.mRemovedEnd);
+		if (!removed.empty() && removedStart < removedEnd)
+			DeleteRange(removedStart, removedEnd);
+
+		const auto &added = edit.mUndo ? edit.mRemoved : edit.mAdded;
+		auto addedStart = SanitizeCoordinates(edit.mUndo ? edit.mRemovedStart
+														 : edit.mAddedStart);
+		if (!added.empty())
+			InsertTextAt(addedStart, added.c_str());
+	}
+	mState.mCursorPosition = SanitizeCoordinates(mState.mCursorPosition);
+	mState.mSelectionStart = mState.mSelectionEnd = mState.mCursorPosition;
+	Colorize();
+}
+
+void TextEditor::SetUndoMemoryLimit(size_t aBytes) {
+	mUndoMemoryLimit = aBytes;
+	EvictUndo();
+}
+
+void TextEditor::EvictUndo() {
+	// the oldest steps go first, but never the one that was just made
+	while (mUndoMemory > mUndoMemoryLimit && mUndoIndex > 1) {
+		mUndoMemory -= mUndoBuffer.front().GetMemory();
+		mUndoBuffer.pop_front();
+		--mUndoIndex;
+	}
+}
+
+void TextEditor::ClearUndo() {
+	mUndoBuffer.clear();
+	mUndoIndex = 0;
+	mUndoMemory = 0;
+}
+
+bool TextEditor::CoalesceUndo(UndoRecord &aPrevious,
+							  const UndoRecord &aValue) const {
+	// only plain typing and single character deletes carry on a step, and only
+	// while the cursor stays where the last one left it
+	if (aPrevious.mAfter.mCursorPosition != aValue.mBefore.mCursorPosition ||
+		aValue.mBefore.mSelectionEnd > aValue.mBefore.mSelectionStart)
+		return false;
+	if (aValue.mAdded.find('\n') != std::string::npos ||
+		aValue.mRemoved.find('\n') != std::string::npos ||
+		aPrevious.mAdded.find('\n') != std::string::npos ||
+		aPrevious.mRemoved.find('\n') != std::string::npos)
+		return false;
+
+	if (!aValue.mAdded.empty() && aValue.mRemoved.empty()) {
+		if (aPrevious.mAdded.empty() || !aPrevious.mRemoved.empty() ||
+			aPrevious.mAddedEnd != aValue.mAddedStart)
+			return false;
+
+		// whitespace after a word starts a new step
+		if (isspace((uint8_t)aValue.mAdded[0]) &&
+			!isspace((uint8_t)aPrevious.mAdded.back()))
+			return false;
+
+		aPrevious.mAdded += aValue.mAdded;
+		aPrevious.mAddedEnd = aValue.mAddedEnd;
+	} else if (aValue.mAdded.empty() && !aValue.mRemoved.empty()) {
+		if (!aPrevious.mAdded.empty() || aPrevious.mRemoved.empty())
+			return false;
+
+		if (aValue.mRemovedEnd == aPrevious.mRemovedStart) {
+			// backspace, the new text goes in front
+			aPrevious.mRemoved.insert(0, aValue.mRemoved);
+			aPrevious.mRemovedStart = aValue.mRemovedStart;
+		} else if (aValue.mRemovedStart == aPrevious.mRemovedStart) {
+			// delete, the text after the cursor keeps sliding in
+			aPrevious.mRemoved += aValue.mRemoved;
+			const auto &removed = aPrevious.mRemoved;
+			aPrevious.mRemovedEnd =
+				AdvanceText(aPrevious.mRemovedStart, removed.data(),
+							removed.data() + removed.size());
+		} else
+			return false;
+	} else
+		return false;
+
+	aPrevious.mAfter = aValue.mAfter;
+	return true;
+}
+
+void TextEditor::StoreUndoDelta(UndoRecord &aValue) const {
+	// a big replace such as pasting over a whole file mostly puts back the
+	// same text, so only the part in between that changed is kept
+	auto &added = aValue.mAdded;
+	auto &removed = aValue.mRemoved;
+	if (added.size() + removed.size() < undoDeltaSize || added.empty() ||
+		removed.empty() || aValue.mAddedStart != aValue.mRemovedStart)
+		return;
+
+	// never split a UTF-8 sequence
+	auto inSequence = [](const std::string &aText, size_t aIndex) {
+		return aIndex < aText.size() && IsUTFSequence(aText[aIndex]);
+	};
+
+	const size_t limit = std::min(added.size(), removed.size());
+	size_t prefix = 0;
+	while (prefix < limit && added[prefix] == removed[prefix])
+		++prefix;
+	while (prefix > 0 &&
+		   (inSequence(added, prefix) || inSequence(removed, prefix)))
+		--prefix;
+
+	size_t suffix = 0;
+	while (suffix < limit - prefix &&
+		   added[added.size() - 1 - suffix] ==
+			   removed[removed.size() - 1 - suffix])
+		++suffix;
+	while (suffix > 0 && (inSequence(added, added.size() - suffix) ||
+						  inSequence(removed, removed.size() - suffix)))
+		--suffix;
+
+	if (prefix == 0 && suffix == 0)
+		return;
+
+	const auto start = aValue.mAddedStart;
+	aValue.mAddedStart = aValue.mRemovedStart =
+		AdvanceText(start, added.data(), added.data() + prefix);
+	aValue.mAddedEnd =
+		AdvanceText(start, added.data(), added.data() + added.size() - suffix);
+	aValue.mRemovedEnd = AdvanceText(start, removed.data(),
+									 removed.data() + removed.size() - suffix);
+	// swapped rather than assigned so the old buffers are actually freed
+	std::string(added, prefix, added.size() - prefix - suffix).swap(added);
+	std::string(removed, prefix, removed.size() - prefix - suffix)
+		.swap(removed);
 }
 
-void TextEditor::Redo(int aSteps) {
-	while (CanRedo() && aSteps-- > 0)
-		mUndoBuffer[mUndoIndex++].Redo(this);
+TextEditor::Coordinates TextEditor::AdvanceText(Coordinates aFrom,
+												const char *aBegin,
+												const char *aEnd) const {
+	for (auto p = aBegin; p < aEnd;) {
+		if (*p == '\n') {
+			++aFrom.mLine;
+			aFrom.mColumn = 0;
+			++p;
+		} else if (*p == '\t') {
+			aFrom.mColumn = (aFrom.mColumn / mTabSize) * mTabSize + mTabSize;
+			++p;
+		} else {
+			++aFrom.mColumn;
+			p += UTF8CharLength(*p);
+		}
+	}
+	return aFrom;
 }
 
 const TextEditor::Palette &TextEditor::GetDarkPalette() {
@@ -2031,6 +3526,7 @@ const TextEditor::Palette &TextEditor::GetDarkPalette() {
 		0x40000000, // Current line fill
 		0x40808080, // Current line fill (inactive)
 		0x40a0a0a0, // Current line edge
+		0x6000a0ff, // Find match
 	}};
 	return p;
 }
@@ -2058,6 +3554,7 @@ const TextEditor::Palette &TextEditor::GetLightPalette() {
 		0x40000000, // Current line fill
 		0x40808080, // Current line fill (inactive)
 		0x40000000, // Current line edge
+		0x6000c0ff, // Find match
 	}};
 	return p;
 }
@@ -2085,6 +3582,7 @@ const TextEditor::Palette &TextEditor::GetRetroBluePalette() {
 		0x40000000, // Current line fill
 		0x40808080, // Current line fill (inactive)
 		0x40000000, // Current line edge
+		0x8000ffff, // Find match
 	}};
 	return p;
 }
@@ -2098,16 +3596,8 @@ std::vector<std::string> TextEditor::GetTextLines() const {
 
 	result.reserve(mLines.size());
 
-	for (auto &line : mLines) {
-		std::string text;
-
-		text.resize(line.size());
-
-		for (size_t i = 0; i < line.size(); ++i)
-			text[i] = line[i].mChar;
-
-		result.emplace_back(std::move(text));
-	}
+	for (size_t l = 0; l < mLines.size(); ++l)
+		result.push_back(mLines[l].GetText());
 
 	return result;
 }
@@ -2132,15 +3622,90 @@ void TextEditor::Colorize(int aFromLine, int aLines) {
 	mColorRangeMax = std::max(mColorRangeMax, toLine);
 	mColorRangeMin = std::max(0, mColorRangeMin);
 	mColorRangeMax = std::max(mColorRangeMin, mColorRangeMax);
-	mCheckComments = true;
+
+	mStateDirtyLine = std::min(mStateDirtyLine, std::max(0, aFromLine));
+	mStateDirtyEnd = std::max(mStateDirtyEnd, toLine);
+
+	++mTextVersion;
+}
+
+void TextEditor::ColorizeLine(const LanguageDefinition &aLanguage,
+							  const RegexList *aRegexList, const char *aBegin,
+							  const char *aEnd, bool aPreprocessor,
+							  PaletteIndex *aColors, std::string &aId) {
+	std::cmatch results;
+
+	std::fill(aColors, aColors + (aEnd - aBegin), PaletteIndex::Default);
+
+	for (auto first = aBegin; first != aEnd;) {
+		const char *token_begin = nullptr;
+		const char *token_end = nullptr;
+		PaletteIndex token_color = PaletteIndex::Default;
+
+		bool hasTokenizeResult = false;
+
+		if (aLanguage.mTokenize != nullptr) {
+			if (aLanguage.mTokenize(first, aEnd, token_begin, token_end,
+									token_color))
+				hasTokenizeResult = true;
+		}
+
+		if (hasTokenizeResult == false && aRegexList != nullptr) {
+			for (auto &p : *aRegexList) {
+				if (std::regex_search(first, aEnd, results, p.first,
+									  std::regex_constants::match_continuous)) {
+					hasTokenizeResult = true;
+
+					auto &v = *results.begin();
+					token_begin = v.first;
+					token_end = v.second;
+					token_color = p.second;
+					break;
+				}
+			}
+		}
+
+		if (hasTokenizeResult == false) {
+			first++;
+		} else {
+			const size_t token_length = token_end - token_begin;
+
+			if (token_color == PaletteIndex::Identifier) {
+				aId.assign(token_begin, token_end);
+
+				// todo : allmost all language definitions use lower case to
+				// specify keywords, so shouldn't this use ::tolower ?
+				if (!aLanguage.mCaseSensitive)
+					std::transform(aId.begin(), aId.end(), aId.begin(),
+								   ::toupper);
+
+				if (!aPreprocessor) {
+					if (aLanguage.mKeywords.count(aId) != 0)
+						token_color = PaletteIndex::Keyword;
+					else if (aLanguage.mIdentifiers.count(aId) != 0)
+						token_color = PaletteIndex::KnownIdentifier;
+					else if (aLanguage.mPreprocIdentifiers.count(aId) != 0)
+						token_color = PaletteIndex::PreprocIdentifier;
+				} else {
+					if (aLanguage.mPreprocIdentifiers.count(aId) != 0)
+						token_color = PaletteIndex::PreprocIdentifier;
+				}
+			}
+
+			std::fill(aColors + (token_begin - aBegin),
+					  aColors + (token_begin - aBegin) + token_length,
+					  token_color);
+
+			first = token_end;
+		}
+	}
 }
 
 void TextEditor::ColorizeRange(int aFromLine, int aToLine) {
 	if (mLines.empty() || aFromLine >= aToLine)
 		return;
 
-	std::string buffer;
-	std::cmatch results;
+	std::vector<PaletteIndex> colors;
 	std::string id;
 
 	int endLine = std::max(0, std::min((int)mLines.size(), aToLine));
@@ -2150,211 +3715,287 @@ void TextEditor::ColorizeRange(int aFromLine, int aToLine) {
 		if (line.empty())
 			continue;
 
-		buffer.resize(line.size());
-		for (size_t j = 0; j < line.size(); ++j) {
-			auto &col = line[j];
-			buffer[j] = col.mChar;
-			col.mColorIndex = PaletteIndex::Default;
-		}
-
-		const char *bufferBegin = &buffer.front();
-		const char *bufferEnd = bufferBegin + buffer.size();
+		const auto &text = line.GetText();
+		colors.resize(line.size());
+		ColorizeLine(mLanguageDefinition, &mRegexList, text.data(),
+					 text.data() + text.size(),
+					 line.GetStyle(line.size() - 1) & StylePreprocessor,
+					 colors.data(), id);
+		line.SetColors(colors.data());
+	}
+}
 
-		auto last = bufferEnd;
+// Shared with the colorize task, which must not touch the editor itself since
+// its tab can be closed while the task is still running
+struct TextEditor::BackgroundColorizer {
+	std::mutex mMutex;
+	std::vector<ColorizeResult> mResults;
+};
+
+void TextEditor::StartBackgroundColorize() {
+	// copying mLines only copies its chunk list, the chunks themselves stay
+	// shared until the editor next writes to them
+	auto lines = std::make_shared<const Lines>(mLines);
+	const int last = std::min(mBackgroundMax, (int)mLines.size());
+	const int first = std::min(mBackgroundMin, last);
+
+	// lines on screen go first so the first frame shows colors right away
+	int visibleFirst = first;
+	int visibleLast = std::min(last, first + 100);
+	if (mCharAdvance.y > 0.0f) {
+		const int top = (int)floor(ImGui::GetScrollY() / mCharAdvance.y);
+		const int height =
+			(int)ceil(ImGui::GetWindowHeight() / mCharAdvance.y) + 1;
+		visibleFirst = std::max(first, std::min(last, RowToLine(top)));
+		visibleLast =
+			std::max(visibleFirst, std::min(last, RowToLine(top + height)));
+	}
 
-		for (auto first = bufferBegin; first != last;) {
-			const char *token_begin = nullptr;
-			const char *token_end = nullptr;
-			PaletteIndex token_color = PaletteIndex::Default;
+	mBackgroundVersion = mTextVersion;
+	{
+		std::lock_guard<std::mutex> lock(mBackgroundColorizer->mMutex);
+		mBackgroundColorizer->mResults.clear();
+	}
 
-			bool hasTokenizeResult = false;
+	mColorizeTask->Start([shared = mBackgroundColorizer,
+						  language = mBackgroundLanguage, lines,
+						  version = mTextVersion, first, last, visibleFirst,
+						  visibleLast](QuakePrism::Jobs::Task &task) {
+		constexpr int chunkSize = 512;
+		std::string id;
+		auto colorize = [&](int from, int to) {
+			for (int start = from; start < to && !task.IsCancelled();
+				 start += chunkSize) {
+				const int end = std::min(to, start + chunkSize);
+
+				ColorizeResult result;
+				result.mVersion = version;
+				result.mFirstLine = start;
+				result.mLineStarts.reserve(end - start + 1);
+				for (int i = start; i < end; ++i) {
+					auto &line = (*lines)[i];
+					const size_t begin = result.mColors.size();
+					result.mLineStarts.push_back((int)begin);
+					if (line.empty())
+						continue;
+
+					const auto &text = line.GetText();
+					result.mColors.resize(begin + line.size());
+					ColorizeLine(*language, nullptr, text.data(),
+								 text.data() + text.size(),
+								 line.GetStyle(line.size() - 1) &
+									 StylePreprocessor,
+								 result.mColors.data() + begin, id);
+				}
+				result.mLineStarts.push_back((int)result.mColors.size());
 
-			if (mLanguageDefinition.mTokenize != nullptr) {
-				if (mLanguageDefinition.mTokenize(first, last, token_begin,
-												  token_end, token_color))
-					hasTokenizeResult = true;
+				std::lock_guard<std::mutex> lock(shared->mMutex);
+				shared->mResults.push_back(std::move(result));
 			}
+		};
 
-			if (hasTokenizeResult == false) {
-				// todo : remove
-				// printf("using regex for %.*s\n", first + 10 < last ? 10 :
-				// int(last - first), first);
-
-				for (auto &p : mRegexList) {
-					if (std::regex_search(
-							first, last, results, p.first,
-							std::regex_constants::match_continuous)) {
-						hasTokenizeResult = true;
-
-						auto &v = *results.begin();
-						token_begin = v.first;
-						token_end = v.second;
-						token_color = p.second;
-						break;
-					}
-				}
-			}
+		colorize(visibleFirst, visibleLast);
+		colorize(visibleLast, last);
+		colorize(first, visibleFirst);
+	});
+}
 
-			if (hasTokenizeResult == false) {
-				first++;
-			} else {
-				const size_t token_length = token_end - token_begin;
-
-				if (token_color == PaletteIndex::Identifier) {
-					id.assign(token_begin, token_end);
-
-					// todo : allmost all language definitions use lower case to
-					// specify keywords, so shouldn't this use ::tolower ?
-					if (!mLanguageDefinition.mCaseSensitive)
-						std::transform(id.begin(), id.end(), id.begin(),
-									   ::toupper);
-
-					if (!line[first - bufferBegin].mPreprocessor) {
-						if (mLanguageDefinition.mKeywords.count(id) != 0)
-							token_color = PaletteIndex::Keyword;
-						else if (mLanguageDefinition.mIdentifiers.count(id) !=
-								 0)
-							token_color = PaletteIndex::KnownIdentifier;
-						else if (mLanguageDefinition.mPreprocIdentifiers.count(
-									 id) != 0)
-							token_color = PaletteIndex::PreprocIdentifier;
-					} else {
-						if (mLanguageDefinition.mPreprocIdentifiers.count(id) !=
-							0)
-							token_color = PaletteIndex::PreprocIdentifier;
-					}
-				}
+void TextEditor::ApplyBackgroundColors() {
+	std::vector<ColorizeResult> results;
+	{
+		std::lock_guard<std::mutex> lock(mBackgroundColorizer->mMutex);
+		results.swap(mBackgroundColorizer->mResults);
+	}
 
-				for (size_t j = 0; j < token_length; ++j)
-					line[(token_begin - bufferBegin) + j].mColorIndex =
-						token_color;
+	for (auto &result : results) {
+		// an edit since the snapshot means the line numbers may have moved
+		if (result.mVersion != mTextVersion)
+			continue;
 
-				first = token_end;
-			}
+		const int count = (int)result.mLineStarts.size() - 1;
+		for (int i = 0; i < count; ++i) {
+			const int lineNo = result.mFirstLine + i;
+			if (lineNo >= (int)mLines.size())
+				break;
+			auto &line = mLines[lineNo];
+			const int begin = result.mLineStarts[i];
+			if ((int)line.size() != result.mLineStarts[i + 1] - begin)
+				continue;
+			line.SetColors(result.mColors.data() + begin);
 		}
 	}
 }
 
-void TextEditor::ColorizeInternal() {
-	if (mLines.empty() || !mColorizerEnabled)
-		return;
+// The kind of a bracket character, or -1
+static int GetBracketKind(char aChar, bool &aOpen) {
+	static const char brackets[] = "()[]{}";
+	const char *found = strchr(brackets, aChar);
+	if (aChar == '\0' || found == nullptr)
+		return -1;
+	aOpen = (found - brackets) % 2 == 0;
+	return (int)(found - brackets) / 2;
+}
 
-	if (mCheckComments) {
-		auto endLine = mLines.size();
-		auto endIndex = 0;
-		auto commentStartLine = endLine;
-		auto commentStartIndex = endIndex;
-		auto withinString = false;
-		auto withinSingleLineComment = false;
-		auto withinPreproc = false;
-		auto firstChar = true; // there is no other non-whitespace characters in
-							   // the line before
-		auto concatenate = false; // '\' on the very end of the line
-		auto currentLine = 0;
-		auto currentIndex = 0;
-		while (currentLine < endLine || currentIndex < endIndex) {
-			auto &line = mLines[currentLine];
-
-			if (currentIndex == 0 && !concatenate) {
-				withinSingleLineComment = false;
-				withinPreproc = false;
-				firstChar = true;
-			}
+TextEditor::LineState TextEditor::LexLineState(int aLine, LineState aState,
+											   Brackets *aBrackets) {
+	const Line &line = static_cast<const Lines &>(mLines)[aLine];
+	const auto &text = line.GetText();
+
+	for (int kind = 0; kind < BracketKinds; ++kind)
+		aState.mCloses[kind] = aState.mOpens[kind] = 0;
+	if (!aState.mContinuation) {
+		aState.mSingleLineComment = false;
+		aState.mPreprocessor = false;
+		aState.mString = false;
+	}
+	aState.mContinuation = false;
+
+	auto &startStr = mLanguageDefinition.mCommentStart;
+	auto &endStr = mLanguageDefinition.mCommentEnd;
+	auto &singleStartStr = mLanguageDefinition.mSingleLineComment;
+
+	thread_local std::vector<Style> styles;
+	line.GetStyles(styles);
+	auto setFlags = [&](int aIndex, bool aMultiLine, bool aComment,
+						bool aPreprocessor) {
+		Style style = styles[aIndex] & StyleColorMask;
+		if (aMultiLine)
+			style |= StyleMultiLineComment;
+		if (aComment)
+			style |= StyleComment;
+		if (aPreprocessor)
+			style |= StylePreprocessor;
+		styles[aIndex] = style;
+	};
+
+	// there are no other non-whitespace characters in the line before
+	bool firstChar = true;
+	const int size = (int)text.size();
+	for (int i = 0; i < size; ++i) {
+		const auto c = text[i];
+
+		if (c != mLanguageDefinition.mPreprocChar && !isspace((uint8_t)c))
+			firstChar = false;
+
+		if (aState.mString) {
+			setFlags(i, aState.mMultiLineComment, false, aState.mPreprocessor);
+
+			if ((c == '\"' && i + 1 < size && text[i + 1] == '\"') ||
+				c == '\\') {
+				if (++i < size)
+					setFlags(i, aState.mMultiLineComment, false,
+							 aState.mPreprocessor);
+			} else if (c == '\"')
+				aState.mString = false;
+			continue;
+		}
 
-			concatenate = false;
-
-			if (!line.empty()) {
-				auto &g = line[currentIndex];
-				auto c = g.mChar;
-
-				if (c != mLanguageDefinition.mPreprocChar && !isspace(c))
-					firstChar = false;
-
-				if (currentIndex == (int)line.size() - 1 &&
-					line[line.size() - 1].mChar == '\\')
-					concatenate = true;
-
-				bool inComment = (commentStartLine < currentLine ||
-								  (commentStartLine == currentLine &&
-								   commentStartIndex <= currentIndex));
-
-				if (withinString) {
-					line[currentIndex].mMultiLineComment = inComment;
-
-					if (c == '\"') {
-						if (currentIndex + 1 < (int)line.size() &&
-							line[currentIndex + 1].mChar == '\"') {
-							currentIndex += 1;
-							if (currentIndex < (int)line.size())
-								line[currentIndex].mMultiLineComment =
-									inComment;
-						} else
-							withinString = false;
-					} else if (c == '\\') {
-						currentIndex += 1;
-						if (currentIndex < (int)line.size())
-							line[currentIndex].mMultiLineComment = inComment;
-					}
-				} else {
-					if (firstChar && c == mLanguageDefinition.mPreprocChar)
-						withinPreproc = true;
+		if (firstChar && c == mLanguageDefinition.mPreprocChar)
+			aState.mPreprocessor = true;
+
+		bool open;
+		const int kind = GetBracketKind(c, open);
+		if (kind >= 0 && !aState.mSingleLineComment &&
+			!aState.mMultiLineComment) {
+			if (aBrackets != nullptr)
+				aBrackets->push_back({i, c});
+			// saturated, a line with 65535 unpaired brackets is no code
+			constexpr auto most = std::numeric_limits<uint16_t>::max();
+			auto &opens = aState.mOpens[kind];
+			auto &closes = aState.mCloses[kind];
+			if (open)
+				opens += opens < most;
+			else if (opens > 0)
+				--opens;
+			else
+				closes += closes < most;
+		}
 
-					if (c == '\"') {
-						withinString = true;
-						line[currentIndex].mMultiLineComment = inComment;
-					} else {
-						auto pred = [](const char &a, const Glyph &b) {
-							return a == b.mChar;
-						};
-						auto from = line.begin() + currentIndex;
-						auto &startStr = mLanguageDefinition.mCommentStart;
-						auto &singleStartStr =
-							mLanguageDefinition.mSingleLineComment;
-
-						if (singleStartStr.size() > 0 &&
-							currentIndex + singleStartStr.size() <=
-								line.size() &&
-							equals(singleStartStr.begin(), singleStartStr.end(),
-								   from, from + singleStartStr.size(), pred)) {
-							withinSingleLineComment = true;
-						} else if (!withinSingleLineComment &&
-								   currentIndex + startStr.size() <=
-									   line.size() &&
-								   equals(startStr.begin(), startStr.end(),
-										  from, from + startStr.size(), pred)) {
-							commentStartLine = currentLine;
-							commentStartIndex = currentIndex;
-						}
+		if (aState.mSingleLineComment || aState.mMultiLineComment) {
+			// comments hide strings and other comment openers
+		} else if (c == '\"') {
+			aState.mString = true;
+		} else if (!singleStartStr.empty() &&
+				   text.compare(i, singleStartStr.size(), singleStartStr) ==
+					   0) {
+			aState.mSingleLineComment = true;
+		} else if (!startStr.empty() &&
+				   text.compare(i, startStr.size(), startStr) == 0) {
+			aState.mMultiLineComment = true;
+			// skip past the opener so "/*/" does not also close it
+			for (size_t j = 0; j + 1 < startStr.size(); ++j, ++i)
+				setFlags(i, true, false, aState.mPreprocessor);
+		}
 
-						inComment = inComment =
-							(commentStartLine < currentLine ||
-							 (commentStartLine == currentLine &&
-							  commentStartIndex <= currentIndex));
+		setFlags(i, aState.mMultiLineComment, aState.mSingleLineComment,
+				 aState.mPreprocessor);
 
-						line[currentIndex].mMultiLineComment = inComment;
-						line[currentIndex].mComment = withinSingleLineComment;
+		if (aState.mMultiLineComment && i + 1 >= (int)endStr.size() &&
+			text.compare(i + 1 - endStr.size(), endStr.size(), endStr) == 0)
+			aState.mMultiLineComment = false;
+	}
 
-						auto &endStr = mLanguageDefinition.mCommentEnd;
-						if (currentIndex + 1 >= (int)endStr.size() &&
-							equals(endStr.begin(), endStr.end(),
-								   from + 1 - endStr.size(), from + 1, pred)) {
-							commentStartIndex = endIndex;
-							commentStartLine = endLine;
-						}
-					}
-				}
-				line[currentIndex].mPreprocessor = withinPreproc;
-				currentIndex += UTF8CharLength(c);
-				if (currentIndex >= (int)line.size()) {
-					currentIndex = 0;
-					++currentLine;
-				}
-			} else {
-				currentIndex = 0;
-				++currentLine;
-			}
+	if (aBrackets == nullptr)
+		mLines[aLine].SetStyles(styles.data());
+	aState.mContinuation = size > 0 && text[size - 1] == '\\';
+	return aState;
+}
+
+void TextEditor::ColorizeInternal() {
+	if (mLines.empty() || !mColorizerEnabled)
+		return;
+
+	// re-lex from the first edited line and stop as soon as a line past the
+	// edit ends in the same state it did before, everything after it is
+	// still valid. A freshly opened file is spread over a few frames.
+	assert(mLineStates.size() == mLines.size());
+	if (mStateDirtyLine < (int)mLines.size()) {
+		constexpr int increment = 5000;
+		const int to =
+			std::min((int)mLines.size(), mStateDirtyLine + increment);
+		LineState state = mStateDirtyLine > 0
+							  ? mLineStates[mStateDirtyLine - 1]
+							  : LineState();
+		bool settled = false;
+		int i = mStateDirtyLine;
+		for (; i < to && !settled; ++i) {
+			state = LexLineState(i, state);
+			settled = state == mLineStates[i] && i + 1 >= mStateDirtyEnd;
+			mLineStates[i] = state;
+			if (mBracketTree.IsBuilt(mLines.size()))
+				mBracketTree.Update(mLineStates, i);
 		}
-		mCheckComments = false;
+		mStateDirtyLine = settled ? (int)mLines.size() : i;
+	}
+	if (mStateDirtyLine >= (int)mLines.size()) {
+		mStateDirtyLine = std::numeric_limits<int>::max();
+		mStateDirtyEnd = 0;
+	}
+
+	// big ranges such as a freshly opened file are handed to the colorize
+	// task, small edits are cheaper to colorize right here
+	constexpr int backgroundThreshold = 1000;
+	if (mLanguageDefinition.mTokenize != nullptr &&
+		mColorRangeMax - mColorRangeMin > backgroundThreshold) {
+		mBackgroundMin = std::min(mBackgroundMin, mColorRangeMin);
+		mBackgroundMax = std::max(mBackgroundMax, mColorRangeMax);
+		mColorRangeMin = std::numeric_limits<int>::max();
+		mColorRangeMax = 0;
+	}
+
+	if (mBackgroundMin < mBackgroundMax) {
+		ApplyBackgroundColors();
+		if (!mColorizeTask->IsRunning()) {
+			// anything published right before the task finished
+			ApplyBackgroundColors();
+			if (mBackgroundVersion == mTextVersion) {
+				mBackgroundMin = std::numeric_limits<int>::max();
+				mBackgroundMax = 0;
+				mBackgroundVersion = 0;
+			} else
+				StartBackgroundColorize();
+		} else if (mBackgroundVersion != mTextVersion)
+			mColorizeTask->Cancel();
 	}
 
 	if (mColorRangeMin < mColorRangeMax) {
@@ -2372,6 +4013,285 @@ void TextEditor::ColorizeInternal() {
 	}
 }
 
+// The bracket counts are only whole once every line has been lexed
+bool TextEditor::IsBracketIndexReady() {
+	if (mLines.empty() || !mColorizerEnabled ||
+		mStateDirtyLine < (int)mLines.size())
+		return false;
+	if (!mBracketTree.IsBuilt(mLines.size()))
+		mBracketTree.Build(mLineStates);
+	return true;
+}
+
+void TextEditor::GetBrackets(int aLine, Brackets &aBrackets) {
+	aBrackets.clear();
+	LexLineState(aLine, aLine > 0 ? mLineStates[aLine - 1] : LineState(),
+				 &aBrackets);
+}
+
+bool TextEditor::FindMatchingBracket(const Coordinates &aPosition,
+									 Coordinates &aBracket,
+									 Coordinates &aMatch) {
+	if (!IsBracketIndexReady())
+		return false;
+	const auto position = SanitizeCoordinates(aPosition);
+	const int line = position.mLine;
+	Brackets brackets;
+	GetBrackets(line, brackets);
+
+	// the bracket right at the cursor wins over the one before it
+	const int index = GetCharacterIndex(position);
+	auto bracket = std::find_if(
+		brackets.begin(), brackets.end(),
+		[index](const Bracket &aBracket) { return aBracket.mIndex == index; });
+	if (bracket == brackets.end())
+		bracket = std::find_if(brackets.begin(), brackets.end(),
+							   [index](const Bracket &aBracket) {
+								   return aBracket.mIndex == index - 1;
+							   });
+	if (bracket == brackets.end())
+		return false;
+
+	bool open;
+	const int kind = GetBracketKind(bracket->mChar, open);
+	int depth = 1;
+	auto pairs = [kind, open, &depth](const Bracket &aOther) {
+		bool otherOpen;
+		if (GetBracketKind(aOther.mChar, otherOpen) != kind)
+			return false;
+		depth += otherOpen == open ? 1 : -1;
+		return depth == 0;
+	};
+	aBracket = Coordinates(line, GetCharacterColumn(line, bracket->mIndex));
+
+	// on the same line, or on the one the tree points at
+	int matchLine = line;
+	Brackets matchBrackets;
+	if (open) {
+		auto match = std::find_if(bracket + 1, brackets.end(), pairs);
+		if (match == brackets.end()) {
+			matchLine = mBracketTree.FindClose(mLineStates, line, kind, depth);
+			if (matchLine < 0)
+				return false;
+			GetBrackets(matchLine, matchBrackets);
+			match = std::find_if(matchBrackets.begin(), matchBrackets.end(),
+								 pairs);
+			if (match == matchBrackets.end())
+				return false;
+		}
+		aMatch =
+			Coordinates(matchLine, GetCharacterColumn(matchLine, match->mIndex));
+	} else {
+		auto match = std::find_if(std::make_reverse_iterator(bracket),
+								  brackets.rend(), pairs);
+		if (match == brackets.rend()) {
+			matchLine = mBracketTree.FindOpen(mLineStates, line, kind, depth);
+			if (matchLine < 0)
+				return false;
+			GetBrackets(matchLine, matchBrackets);
+			match = std::find_if(matchBrackets.rbegin(), matchBrackets.rend(),
+								 pairs);
+			if (match == matchBrackets.rend())
+				return false;
+		}
+		aMatch =
+			Coordinates(matchLine, GetCharacterColumn(matchLine, match->mIndex));
+	}
+	return true;
+}
+
+// The line of the } closing the outermost block aLine leaves open, or -1 if
+// it opens none or the block hides no lines
+int TextEditor::FindFoldEnd(int aLine) {
+	if (aLine < 0 || aLine >= (int)mLines.size() || !IsBracketIndexReady())
+		return -1;
+	int depth = mLineStates[aLine].mOpens[BracketCurly];
+	if (depth == 0)
+		return -1;
+	const int end =
+		mBracketTree.FindClose(mLineStates, aLine, BracketCurly, depth);
+	return end > aLine + 1 ? end : -1;
+}
+
+bool TextEditor::ToggleFold(int aLine) {
+	if (mFolds.erase(aLine) != 0)
+		return true;
+	const int end = FindFoldEnd(aLine);
+	if (end < 0)
+		return false;
+	mFolds.insert(aLine);
+
+	// a cursor inside would unfold it again right away
+	const auto cursor = GetActualCursorCoordinates();
+	if (cursor.mLine > aLine && cursor.mLine < end) {
+		SetSelection(Coordinates(aLine, GetLineMaxColumn(aLine)),
+					 Coordinates(aLine, GetLineMaxColumn(aLine)));
+		SetCursorPosition(Coordinates(aLine, GetLineMaxColumn(aLine)));
+	}
+	return true;
+}
+
+void TextEditor::UpdateFolds() {
+	mFoldRanges.clear();
+	if (mFolds.empty() || !IsBracketIndexReady())
+		return;
+
+	const int cursorLine = GetActualCursorCoordinates().mLine;
+	for (auto it = mFolds.begin(); it != mFolds.end();) {
+		const int end = FindFoldEnd(*it);
+		// edited so it no longer opens a block, or the cursor went inside
+		if (end < 0 || (cursorLine > *it && cursorLine < end)) {
+			it = mFolds.erase(it);
+			continue;
+		}
+		// folds inside a folded block stay folded for when it opens
+		if (mFoldRanges.empty() || *it > mFoldRanges.back().second)
+			mFoldRanges.emplace_back(*it + 1, end - 1);
+		++it;
+	}
+}
+
+// Rows are what is on screen, the lines of folded blocks taking none
+int TextEditor::LineToRow(int aLine) const {
+	int row = aLine;
+	for (const auto &range : mFoldRanges) {
+		if (range.first > aLine)
+			break;
+		row -= std::min(aLine, range.second) - range.first + 1;
+	}
+	return row;
+}
+
+int TextEditor::RowToLine(int aRow) const {
+	int line = aRow;
+	for (const auto &range : mFoldRanges) {
+		if (range.first > line)
+			break;
+		line += range.second - range.first + 1;
+	}
+	return line;
+}
+
+int TextEditor::GetTotalRows() const {
+	int rows = (int)mLines.size();
+	for (const auto &range : mFoldRanges)
+		rows -= range.second - range.first + 1;
+	return rows;
+}
+
+// The name a function is defined with, from the text before its body such
+// as "void() monster_run = [$run1, monster_run2]" or "void foo(float x)"
+static std::string GetFunctionName(std::string aSignature) {
+	auto trim = [&aSignature]() {
+		while (!aSignature.empty() && isspace((uint8_t)aSignature.back()))
+			aSignature.pop_back();
+	};
+	// drops a trailing (...) or [...] group
+	auto dropGroup = [&aSignature](char aOpen, char aClose) {
+		int depth = 0;
+		for (size_t i = aSignature.size(); i-- > 0;) {
+			if (aSignature[i] == aClose)
+				++depth;
+			else if (aSignature[i] == aOpen && --depth == 0) {
+				aSignature.resize(i);
+				return;
+			}
+		}
+		aSignature.clear();
+	};
+
+	for (trim(); !aSignature.empty(); trim()) {
+		if (aSignature.back() == '=')
+			aSignature.pop_back();
+		else if (aSignature.back() == ']')
+			dropGroup('[', ']');
+		else
+			break;
+	}
+	if (!aSignature.empty() && aSignature.back() == ')') {
+		dropGroup('(', ')');
+		trim();
+	}
+
+	size_t start = aSignature.size();
+	while (start > 0 && (isalnum((uint8_t)aSignature[start - 1]) ||
+						 aSignature[start - 1] == '_'))
+		--start;
+	return aSignature.substr(start);
+}
+
+// The text of a line before aEnd with its comments left out
+std::string TextEditor::GetCodeText(int aLine, int aEnd) const {
+	const auto &line = mLines[aLine];
+	std::string code;
+	for (int i = 0; i < aEnd && i < (int)line.size(); ++i)
+		if ((line.GetStyle(i) & (StyleComment | StyleMultiLineComment)) == 0)
+			code += line.GetText()[i];
+	return code;
+}
+
+const std::string &TextEditor::GetCurrentFunction() {
+	const auto cursor = GetActualCursorCoordinates();
+	if (mFunctionVersion == mTextVersion && mFunctionCursor == cursor)
+		return mFunctionName;
+	if (!IsBracketIndexReady())
+		return mFunctionName;
+	mFunctionVersion = mTextVersion;
+	mFunctionCursor = cursor;
+	mFunctionName.clear();
+
+	// how deep in { } blocks the cursor is, the outermost being the body
+	const int line = cursor.mLine;
+	const int index = GetCharacterIndex(cursor);
+	Brackets brackets;
+	GetBrackets(line, brackets);
+	int depth =
+		mBracketTree.GetPrefix(mLineStates, line, BracketCurly).mOpens;
+	auto end = brackets.begin();
+	for (; end != brackets.end() && end->mIndex < index; ++end) {
+		if (end->mChar == '{')
+			++depth;
+		else if (end->mChar == '}')
+			depth = std::max(0, depth - 1);
+	}
+	if (depth == 0)
+		return mFunctionName;
+
+	// back to the { that opens the outermost of them
+	auto findOpen = [&depth](Brackets::const_reverse_iterator aFrom,
+							 Brackets::const_reverse_iterator aTo) {
+		for (; aFrom != aTo; ++aFrom) {
+			if (aFrom->mChar == '}')
+				++depth;
+			else if (aFrom->mChar == '{' && --depth == 0)
+				return aFrom->mIndex;
+		}
+		return -1;
+	};
+	int openLine = line;
+	int openIndex = findOpen(std::make_reverse_iterator(end), brackets.crend());
+	if (openIndex < 0) {
+		openLine = mBracketTree.FindOpen(mLineStates, line, BracketCurly, depth);
+		if (openLine < 0)
+			return mFunctionName;
+		GetBrackets(openLine, brackets);
+		openIndex = findOpen(brackets.crbegin(), brackets.crend());
+		if (openIndex < 0)
+			return mFunctionName;
+	}
+
+	// the name is usually on the same line, or on one of the few above when
+	// the { has a line of its own
+	std::string signature = GetCodeText(openLine, openIndex);
+	for (int above = openLine - 1; above >= std::max(0, openLine - 3) &&
+								   signature.find_first_not_of(" \t") ==
+									   std::string::npos;
+		 --above)
+		signature = GetCodeText(above, (int)mLines[above].size());
+	mFunctionName = GetFunctionName(signature);
+	return mFunctionName;
+}
+
 float TextEditor::TextDistanceToLineStart(const Coordinates &aFrom) const {
 	auto &line = mLines[aFrom.mLine];
 	float distance = 0.0f;
@@ -2381,17 +4301,17 @@ float TextEditor::TextDistanceToLineStart(const Coordinates &aFrom) const {
 						  .x;
 	int colIndex = GetCharacterIndex(aFrom);
 	for (size_t it = 0u; it < line.size() && it < colIndex;) {
-		if (line[it].mChar == '\t') {
+		if (line[it] == '\t') {
 			distance = (1.0f + std::floor((1.0f + distance) /
 										  (float(mTabSize) * spaceSize))) *
 					   (float(mTabSize) * spaceSize);
 			++it;
 		} else {
-			auto d = UTF8CharLength(line[it].mChar);
+			auto d = UTF8CharLength(line[it]);
 			char tempCString[7];
 			int i = 0;
 			for (; i < 6 && d-- > 0 && it < (int)line.size(); i++, it++)
-				tempCString[i] = line[it].mChar;
+				tempCString[i] = line[it];
 
 			tempCString[i] = '\0';
 			distance +=
@@ -2425,12 +4345,12 @@ void TextEditor::EnsureCursorVisible() {
 
 	auto pos = GetActualCursorCoordinates();
 	auto len = TextDistanceToLineStart(pos);
+	const int row = LineToRow(pos.mLine);
 
-	if (pos.mLine < top)
-		ImGui::SetScrollY(std::max(0.0f, (pos.mLine - 1) * mCharAdvance.y));
-	if (pos.mLine > bottom - 4)
-		ImGui::SetScrollY(
-			std::max(0.0f, (pos.mLine + 4) * mCharAdvance.y - height));
+	if (row < top)
+		ImGui::SetScrollY(std::max(0.0f, (row - 1) * mCharAdvance.y));
+	if (row > bottom - 4)
+		ImGui::SetScrollY(std::max(0.0f, (row + 4) * mCharAdvance.y - height));
 	if (len + mTextStart < left + 4)
 		ImGui::SetScrollX(std::max(0.0f, len + mTextStart - 4));
 	if (len + mTextStart > right - 4)
@@ -2457,6 +4377,10 @@ TextEditor::UndoRecord::UndoRecord(const std::string &aAdded,
 	assert(mRemovedStart <= mRemovedEnd);
 }
 
+size_t TextEditor::UndoRecord::GetMemory() const {
+	return sizeof(UndoRecord) + mAdded.capacity() + mRemoved.capacity();
+}
+
 void TextEditor::UndoRecord::Undo(TextEditor *aEditor) {
 	if (!mAdded.empty()) {
 		aEditor->DeleteRange(mAddedStart, mAddedEnd);
@@ -2700,6 +4624,168 @@ static bool TokenizeCStylePunctuation(const char *in_begin, const char *in_end,
 	return false;
 }
 
+// Character classes for the QuakeC tokenizer, one lookup per byte instead of
+// a chain of comparisons or a regex per token
+enum QCCharClass : uint8_t {
+	QCC_Other = 0,
+	QCC_Space = 1 << 0,
+	QCC_IdentStart = 1 << 1,
+	QCC_Digit = 1 << 2,
+	QCC_Punct = 1 << 3,
+	QCC_Vector = 1 << 4, // anything allowed between the quotes of '0 0 1'
+};
+
+static const std::array<uint8_t, 256> qcCharClass = []() {
+	std::array<uint8_t, 256> table{};
+	table[' '] = table['\t'] = table['\r'] = table['\v'] = table['\f'] =
+		QCC_Space | QCC_Vector;
+	for (int c = 'a'; c <= 'z'; ++c)
+		table[c] = QCC_IdentStart;
+	for (int c = 'A'; c <= 'Z'; ++c)
+		table[c] = QCC_IdentStart;
+	table['_'] = QCC_IdentStart;
+	for (int c = '0'; c <= '9'; ++c)
+		table[c] = QCC_Digit | QCC_Vector;
+	table['e'] |= QCC_Vector;
+	table['E'] |= QCC_Vector;
+	for (const char *p = "[]{}!%^&*()-+=~|<>?:/;,."; *p != '\0'; ++p)
+		table[(unsigned char)*p] = QCC_Punct;
+	table['-'] |= QCC_Vector;
+	table['+'] |= QCC_Vector;
+	table['.'] |= QCC_Vector;
+	return table;
+}();
+
+static inline bool QCIs(const char c, const uint8_t aClass) {
+	return (qcCharClass[(unsigned char)c] & aClass) != 0;
+}
+
+static const char *QCScanIdentifier(const char *p, const char *in_end) {
+	while (p < in_end && QCIs(*p, QCC_IdentStart | QCC_Digit))
+		p++;
+	return p;
+}
+
+// Tokenizes one QuakeC token starting at in_begin. Every byte of the line
+// ends up in some token, so ColorizeRange never falls back to mRegexList.
+static bool TokenizeQuakeC(const char *in_begin, const char *in_end,
+						   const char *&out_begin, const char *&out_end,
+						   TextEditor::PaletteIndex &paletteIndex) {
+	using PaletteIndex = TextEditor::PaletteIndex;
+
+	while (in_begin < in_end && QCIs(*in_begin, QCC_Space))
+		in_begin++;
+
+	out_begin = in_begin;
+	if (in_begin == in_end) {
+		out_end = in_end;
+		paletteIndex = PaletteIndex::Default;
+		return true;
+	}
+
+	const char *p = in_begin;
+	const char c = *p;
+
+	if (QCIs(c, QCC_IdentStart)) {
+		out_end = QCScanIdentifier(p + 1, in_end);
+		paletteIndex = PaletteIndex::Identifier;
+		return true;
+	}
+
+	if (QCIs(c, QCC_Digit) ||
+		(c == '.' && p + 1 < in_end && QCIs(p[1], QCC_Digit))) {
+		if (c == '0' && p + 1 < in_end && (p[1] == 'x' || p[1] == 'X')) {
+			p += 2;
+			while (p < in_end && isxdigit((unsigned char)*p))
+				p++;
+		} else {
+			while (p < in_end && (QCIs(*p, QCC_Digit) || *p == '.'))
+				p++;
+		}
+		out_end = p;
+		paletteIndex = PaletteIndex::Number;
+		return true;
+	}
+
+	switch (c) {
+	case '"':
+		// an unterminated string runs to the end of the line
+		for (p++; p < in_end; p++) {
+			if (*p == '\\' && p + 1 < in_end)
+				p++;
+			else if (*p == '"') {
+				p++;
+				break;
+			}
+		}
+		out_end = p;
+		paletteIndex = PaletteIndex::String;
+		return true;
+
+	case '\'': {
+		// '0 0 1' is a vector constant, anything else is a character literal
+		bool isVector = true;
+		for (p++; p < in_end && *p != '\''; p++) {
+			if (*p == '\\' && p + 1 < in_end)
+				p++;
+			if (!QCIs(*p, QCC_Vector))
+				isVector = false;
+		}
+		if (p == in_end) {
+			out_end = in_begin + 1;
+			paletteIndex = PaletteIndex::Punctuation;
+			return true;
+		}
+		out_end = p + 1;
+		paletteIndex = isVector && out_end - in_begin > 2
+						   ? PaletteIndex::Number
+						   : PaletteIndex::CharLiteral;
+		return true;
+	}
+
+	case '$':
+		// model generation macros such as $frame, $cd and $base, or a frame
+		// name reference like $stand1
+		out_end = QCScanIdentifier(p + 1, in_end);
+		paletteIndex = PaletteIndex::PreprocIdentifier;
+		return true;
+
+	case '#':
+		// builtin numbers as in `void() remove = #15;`, otherwise a
+		// preprocessor directive such as #define or #include
+		if (p + 1 < in_end && QCIs(p[1], QCC_Digit)) {
+			for (p++; p < in_end && QCIs(*p, QCC_Digit);)
+				p++;
+			paletteIndex = PaletteIndex::Number;
+		} else {
+			p = QCScanIdentifier(p + 1, in_end);
+			paletteIndex = PaletteIndex::Preprocessor;
+		}
+		out_end = p;
+		return true;
+
+	case '/':
+		if (p + 1 < in_end && p[1] == '/') {
+			out_end = in_end;
+			paletteIndex = PaletteIndex::Comment;
+			return true;
+		}
+		if (p + 1 < in_end && p[1] == '*') {
+			for (p += 2; p + 1 < in_end && !(p[0] == '*' && p[1] == '/');)
+				p++;
+			out_end = p + 1 < in_end ? p + 2 : in_end;
+			paletteIndex = PaletteIndex::MultiLineComment;
+			return true;
+		}
+		break;
+	}
+
+	out_end = in_begin + 1;
+	paletteIndex = QCIs(c, QCC_Punct) ? PaletteIndex::Punctuation
+									  : PaletteIndex::Default;
+	return true;
+}
+
 const TextEditor::LanguageDefinition &
 TextEditor::LanguageDefinition::CPlusPlus() {
 	static bool inited = false;
@@ -3371,36 +5457,7 @@ const TextEditor::LanguageDefinition &TextEditor::LanguageDefinition::QuakeC() {
 			langDef.mIdentifiers.insert(std::make_pair(std::string(k), id));
 		}
 
-		langDef.mTokenize = [](const char *in_begin, const char *in_end,
-							   const char *&out_begin, const char *&out_end,
-							   PaletteIndex &paletteIndex) -> bool {
-			paletteIndex = PaletteIndex::Max;
-
-			while (in_begin < in_end && isascii(*in_begin) &&
-				   isblank(*in_begin))
-				in_begin++;
-
-			if (in_begin == in_end) {
-				out_begin = in_end;
-				out_end = in_end;
-				paletteIndex = PaletteIndex::Default;
-			} else if (TokenizeCStyleString(in_begin, in_end, out_begin,
-											out_end))
-				paletteIndex = PaletteIndex::String;
-			else if (TokenizeCStyleCharacterLiteral(in_begin, in_end, out_begin,
-													out_end))
-				paletteIndex = PaletteIndex::CharLiteral;
-			else if (TokenizeCStyleIdentifier(in_begin, in_end, out_begin,
-											  out_end))
-				paletteIndex = PaletteIndex::Identifier;
-			else if (TokenizeCStyleNumber(in_begin, in_end, out_begin, out_end))
-				paletteIndex = PaletteIndex::Number;
-			else if (TokenizeCStylePunctuation(in_begin, in_end, out_begin,
-											   out_end))
-				paletteIndex = PaletteIndex::Punctuation;
-
-			return paletteIndex != PaletteIndex::Max;
-		};
+		langDef.mTokenize = TokenizeQuakeC;
 
 		langDef.mCommentStart = "/*";
 		langDef.mCommentEnd = "*/";
@@ -2,14 +2,20 @@
 
 #include "imgui.h"
 #include <array>
+#include <deque>
 #include <map>
 #include <memory>
+#include <set>
 #include <regex>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+namespace QuakePrism::Jobs {
+class Task;
+}
+
 class TextEditor {
   public:
 	enum class PaletteIndex {
@@ -34,6 +40,7 @@ class TextEditor {
 		CurrentLineFill,
 		CurrentLineFillInactive,
 		CurrentLineEdge,
+		FindMatch,
 		Max
 	};
 
@@ -104,28 +111,164 @@ class TextEditor {
 		std::string mDeclaration;
 	};
 
+	struct FindOptions {
+		bool mCaseSensitive = false;
+		bool mWholeWord = false;
+		bool mRegex = false;
+
+		bool operator==(const FindOptions &o) const {
+			return mCaseSensitive == o.mCaseSensitive &&
+				   mWholeWord == o.mWholeWord && mRegex == o.mRegex;
+		}
+		bool operator!=(const FindOptions &o) const { return !(*this == o); }
+	};
+
+	// A match of the find query as byte offsets into a single line
+	struct FindMatch {
+		int mLine;
+		int mStart;
+		int mEnd;
+	};
+	typedef std::vector<FindMatch> FindMatches;
+
 	typedef std::string String;
 	typedef std::unordered_map<std::string, Identifier> Identifiers;
 	typedef std::unordered_set<std::string> Keywords;
 	typedef std::map<int, std::string> ErrorMarkers;
 	typedef std::unordered_set<int> Breakpoints;
+	typedef std::set<int> Folds; // the lines whose blocks are folded
 	typedef std::array<ImU32, (unsigned)PaletteIndex::Max> Palette;
 	typedef uint8_t Char;
 
-	struct Glyph {
-		Char mChar;
-		PaletteIndex mColorIndex = PaletteIndex::Default;
-		bool mComment : 1;
-		bool mMultiLineComment : 1;
-		bool mPreprocessor : 1;
+	// How a run of characters is drawn: the PaletteIndex picked by the
+	// tokenizer in the low bits, plus the flags set by the comment and
+	// preprocessor pass
+	typedef uint8_t Style;
+	enum StyleBits : Style {
+		StyleColorMask = 0x1f,
+		StyleComment = 0x20,
+		StyleMultiLineComment = 0x40,
+		StylePreprocessor = 0x80,
+	};
 
-		Glyph(Char aChar, PaletteIndex aColorIndex)
-			: mChar(aChar), mColorIndex(aColorIndex), mComment(false),
-			  mMultiLineComment(false), mPreprocessor(false) {}
+	// packed into four bytes, so the runs of a line only reach MaxStyledBytes
+	// in and anything past that is neither colored nor drawn
+	struct ColorSpan {
+		uint32_t mEnd : 24; // one past the last byte of the run
+		uint32_t mStyle : 8;
 	};
+	static constexpr uint32_t MaxStyledBytes = (1u << 24) - 1;
 
-	typedef std::vector<Glyph> Line;
-	typedef std::vector<Line> Lines;
+	// One line of text, stored as its raw UTF-8 bytes with the styles
+	// run-length encoded next to it. Indices are byte offsets.
+	class Line {
+	  public:
+		Line() = default;
+		explicit Line(std::string aText);
+
+		size_t size() const { return mText.size(); }
+		bool empty() const { return mText.empty(); }
+		Char operator[](size_t aIndex) const { return (Char)mText[aIndex]; }
+		const std::string &GetText() const { return mText; }
+		const std::vector<ColorSpan> &GetSpans() const { return mSpans; }
+
+		// inserted text takes the style of the character before it until
+		// the line is colorized again
+		void insert(size_t aAt, const char *aText, size_t aCount);
+		void insert(size_t aAt, const std::string &aText) {
+			insert(aAt, aText.data(), aText.size());
+		}
+		void append(const Line &aOther, size_t aFrom = 0);
+		void erase(size_t aFirst, size_t aLast);
+
+		Style GetStyle(size_t aIndex) const;
+		PaletteIndex GetColorIndex(size_t aIndex) const {
+			return (PaletteIndex)(GetStyle(aIndex) & StyleColorMask);
+		}
+		void GetStyles(std::vector<Style> &aStyles) const;
+		void SetStyles(const Style *aStyles);
+		// replaces the tokenizer colors and keeps the comment flags
+		void SetColors(const PaletteIndex *aColors);
+
+	  private:
+		uint32_t StyledSize() const;
+		void FillTail();
+		void Compact();
+
+		std::string mText;
+		// the last one ends at size(), or MaxStyledBytes on longer lines
+		std::vector<ColorSpan> mSpans;
+	};
+
+	// The document's lines, kept in chunks of a few hundred lines each.
+	// Inserting or removing lines only shifts the chunk they live in and the
+	// chunk list, and copies share chunks until one side writes to them, so
+	// a snapshot of the whole document for a background task is cheap.
+	class Lines {
+	  public:
+		size_t size() const { return mSize; }
+		bool empty() const { return mSize == 0; }
+
+		Line &operator[](size_t aIndex);
+		const Line &operator[](size_t aIndex) const;
+		Line &at(size_t aIndex);
+		const Line &at(size_t aIndex) const;
+		Line &back() { return (*this)[mSize - 1]; }
+		const Line &back() const { return (*this)[mSize - 1]; }
+
+		Line &insert(size_t aIndex, Line aLine);
+		void insert(size_t aIndex, std::vector<Line> &&aLines);
+		void push_back(Line aLine) { insert(mSize, std::move(aLine)); }
+		void erase(size_t aIndex) { erase(aIndex, aIndex + 1); }
+		void erase(size_t aFirst, size_t aLast);
+		void assign(std::vector<Line> &&aLines);
+		void clear();
+
+	  private:
+		typedef std::vector<Line> Chunk;
+
+		size_t FindChunk(size_t aIndex) const;
+		Chunk &MutableChunk(size_t aChunk);
+		void SplitChunk(size_t aChunk, size_t aAt);
+		void UpdateStarts(size_t aFromChunk);
+
+		std::vector<std::shared_ptr<Chunk>> mChunks;
+		std::vector<size_t> mStarts; // index of the first line of each chunk
+		size_t mSize = 0;
+		mutable size_t mLastChunk = 0; // most lookups are near the last one
+	};
+
+	enum BracketKind {
+		BracketRound,
+		BracketSquare,
+		BracketCurly,
+		BracketKinds
+	};
+
+	// Lexer state at the end of a line, which is all the next line needs to
+	// know to work out its comment and preprocessor flags. The bracket
+	// counts only describe the line itself.
+	struct LineState {
+		bool mMultiLineComment = false;
+		bool mSingleLineComment = false;
+		bool mString = false;
+		bool mPreprocessor = false;
+		bool mContinuation = false; // the line ends with '\'
+
+		// brackets of each kind in code that the line leaves unpaired:
+		// closes pairing with earlier lines, opens left for later ones
+		uint16_t mCloses[BracketKinds] = {};
+		uint16_t mOpens[BracketKinds] = {};
+
+		bool operator==(const LineState &o) const {
+			return mMultiLineComment == o.mMultiLineComment &&
+				   mSingleLineComment == o.mSingleLineComment &&
+				   mString == o.mString && mPreprocessor == o.mPreprocessor &&
+				   mContinuation == o.mContinuation;
+		}
+		bool operator!=(const LineState &o) const { return !(*this == o); }
+	};
+	typedef std::vector<LineState> LineStates;
 
 	struct LanguageDefinition {
 		typedef std::pair<std::string, PaletteIndex> TokenRegexString;
@@ -165,6 +308,10 @@ class TextEditor {
 	};
 
 	TextEditor();
+	TextEditor(const TextEditor &) = delete;
+	TextEditor &operator=(const TextEditor &) = delete;
+	TextEditor(TextEditor &&);
+	TextEditor &operator=(TextEditor &&);
 	~TextEditor();
 
 	void SetLanguageDefinition(const LanguageDefinition &aLanguageDef);
@@ -185,8 +332,50 @@ class TextEditor {
 	void Render(const char *aTitle, const ImVec2 &aSize = ImVec2(),
 				bool aBorder = false);
 	void SetText(const std::string &aText);
+	void SetText(const char *aBegin, const char *aEnd);
 	std::string GetText() const;
 
+	// Opens a file with the first screen of it in place and splits the rest
+	// into lines in the background. Anything that needs the whole text, such
+	// as saving it, has to call FinishLoading first.
+	bool LoadFile(const std::string &aPath);
+	bool IsLoading() const { return mLoading; }
+	void FinishLoading();
+
+	enum class SaveState { Idle, Saving, Saved, Failed };
+
+	// Writes the text to aPath in the background from a snapshot taken right
+	// away, so the editor stays usable however long the disk takes
+	void SaveFile(const std::string &aPath);
+	SaveState GetSaveState() const { return mSaveState; }
+	// Returns true once for every save that has finished, GetSaveState then
+	// tells whether it made it to disk
+	bool PollSave();
+	// Blocks until the save being written and any save queued behind it are
+	// done, leaving PollSave to report how the last one went
+	void WaitForSave();
+
+	// A change as the crash recovery journal sees it. Edits are kept for
+	// TakeEdits once SetRecordEdits is on and replay with ApplyEdits.
+	struct Edit {
+		bool mUndo; // the change was undone rather than made
+		std::string mAdded;
+		Coordinates mAddedStart;
+		Coordinates mAddedEnd;
+		std::string mRemoved;
+		Coordinates mRemovedStart;
+		Coordinates mRemovedEnd;
+	};
+	typedef std::vector<Edit> Edits;
+
+	void SetRecordEdits(bool aValue);
+	// Hands over the edits made since the last call
+	void TakeEdits(Edits &aEdits);
+	void ApplyEdits(const Edits &aEdits);
+	// Replaces the whole text as a single step that can be undone
+	void ReplaceText(const std::string &aText);
+	const Lines &GetLines() const { return mLines; }
+
 	void SetTextLines(const std::vector<std::string> &aLines);
 	std::vector<std::string> GetTextLines() const;
 
@@ -209,6 +398,8 @@ class TextEditor {
 		return GetActualCursorCoordinates();
 	}
 	void SetCursorPosition(const Coordinates &aPosition);
+	// The column a byte offset into a line is drawn at
+	Coordinates IndexToCoordinates(int aLine, int aIndex) const;
 
 	inline void SetHandleMouseInputs(bool aValue) {
 		mHandleMouseInputs = aValue;
@@ -261,6 +452,37 @@ class TextEditor {
 							const Coordinates &aFrom, Coordinates &outStart,
 							Coordinates &outEnd);
 
+	// All matches of the query are found in a single pass over the document
+	// and cached until either the text or the query changes. They are
+	// highlighted in the text and on the scrollbar; an empty pattern turns
+	// that off again.
+	void SetFindQuery(const std::string &aPattern, const FindOptions &aOptions);
+	inline const std::string &GetFindError() const { return mFindError; }
+	const FindMatches &GetFindMatches();
+	int GetCurrentFindMatch(); // index of the selected match or -1
+	// Selects the match after the cursor, or the one before it, wrapping
+	// around the document. aKeepCurrent also accepts a match starting right
+	// at the selection, for search as you type.
+	bool SelectNextMatch(bool aBackwards = false, bool aKeepCurrent = false);
+
+	std::string GetWordUnderCursor() const;
+
+	// The bracket at aPosition, or right before it, and the one it pairs
+	// with. Brackets in strings and comments are left out. Returns false if
+	// there is no bracket there or it is unpaired.
+	bool FindMatchingBracket(const Coordinates &aPosition,
+							 Coordinates &aBracket, Coordinates &aMatch);
+
+	// Hides the lines inside the { } block a line opens, or shows them
+	// again. Returns false if the line opens no block spanning other lines.
+	bool ToggleFold(int aLine);
+	bool IsFolded(int aLine) const { return mFolds.count(aLine) != 0; }
+	void UnfoldAll() { mFolds.clear(); }
+
+	// The name of the function whose body holds the cursor, empty outside of
+	// one
+	const std::string &GetCurrentFunction();
+
 	void Copy();
 	void Cut();
 	void Paste();
@@ -271,6 +493,12 @@ class TextEditor {
 	void Undo(int aSteps = 1);
 	void Redo(int aSteps = 1);
 
+	// Once the undo history takes more than this many bytes the oldest
+	// steps are dropped
+	void SetUndoMemoryLimit(size_t aBytes);
+	inline size_t GetUndoMemoryLimit() const { return mUndoMemoryLimit; }
+	inline size_t GetUndoMemoryUsed() const { return mUndoMemory; }
+
 	static const Palette &GetDarkPalette();
 	static const Palette &GetLightPalette();
 	static const Palette &GetRetroBluePalette();
@@ -280,6 +508,81 @@ class TextEditor {
   private:
 	typedef std::vector<std::pair<std::regex, PaletteIndex>> RegexList;
 
+	// Colors worked out off the UI thread for a run of lines, only applied if
+	// the text has not been edited since the snapshot was taken
+	struct ColorizeResult {
+		uint64_t mVersion;
+		int mFirstLine;
+		std::vector<int> mLineStarts; // mLines.size() + 1 offsets into mColors
+		std::vector<PaletteIndex> mColors;
+	};
+	struct BackgroundColorizer;
+
+	// A counted bracket of a line, as a byte offset
+	struct Bracket {
+		int mIndex;
+		char mChar;
+	};
+	typedef std::vector<Bracket> Brackets;
+
+	struct BracketBalance {
+		int mCloses = 0;
+		int mOpens = 0;
+	};
+
+	// A segment tree over groups of lines holding what each range leaves
+	// unpaired, so the line that closes or opens a block is found in
+	// O(log n) rather than by scanning the text in between. Editing a line
+	// updates a single leaf, adding or removing lines rebuilds it.
+	class BracketTree {
+	  public:
+		bool IsBuilt(size_t aLines) const { return mLines == (int)aLines; }
+		void Clear() { mLines = -1; }
+		void Build(const LineStates &aStates);
+		void Update(const LineStates &aStates, int aLine);
+
+		// The line after aLine on which aDepth open brackets of aKind are
+		// closed, or -1. aDepth is left at how many of them are still open
+		// when that line starts.
+		int FindClose(const LineStates &aStates, int aLine, int aKind,
+					  int &aDepth) const;
+		// The line before aLine on which aDepth close brackets of aKind are
+		// opened, or -1. aDepth is left at how many are still unopened
+		// after the end of that line.
+		int FindOpen(const LineStates &aStates, int aLine, int aKind,
+					 int &aDepth) const;
+		// What lines [0, aEnd) leave unpaired
+		BracketBalance GetPrefix(const LineStates &aStates, int aEnd,
+								 int aKind) const;
+
+	  private:
+		static constexpr int linesPerLeaf = 32;
+
+		static BracketBalance Combine(const BracketBalance &aFirst,
+									  const BracketBalance &aSecond);
+		static BracketBalance LineBalance(const LineState &aState, int aKind);
+
+		BracketBalance &Node(int aNode, int aKind) {
+			return mNodes[aNode * BracketKinds + aKind];
+		}
+		const BracketBalance &Node(int aNode, int aKind) const {
+			return mNodes[aNode * BracketKinds + aKind];
+		}
+		void UpdateLeaf(const LineStates &aStates, int aLeaf);
+		int FindCloseLeaf(int aNode, int aLow, int aHigh, int aFrom,
+						  int aKind, int &aDepth) const;
+		int FindOpenLeaf(int aNode, int aLow, int aHigh, int aTo, int aKind,
+						 int &aDepth) const;
+		void GetPrefixLeaves(int aNode, int aLow, int aHigh, int aEnd,
+							 int aKind, BracketBalance &aBalance) const;
+
+		int mLines = -1; // the line count it was built for, -1 if stale
+		int mLeaves = 0; // a power of two
+		std::vector<BracketBalance> mNodes; // root at 1, BracketKinds each
+	};
+	struct BackgroundLoader;
+	struct BackgroundSaver;
+
 	struct EditorState {
 		Coordinates mSelectionStart;
 		Coordinates mSelectionEnd;
@@ -304,6 +607,7 @@ class TextEditor {
 
 		void Undo(TextEditor *aEditor);
 		void Redo(TextEditor *aEditor);
+		size_t GetMemory() const;
 
 		std::string mAdded;
 		Coordinates mAddedStart;
@@ -317,12 +621,56 @@ class TextEditor {
 		EditorState mAfter;
 	};
 
-	typedef std::vector<UndoRecord> UndoBuffer;
+	typedef std::deque<UndoRecord> UndoBuffer;
+
+	// A candidate of the autocomplete popup
+	struct Completion {
+		std::string mName;
+		const char *mKind; // shown dimmed next to the name
+		int mScore;
+	};
+	typedef std::vector<Completion> Completions;
 
 	void ProcessInputs();
+	void UpdateFindMatches();
+	Coordinates FindMatchStart(const FindMatch &aMatch) const;
+	Coordinates FindMatchEnd(const FindMatch &aMatch) const;
+	void RenderFindMatches(int aFirstLine, int aLastLine,
+						   const ImVec2 &aScreenPos);
+	void RenderFindTicks();
+	// Refreshes the popup for the word before the cursor. A closed popup is
+	// only opened once that word is at least aOpenPrefix long, 0 never opens
+	// it.
+	void UpdateCompletion(int aOpenPrefix);
+	void MoveCompletion(int aAmount);
+	void AcceptCompletion();
+	void RenderCompletion(const ImVec2 &aScreenPos);
 	void Colorize(int aFromLine = 0, int aCount = -1);
 	void ColorizeRange(int aFromLine = 0, int aToLine = 0);
 	void ColorizeInternal();
+	static void ColorizeLine(const LanguageDefinition &aLanguage,
+							 const RegexList *aRegexList, const char *aBegin,
+							 const char *aEnd, bool aPreprocessor,
+							 PaletteIndex *aColors, std::string &aId);
+	void StartBackgroundColorize();
+	void ApplyBackgroundColors();
+	static void SplitLines(const char *aBegin, const char *aEnd,
+						   std::vector<Line> &aLines);
+	void CancelLoading();
+	void StartSave();
+	// Works out the flags of a line from the state of the one before it and
+	// stores its styles. Given aBrackets it only lists the counted brackets
+	// and leaves the line alone.
+	LineState LexLineState(int aLine, LineState aState,
+						   Brackets *aBrackets = nullptr);
+	bool IsBracketIndexReady();
+	void GetBrackets(int aLine, Brackets &aBrackets);
+	std::string GetCodeText(int aLine, int aEnd) const;
+	int FindFoldEnd(int aLine);
+	void UpdateFolds();
+	int LineToRow(int aLine) const;
+	int RowToLine(int aRow) const;
+	int GetTotalRows() const;
 	float TextDistanceToLineStart(const Coordinates &aFrom) const;
 	void EnsureCursorVisible();
 	int GetPageSize() const;
@@ -334,6 +682,13 @@ class TextEditor {
 	void DeleteRange(const Coordinates &aStart, const Coordinates &aEnd);
 	int InsertTextAt(Coordinates &aWhere, const char *aValue);
 	void AddUndo(UndoRecord &aValue);
+	void RecordEdit(const UndoRecord &aValue, bool aUndo);
+	bool CoalesceUndo(UndoRecord &aPrevious, const UndoRecord &aValue) const;
+	void StoreUndoDelta(UndoRecord &aValue) const;
+	void EvictUndo();
+	void ClearUndo();
+	Coordinates AdvanceText(Coordinates aFrom, const char *aBegin,
+							const char *aEnd) const;
 	Coordinates ScreenPosToCoordinates(const ImVec2 &aPosition) const;
 	Coordinates FindWordStart(const Coordinates &aFrom) const;
 	Coordinates FindWordEnd(const Coordinates &aFrom) const;
@@ -346,12 +701,12 @@ class TextEditor {
 	void RemoveLine(int aStart, int aEnd);
 	void RemoveLine(int aIndex);
 	Line &InsertLine(int aIndex);
+	void InsertLines(int aIndex, std::vector<Line> &&aLines);
 	void EnterCharacter(ImWchar aChar, bool aShift);
 	void Backspace();
 	void DeleteSelection();
-	std::string GetWordUnderCursor() const;
 	std::string GetWordAt(const Coordinates &aCoords) const;
-	ImU32 GetGlyphColor(const Glyph &aGlyph) const;
+	ImU32 GetStyleColor(Style aStyle) const;
 
 	void HandleKeyboardInputs();
 	void HandleMouseInputs();
@@ -362,6 +717,8 @@ class TextEditor {
 	EditorState mState;
 	UndoBuffer mUndoBuffer;
 	int mUndoIndex;
+	size_t mUndoMemory;
+	size_t mUndoMemoryLimit;
 
 	int mTabSize;
 	bool mOverwrite;
@@ -387,12 +744,61 @@ class TextEditor {
 	LanguageDefinition mLanguageDefinition;
 	RegexList mRegexList;
 
-	bool mCheckComments;
+	LineStates mLineStates; // end of line lexer state, parallel to mLines
+	int mStateDirtyLine; // first line whose state has to be recomputed
+	int mStateDirtyEnd;	 // lines before this are always re-lexed
+	BracketTree mBracketTree;
+
+	Folds mFolds;
+	// the lines the folds hide as first and last line, sorted and apart
+	std::vector<std::pair<int, int>> mFoldRanges;
+
+	uint64_t mBracketVersion; // text version the bracket match was found for
+	Coordinates mBracketCursor;
+	bool mBracketFound;
+	Coordinates mBracketStart, mBracketMatch;
+
+	uint64_t mFunctionVersion; // text version mFunctionName was found for
+	Coordinates mFunctionCursor;
+	std::string mFunctionName;
+
+	uint64_t mTextVersion; // bumped on every edit
+	uint64_t mBackgroundVersion; // version the colorize task is working on
+	int mBackgroundMin, mBackgroundMax; // lines left to the colorize task
+	std::shared_ptr<const LanguageDefinition> mBackgroundLanguage;
+	std::shared_ptr<BackgroundColorizer> mBackgroundColorizer;
+	std::unique_ptr<QuakePrism::Jobs::Task> mColorizeTask;
+
+	bool mLoading; // the load task is still splitting the end of the file
+	std::shared_ptr<BackgroundLoader> mBackgroundLoader;
+	std::unique_ptr<QuakePrism::Jobs::Task> mLoadTask;
+
+	SaveState mSaveState;
+	std::string mSavePath;
+	bool mSavePending; // saved again while the last save was still running
+	std::shared_ptr<BackgroundSaver> mBackgroundSaver;
+	std::unique_ptr<QuakePrism::Jobs::Task> mSaveTask;
+
+	bool mRecordEdits;
+	Edits mEdits; // made since the last TakeEdits
+
+	std::string mFindPattern;
+	FindOptions mFindOptions;
+	std::regex mFindRegex;
+	std::string mFindError;	 // why the pattern could not be used, if it can't
+	FindMatches mFindMatches; // sorted by line and offset
+	uint64_t mFindVersion;	  // text version mFindMatches was built from
+
+	bool mCompletionOpen;
+	Completions mCompletions;	   // best first
+	int mCompletionIndex;		   // the selected one
+	std::string mCompletionPrefix; // what mCompletions were found for
+	Coordinates mCompletionStart;  // where the word being completed starts
+
 	Breakpoints mBreakpoints;
 	ErrorMarkers mErrorMarkers;
 	ImVec2 mCharAdvance;
 	Coordinates mInteractiveStart, mInteractiveEnd;
-	std::string mLineBuffer;
 	uint64_t mStartTime;
 
 	float mLastClick;
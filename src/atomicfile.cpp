@@ -0,0 +1,110 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#include "atomicfile.h"
+#include <algorithm>
+#include <string>
+#include <system_error>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace QuakePrism {
+
+bool WriteFileAtomic(const std::filesystem::path &filename, const void *data,
+					 const size_t size) {
+	// a symlinked file keeps its link and has its target replaced instead
+	std::error_code ec;
+	std::filesystem::path target = filename;
+	if (std::filesystem::is_symlink(filename, ec)) {
+		target = std::filesystem::canonical(filename, ec);
+		if (ec)
+			return false;
+	}
+	const auto tempFile =
+		target.parent_path() / ("." + target.filename().string() + ".tmp");
+	const char *bytes = static_cast<const char *>(data);
+
+#ifdef _WIN32
+	HANDLE file =
+		CreateFileW(tempFile.wstring().c_str(), GENERIC_WRITE, 0, nullptr,
+					CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	bool written = true;
+	for (size_t offset = 0; offset < size && written;) {
+		// WriteFile takes at most 4GB at a time
+		const DWORD count = static_cast<DWORD>(
+			std::min<size_t>(size - offset, 0x40000000));
+		DWORD done = 0;
+		written = WriteFile(file, bytes + offset, count, &done, nullptr) &&
+				  done > 0;
+		offset += done;
+	}
+	written = written && FlushFileBuffers(file);
+	CloseHandle(file);
+	if (!written || !MoveFileExW(tempFile.wstring().c_str(),
+								 target.wstring().c_str(),
+								 MOVEFILE_REPLACE_EXISTING |
+									 MOVEFILE_WRITE_THROUGH)) {
+		DeleteFileW(tempFile.wstring().c_str());
+		return false;
+	}
+#else
+	// the new file keeps the permissions of the one it replaces
+	mode_t mode = 0644;
+	struct stat info;
+	if (stat(target.c_str(), &info) == 0)
+		mode = info.st_mode & 07777;
+
+	int fd = open(tempFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode);
+	if (fd < 0)
+		return false;
+	fchmod(fd, mode);
+	bool written = true;
+	for (size_t offset = 0; offset < size && written;) {
+		const ssize_t done = write(fd, bytes + offset, size - offset);
+		written = done > 0;
+		offset += written ? done : 0;
+	}
+	written = fsync(fd) == 0 && written;
+	if (close(fd) != 0 || !written ||
+		rename(tempFile.c_str(), target.c_str()) != 0) {
+		unlink(tempFile.c_str());
+		return false;
+	}
+
+	// the rename itself only survives a crash once the folder is synced too
+	const auto folder = target.has_parent_path() ? target.parent_path()
+												 : std::filesystem::path(".");
+	fd = open(folder.c_str(), O_RDONLY);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+#endif
+	return true;
+}
+
+} // namespace QuakePrism
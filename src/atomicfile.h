@@ -0,0 +1,32 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#pragma once
+#include <cstddef>
+#include <filesystem>
+
+namespace QuakePrism {
+
+// Replaces filename with data in a way that never leaves it half written.
+// The data goes to a temporary file next to it first, which is flushed to
+// disk and then renamed over the original.
+bool WriteFileAtomic(const std::filesystem::path &filename, const void *data,
+					 const size_t size);
+
+} // namespace QuakePrism
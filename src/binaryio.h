@@ -0,0 +1,76 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace QuakePrism {
+
+// The small binary files kept under .qprism are built up with the Append
+// functions and read back with the Read ones. Values are stored in the
+// machine's own byte order since the machine that wrote them reads them.
+
+typedef struct {
+	const unsigned char *p, *end;
+	bool failed; // a read ran past the end, later reads give zero values
+} reader_t;
+
+inline bool ReadBytes(reader_t &reader, void *out, const size_t size) {
+	if (reader.failed || static_cast<size_t>(reader.end - reader.p) < size) {
+		reader.failed = true;
+		return false;
+	}
+	memcpy(out, reader.p, size);
+	reader.p += size;
+	return true;
+}
+
+template <typename T> T ReadValue(reader_t &reader) {
+	T value = T();
+	ReadBytes(reader, &value, sizeof(T));
+	return value;
+}
+
+// Text stored after its length, which is written as a Size
+template <typename Size> std::string ReadString(reader_t &reader) {
+	const Size size = ReadValue<Size>(reader);
+	if (reader.failed || static_cast<uint64_t>(reader.end - reader.p) <
+							 static_cast<uint64_t>(size)) {
+		reader.failed = true;
+		return std::string();
+	}
+	std::string text(reinterpret_cast<const char *>(reader.p), size);
+	reader.p += size;
+	return text;
+}
+
+template <typename T> void AppendValue(std::string &data, const T value) {
+	data.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename Size>
+void AppendString(std::string &data, const std::string &text) {
+	AppendValue<Size>(data, text.size());
+	data.append(text);
+}
+
+} // namespace QuakePrism
@@ -0,0 +1,279 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#include "bsp.h"
+#include "jobs.h"
+#include "util.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <unordered_map>
+
+namespace QuakePrism::BSP {
+
+// Rebuilds a miptex with the standard layout so lumps taken from any
+// compiler's output end up identical when their pixels are
+static bool CopyMiptex(const unsigned char *data, const size_t size,
+					   WAD::wadlump_t &lump) {
+	WAD::miptex_t miptex;
+	if (size < sizeof(WAD::miptex_t))
+		return false;
+	memcpy(&miptex, data, sizeof(WAD::miptex_t));
+	if (miptex.width <= 0 || miptex.height <= 0)
+		return false;
+
+	int mipSizes[4];
+	int dataOffset = sizeof(WAD::miptex_t);
+	for (int mip = 0; mip < 4; ++mip) {
+		mipSizes[mip] = (miptex.width >> mip) * (miptex.height >> mip);
+		// textures stored in an external WAD have no pixels in the map
+		if (miptex.offsets[mip] <= 0 ||
+			static_cast<size_t>(miptex.offsets[mip]) + mipSizes[mip] > size)
+			return false;
+	}
+
+	lump.name = std::string(miptex.name, strnlen(miptex.name, 16));
+	lump.type = 'D';
+	lump.data.resize(sizeof(WAD::miptex_t) + mipSizes[0] + mipSizes[1] +
+					 mipSizes[2] + mipSizes[3]);
+	for (int mip = 0; mip < 4; ++mip) {
+		memcpy(lump.data.data() + dataOffset, data + miptex.offsets[mip],
+			   mipSizes[mip]);
+		miptex.offsets[mip] = dataOffset;
+		dataOffset += mipSizes[mip];
+	}
+	memset(miptex.name, 0, sizeof(miptex.name));
+	strncpy(miptex.name, lump.name.c_str(), 15);
+	memcpy(lump.data.data(), &miptex, sizeof(WAD::miptex_t));
+	return true;
+}
+
+// Loads the texture lump and checks its miptex directory, everything else
+// in the map is skipped
+static bool ReadTextureLump(const std::filesystem::path &filename,
+							std::vector<unsigned char> &buffer,
+							int &numMiptex) {
+	std::ifstream file(filename, std::ios::binary);
+	if (!file) {
+		std::cerr << "Failed to open file: " << filename.string()
+				  << std::endl;
+		return false;
+	}
+
+	dheader_t header;
+	file.read(reinterpret_cast<char *>(&header), sizeof(dheader_t));
+	if (!file || (header.version != BSPVERSION &&
+				  header.version != BSP2VERSION &&
+				  header.version != BSP2RMQVERSION)) {
+		std::cerr << "Unsupported BSP version in " << filename.string()
+				  << std::endl;
+		return false;
+	}
+
+	const lump_t &lump = header.lumps[LUMP_TEXTURES];
+	numMiptex = 0;
+	if (lump.filelen < static_cast<int>(sizeof(int)))
+		return true;
+	buffer.resize(lump.filelen);
+	file.seekg(lump.fileofs, std::ios::beg);
+	file.read(reinterpret_cast<char *>(buffer.data()), lump.filelen);
+	if (!file) {
+		std::cerr << "Failed to read textures from " << filename.string()
+				  << std::endl;
+		return false;
+	}
+
+	memcpy(&numMiptex, buffer.data(), sizeof(int));
+	if (numMiptex < 0 || (numMiptex + 1) * sizeof(int) > buffer.size()) {
+		std::cerr << "Corrupt texture lump in " << filename.string()
+				  << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Offset of the nth miptex in the texture lump or -1 if it is missing
+static int MiptexOffset(const std::vector<unsigned char> &buffer,
+						const int index) {
+	int dataofs;
+	memcpy(&dataofs, buffer.data() + (index + 1) * sizeof(int), sizeof(int));
+	if (dataofs < 0 ||
+		static_cast<size_t>(dataofs) + sizeof(WAD::miptex_t) > buffer.size())
+		return -1;
+	return dataofs;
+}
+
+bool ReadTextures(const std::filesystem::path &filename,
+				  std::vector<WAD::wadlump_t> &textures) {
+	std::vector<unsigned char> buffer;
+	int numMiptex;
+	if (!ReadTextureLump(filename, buffer, numMiptex))
+		return false;
+
+	for (int i = 0; i < numMiptex; ++i) {
+		const int dataofs = MiptexOffset(buffer, i);
+		if (dataofs < 0)
+			continue;
+		WAD::wadlump_t texture;
+		if (CopyMiptex(buffer.data() + dataofs, buffer.size() - dataofs,
+					   texture))
+			textures.push_back(std::move(texture));
+	}
+	return true;
+}
+
+bool ReadTextureNames(const std::filesystem::path &filename,
+					  std::vector<std::string> &names) {
+	std::vector<unsigned char> buffer;
+	int numMiptex;
+	if (!ReadTextureLump(filename, buffer, numMiptex))
+		return false;
+
+	// unlike ReadTextures this keeps textures stored outside the map
+	for (int i = 0; i < numMiptex; ++i) {
+		const int dataofs = MiptexOffset(buffer, i);
+		if (dataofs < 0)
+			continue;
+		const char *name = reinterpret_cast<const char *>(&buffer[dataofs]);
+		names.emplace_back(name, strnlen(name, 16));
+	}
+	return true;
+}
+
+bool ReadMapTextureNames(const std::filesystem::path &filename,
+						 std::vector<std::string> &names) {
+	std::ifstream file(filename);
+	if (!file) {
+		std::cerr << "Failed to open file: " << filename.string()
+				  << std::endl;
+		return false;
+	}
+
+	// brush faces look like "( x y z ) ( x y z ) ( x y z ) name ..." in
+	// both the standard and valve 220 formats
+	std::string line;
+	while (std::getline(file, line)) {
+		size_t pos = line.find_first_not_of(" \t");
+		if (pos == std::string::npos || line[pos] != '(')
+			continue;
+		for (int i = 0; i < 3 && pos != std::string::npos; ++i) {
+			pos = line.find(')', pos);
+			if (pos != std::string::npos)
+				++pos;
+		}
+		if (pos == std::string::npos)
+			continue;
+		pos = line.find_first_not_of(" \t", pos);
+		if (pos == std::string::npos)
+			continue;
+		const size_t end = line.find_first_of(" \t\r", pos);
+		names.push_back(line.substr(pos, end - pos));
+	}
+	return true;
+}
+
+bool ExtractTexturesToWad(const std::vector<std::filesystem::path> &maps,
+						  const std::filesystem::path &output) {
+	std::vector<std::vector<WAD::wadlump_t>> mapTextures(maps.size());
+	std::vector<char> read(maps.size(), 0);
+	Jobs::ParallelFor(maps.size(), [&](size_t i) {
+		read[i] = ReadTextures(maps[i], mapTextures[i]);
+	});
+	size_t readCount = 0;
+	for (size_t i = 0; i < maps.size(); ++i) {
+		if (read[i])
+			++readCount;
+		else
+			std::cerr << "Skipping unreadable map " << maps[i].string()
+					  << std::endl;
+	}
+	// an empty WAD would look like a map without textures
+	if (readCount == 0)
+		return false;
+
+	// merge in map order so the output does not depend on thread timing,
+	// quake looks textures up by name so the first version of a name wins
+	std::vector<WAD::wadlump_t> lumps;
+	std::unordered_map<std::string, uint64_t> seen;
+	size_t duplicates = 0;
+	for (size_t i = 0; i < maps.size(); ++i) {
+		for (auto &texture : mapTextures[i]) {
+			std::string key = texture.name;
+			std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+			// the name is left out so case differences still match
+			const uint64_t hash = HashBytes(texture.data.data() + 16,
+											texture.data.size() - 16);
+			auto it = seen.find(key);
+			if (it != seen.end()) {
+				if (it->second == hash) {
+					++duplicates;
+				} else {
+					std::cerr << "Skipping conflicting texture "
+							  << texture.name << " in "
+							  << maps[i].filename().string() << std::endl;
+				}
+				continue;
+			}
+			seen[key] = hash;
+			lumps.push_back(std::move(texture));
+		}
+	}
+
+	if (!WAD::WriteLumps(output.string().c_str(), lumps))
+		return false;
+	std::cout << "Wrote " << lumps.size() << " textures from " << readCount
+			  << " maps to " << output.string() << " (" << duplicates
+			  << " duplicates skipped)" << std::endl;
+	return true;
+}
+
+std::vector<std::filesystem::path>
+FindMaps(const std::filesystem::path &source, const std::string &extension) {
+	std::vector<std::filesystem::path> maps;
+	std::error_code ec;
+	if (!std::filesystem::is_directory(source, ec)) {
+		if (std::filesystem::is_regular_file(source, ec) &&
+			source.extension() == extension)
+			maps.push_back(source);
+		return maps;
+	}
+	// unreadable folders are skipped rather than ending the search, and
+	// hidden ones such as .git hold no maps
+	for (std::filesystem::recursive_directory_iterator
+			 it(source,
+				std::filesystem::directory_options::skip_permission_denied, ec),
+		 last;
+		 !ec && it != last; it.increment(ec)) {
+		const std::string name = it->path().filename().string();
+		if (!name.empty() && name[0] == '.') {
+			it.disable_recursion_pending();
+			continue;
+		}
+		std::error_code statError;
+		if (it->is_regular_file(statError) &&
+			it->path().extension() == extension)
+			maps.push_back(it->path());
+	}
+	std::sort(maps.begin(), maps.end());
+	return maps;
+}
+
+} // namespace QuakePrism::BSP
@@ -0,0 +1,69 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#pragma once
+#include "wad.h"
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#define BSPVERSION 29
+#define BSP2VERSION                                                            \
+	(('2' << 24) + ('P' << 16) + ('S' << 8) + 'B') // little-endian "BSP2"
+#define BSP2RMQVERSION                                                         \
+	(('B' << 24) + ('S' << 16) + ('P' << 8) + '2') // little-endian "2PSB"
+#define LUMP_TEXTURES 2
+#define HEADER_LUMPS 15
+
+namespace QuakePrism::BSP {
+
+typedef struct {
+	int fileofs, filelen;
+} lump_t;
+
+typedef struct {
+	int version;
+	lump_t lumps[HEADER_LUMPS];
+} dheader_t;
+
+// Reads every miptex embedded in a BSP29 or BSP2 map as WAD lumps
+bool ReadTextures(const std::filesystem::path &filename,
+				  std::vector<WAD::wadlump_t> &textures);
+
+// Names of every texture a map uses, including ones it does not embed
+bool ReadTextureNames(const std::filesystem::path &filename,
+					  std::vector<std::string> &names);
+
+// Texture names used by the brushes of a .map source file
+bool ReadMapTextureNames(const std::filesystem::path &filename,
+						 std::vector<std::string> &names);
+
+// Collects the embedded textures of all maps into one WAD, textures that
+// appear in several maps are only written once. Maps that cannot be read
+// are reported and left out, and nothing is written if none could be read
+bool ExtractTexturesToWad(const std::vector<std::filesystem::path> &maps,
+						  const std::filesystem::path &output);
+
+// Every file with the extension under a directory, or just the file itself
+// if it is one. Nothing if source does not exist
+std::vector<std::filesystem::path>
+FindMaps(const std::filesystem::path &source,
+		 const std::string &extension = ".bsp");
+
+} // namespace QuakePrism::BSP
@@ -0,0 +1,453 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#include "compiler.h"
+#include "atomicfile.h"
+#include "binaryio.h"
+#include "jobs.h"
+#include "mappedfile.h"
+#include "symbols.h"
+#include "util.h"
+#include "watcher.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <regex>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+namespace QuakePrism::Compiler {
+
+// how long a read waits for output before checking for a cancel
+static constexpr int waitMilliseconds = 100;
+// how long a cancelled fteqcc gets to exit before it is killed outright
+static constexpr auto killTimeout = std::chrono::seconds(2);
+
+static constexpr uint32_t cacheVersion = 1;
+static constexpr char cacheMagic[4] = {'Q', 'P', 'C', 'C'};
+
+static std::mutex outputMutex;
+static std::string output;
+static std::atomic<uint64_t> outputVersion{0};
+static std::atomic<int64_t> startTime{0}; // steady clock milliseconds
+static std::atomic<int64_t> endTime{0};
+static std::mutex resultMutex;
+static std::shared_ptr<const compileresult_t> result;
+static std::atomic<uint64_t> resultVersion{0};
+// the last compile that ran to the end and the sources it read, only
+// touched by the compile task
+static std::shared_ptr<const compileresult_t> cached;
+static uint64_t cachedKey = 0;
+static Jobs::Task compileTask;
+
+static int64_t Now() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			   std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+std::filesystem::path GetCompilerPath(const std::filesystem::path &srcDir) {
+#ifdef _WIN32
+	return srcDir / "fteqcc64.exe";
+#else
+	return srcDir / "fteqcc64";
+#endif
+}
+
+// Runs fteqcc in srcDir and waits for it to exit, handing what it prints on
+// stdout and stderr to onOutput as it arrives. Setting cancel kills it.
+// Returns its exit status, or -1 if it could not be started or was
+// cancelled.
+#ifdef _WIN32
+static int Run(const std::filesystem::path &srcDir,
+			   const std::function<void(const char *, size_t)> &onOutput,
+			   const std::atomic<bool> *cancel) {
+	SECURITY_ATTRIBUTES sa;
+	sa.nLength = sizeof(SECURITY_ATTRIBUTES);
+	sa.bInheritHandle = TRUE;
+	sa.lpSecurityDescriptor = NULL;
+
+	// one pipe takes both stdout and stderr, only its write end is inherited
+	HANDLE readPipe = NULL;
+	HANDLE writePipe = NULL;
+	if (!CreatePipe(&readPipe, &writePipe, &sa, 0))
+		return -1;
+	SetHandleInformation(readPipe, HANDLE_FLAG_INHERIT, 0);
+
+	STARTUPINFOW si;
+	ZeroMemory(&si, sizeof(STARTUPINFOW));
+	si.cb = sizeof(STARTUPINFOW);
+	si.hStdError = writePipe;
+	si.hStdOutput = writePipe;
+	si.dwFlags |= STARTF_USESTDHANDLES;
+
+	PROCESS_INFORMATION pi;
+	ZeroMemory(&pi, sizeof(PROCESS_INFORMATION));
+
+	std::wstring command = L"\"" + GetCompilerPath(srcDir).wstring() + L"\"";
+	const std::wstring directory = srcDir.wstring();
+	const bool started =
+		CreateProcessW(NULL, &command[0], NULL, NULL, TRUE, CREATE_NO_WINDOW,
+					   NULL, directory.c_str(), &si, &pi);
+	CloseHandle(writePipe);
+	if (!started) {
+		CloseHandle(readPipe);
+		return -1;
+	}
+
+	// only read what is there so a cancel is noticed while fteqcc is quiet
+	char buffer[4096];
+	bool cancelled = false;
+	for (;;) {
+		if (cancel && *cancel) {
+			TerminateProcess(pi.hProcess, 1);
+			cancelled = true;
+			break;
+		}
+		DWORD available = 0;
+		if (!PeekNamedPipe(readPipe, NULL, 0, NULL, &available, NULL))
+			break; // fteqcc exited and everything has been read
+		if (available == 0) {
+			WaitForSingleObject(pi.hProcess, waitMilliseconds);
+			continue;
+		}
+		DWORD count = 0;
+		if (!ReadFile(readPipe, buffer,
+					  std::min<DWORD>(available, sizeof(buffer)), &count,
+					  NULL) ||
+			count == 0)
+			break;
+		onOutput(buffer, count);
+	}
+	CloseHandle(readPipe);
+
+	WaitForSingleObject(pi.hProcess, INFINITE);
+	DWORD status = 0;
+	GetExitCodeProcess(pi.hProcess, &status);
+	CloseHandle(pi.hProcess);
+	CloseHandle(pi.hThread);
+	return cancelled ? -1 : (int)status;
+}
+#else
+static int Run(const std::filesystem::path &srcDir,
+			   const std::function<void(const char *, size_t)> &onOutput,
+			   const std::atomic<bool> *cancel) {
+	// one pipe takes both stdout and stderr, kept out of other children
+	int fds[2];
+	if (pipe(fds) != 0)
+		return -1;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+	// fteqcc looks for progs.src in its working directory, which is set for
+	// it alone rather than by changing ours
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	if (posix_spawn_file_actions_addchdir_np(&actions, srcDir.c_str()) != 0) {
+		posix_spawn_file_actions_destroy(&actions);
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+
+	const std::string program = GetCompilerPath(srcDir).string();
+	char *argv[] = {const_cast<char *>(program.c_str()), nullptr};
+	pid_t pid;
+	const int error =
+		posix_spawn(&pid, program.c_str(), &actions, nullptr, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(fds[1]);
+	if (error != 0) {
+		close(fds[0]);
+		return -1;
+	}
+
+	char buffer[4096];
+	bool cancelled = false;
+	pollfd readable = {fds[0], POLLIN, 0};
+	for (;;) {
+		if (cancel && *cancel) {
+			kill(pid, SIGTERM);
+			cancelled = true;
+			break;
+		}
+		const int ready = poll(&readable, 1, waitMilliseconds);
+		if (ready < 0 && errno != EINTR)
+			break;
+		if (ready <= 0)
+			continue;
+		const ssize_t count = read(fds[0], buffer, sizeof(buffer));
+		if (count > 0)
+			onOutput(buffer, count);
+		else if (count == 0 || (errno != EAGAIN && errno != EINTR))
+			break; // fteqcc exited and everything has been read
+	}
+	close(fds[0]);
+
+	int status = 0;
+	pid_t reaped = 0;
+	if (cancelled) {
+		// SIGTERM can be ignored, so fteqcc only gets so long to go quietly
+		const auto deadline = std::chrono::steady_clock::now() + killTimeout;
+		while (((reaped = waitpid(pid, &status, WNOHANG)) == 0 ||
+				(reaped < 0 && errno == EINTR)) &&
+			   std::chrono::steady_clock::now() < deadline)
+			poll(nullptr, 0, waitMilliseconds);
+		if (reaped <= 0)
+			kill(pid, SIGKILL);
+	}
+	if (reaped <= 0) {
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+			;
+	}
+	if (cancelled || !WIFEXITED(status))
+		return -1;
+	return WEXITSTATUS(status);
+}
+#endif
+
+static std::vector<diagnostic_t> ParseOutput(const std::string &text) {
+	std::vector<diagnostic_t> diagnostics;
+	const std::regex combinedRegex(
+		R"(([^:]+):(\d+): (warning|error)(?: ([^:]+))?: (.+))");
+	std::smatch match;
+	std::istringstream stream(text);
+	std::string line;
+	while (std::getline(stream, line)) {
+		if (std::regex_match(line, match, combinedRegex)) {
+			diagnostic_t diagnostic;
+			diagnostic.file = match[1];
+			diagnostic.line = std::stoi(match[2]);
+			diagnostic.type = match[3];
+			// include the warning/error code
+			diagnostic.message =
+				std::string(match[4]) + ": " + std::string(match[5]);
+			diagnostics.push_back(diagnostic);
+		}
+	}
+	return diagnostics;
+}
+
+static int64_t GetModified(const std::filesystem::path &file) {
+	std::error_code ec;
+	const auto time = std::filesystem::last_write_time(file, ec);
+	return ec ? 0 : static_cast<int64_t>(time.time_since_epoch().count());
+}
+
+// Identifies what a compile reads: fteqcc itself, progs.src and every file
+// it lists. Sources are hashed by content, so saving a file without
+// changing it still finds the last compile.
+static uint64_t HashSources(const std::filesystem::path &srcDir) {
+	const auto compiler = Watcher::GetStamp(GetCompilerPath(srcDir));
+	uint64_t hash = HashBytes(&cacheVersion, sizeof(cacheVersion));
+	hash = HashBytes(&compiler.size, sizeof(compiler.size), hash);
+	hash = HashBytes(&compiler.modified, sizeof(compiler.modified), hash);
+
+	auto files = Symbols::ReadProgsSrc(srcDir);
+	files.insert(files.begin(), srcDir / "progs.src");
+	for (const auto &file : files) {
+		const std::string name = file.generic_string();
+		hash = HashBytes(name.data(), name.size() + 1, hash);
+		// a missing file hashes apart from an empty one
+		MappedFile mapped;
+		const uint8_t found = mapped.Open(file);
+		hash = HashBytes(&found, sizeof(found), hash);
+		if (found)
+			hash = HashBytes(mapped.Data(), mapped.Size(), hash);
+	}
+	return hash;
+}
+
+static std::filesystem::path GetCachePath(const std::filesystem::path &srcDir) {
+	return srcDir.parent_path() / ".qprism" / "compile.cache";
+}
+
+static void SaveCache(const compileresult_t &compiled, const uint64_t key) {
+	std::string data(cacheMagic, sizeof(cacheMagic));
+	AppendValue<uint32_t>(data, cacheVersion);
+	AppendValue<uint64_t>(data, key);
+	AppendValue<int32_t>(data, compiled.status);
+	AppendValue<int64_t>(data, compiled.progsModified);
+	AppendString<uint32_t>(data, compiled.output);
+
+	const auto file = GetCachePath(compiled.srcDir);
+	std::error_code ec;
+	std::filesystem::create_directories(file.parent_path(), ec);
+	WriteFileAtomic(file, data.data(), data.size());
+}
+
+// The compile saved by an earlier run, or null if there is none or it is
+// damaged or from another version
+static std::shared_ptr<const compileresult_t>
+LoadCache(const std::filesystem::path &srcDir, uint64_t &key) {
+	MappedFile mapped;
+	if (!mapped.Open(GetCachePath(srcDir)))
+		return nullptr;
+	reader_t reader = {mapped.Data(), mapped.Data() + mapped.Size(), false};
+	char magic[sizeof(cacheMagic)];
+	if (!ReadBytes(reader, magic, sizeof(magic)) ||
+		memcmp(magic, cacheMagic, sizeof(magic)) != 0 ||
+		ReadValue<uint32_t>(reader) != cacheVersion)
+		return nullptr;
+
+	auto compiled = std::make_shared<compileresult_t>();
+	compiled->srcDir = srcDir;
+	key = ReadValue<uint64_t>(reader);
+	compiled->status = ReadValue<int32_t>(reader);
+	compiled->progsModified = ReadValue<int64_t>(reader);
+	compiled->output = ReadString<uint32_t>(reader);
+	if (reader.failed || reader.p != reader.end)
+		return nullptr;
+	compiled->diagnostics = ParseOutput(compiled->output);
+	return compiled;
+}
+
+// The last compile if nothing it read has changed since and the progs.dat
+// it left is still there, from memory or from the project's .qprism folder
+static std::shared_ptr<const compileresult_t>
+FindCached(const std::filesystem::path &srcDir, const uint64_t key,
+		   const std::filesystem::path &progs) {
+	if (!cached || cached->srcDir != srcDir) {
+		cached = LoadCache(srcDir, cachedKey);
+		if (!cached)
+			return nullptr;
+	}
+	if (cachedKey != key ||
+		(progs.empty() ? 0 : GetModified(progs)) != cached->progsModified)
+		return nullptr;
+	return cached;
+}
+
+static void Publish(std::shared_ptr<const compileresult_t> compiled) {
+	{
+		std::lock_guard<std::mutex> lock(resultMutex);
+		result = std::move(compiled);
+	}
+	++resultVersion;
+}
+
+static void AppendOutput(const char *text, const size_t size) {
+	std::lock_guard<std::mutex> lock(outputMutex);
+	// a \r\n split across two reads still loses its \r
+	for (size_t i = 0; i < size; ++i)
+		if (text[i] != '\r')
+			output += text[i];
+	++outputVersion;
+}
+
+bool StartCompile(const std::filesystem::path &srcDir, const bool force) {
+	if (compileTask.IsRunning())
+		return false;
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		output.clear();
+		++outputVersion;
+	}
+	startTime = endTime = Now();
+	return compileTask.Start([srcDir, force](Jobs::Task &task) {
+		// nothing changed since the last compile, show what it printed
+		const uint64_t key = HashSources(srcDir);
+		std::filesystem::path progs;
+		Symbols::ReadProgsSrc(srcDir, &progs);
+		auto hit = force ? nullptr : FindCached(srcDir, key, progs);
+		if (hit) {
+			const std::string note =
+				"\nNo changes since the last compile, its output is shown.\n";
+			AppendOutput(hit->output.data(), hit->output.size());
+			AppendOutput(note.data(), note.size());
+			Publish(std::move(hit));
+			endTime = Now();
+			return;
+		}
+
+		const int status = Run(srcDir, AppendOutput, task.CancelFlag());
+		if (task.IsCancelled()) {
+			const std::string note = "\nCompile cancelled.\n";
+			AppendOutput(note.data(), note.size());
+		} else if (status < 0) {
+			const std::string note = "Unable to run " +
+									 GetCompilerPath(srcDir).string() + "\n";
+			AppendOutput(note.data(), note.size());
+		}
+
+		auto finished = std::make_shared<compileresult_t>();
+		finished->srcDir = srcDir;
+		finished->status = task.IsCancelled() ? -1 : status;
+		finished->output = GetOutput();
+		finished->diagnostics = ParseOutput(finished->output);
+		finished->progsModified = progs.empty() ? 0 : GetModified(progs);
+		// keyed on the sources as they were before fteqcc read them, so an
+		// edit made during the compile is not taken as compiled
+		if (finished->status >= 0) {
+			cached = finished;
+			cachedKey = key;
+			SaveCache(*finished, key);
+		}
+		Publish(std::move(finished));
+		endTime = Now();
+	});
+}
+
+void CancelCompile() { compileTask.Cancel(); }
+
+bool IsCompiling() { return compileTask.IsRunning(); }
+
+double GetElapsedSeconds() {
+	const int64_t end = compileTask.IsRunning() ? Now() : endTime.load();
+	return (end - startTime) / 1000.0;
+}
+
+uint64_t GetOutputVersion() { return outputVersion; }
+
+std::string GetOutput() {
+	std::lock_guard<std::mutex> lock(outputMutex);
+	return output;
+}
+
+uint64_t GetResultVersion() { return resultVersion; }
+
+std::shared_ptr<const compileresult_t> GetResult() {
+	std::lock_guard<std::mutex> lock(resultMutex);
+	return result;
+}
+
+bool Succeeded(const compileresult_t &compiled) {
+	return compiled.status == 0 && compiled.progsModified != 0;
+}
+
+} // namespace QuakePrism::Compiler
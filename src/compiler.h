@@ -0,0 +1,74 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace QuakePrism::Compiler {
+
+typedef struct {
+	std::string file; // as fteqcc names it, relative to src
+	int line;
+	std::string type; // warning or error
+	std::string message;
+} diagnostic_t;
+
+typedef struct {
+	std::filesystem::path srcDir; // the folder that was compiled
+	// fteqcc's exit status, -1 if it did not run to the end
+	int status;
+	std::string output;
+	std::vector<diagnostic_t> diagnostics;
+	// write time of progs.dat afterwards, 0 if it is missing
+	int64_t progsModified;
+} compileresult_t;
+
+// Where fteqcc is expected in a project's src folder
+std::filesystem::path GetCompilerPath(const std::filesystem::path &srcDir);
+
+// Compiles the project on a background task. Returns false if a compile is
+// still running. Unless forced, the last compile is reused when nothing
+// progs.src lists has changed since, which misses files a .qc file
+// #includes, so compiles meant to build progs.dat are forced.
+bool StartCompile(const std::filesystem::path &srcDir, const bool force);
+void CancelCompile();
+bool IsCompiling();
+
+// Seconds the running compile has taken so far, or the last one took
+double GetElapsedSeconds();
+
+// What the running or last compile printed so far, with \r\n turned into
+// \n. The version changes whenever more arrives.
+uint64_t GetOutputVersion();
+std::string GetOutput();
+
+// The outcome of the last compile that finished, or null before the first.
+// Everything that needs compiler output shares it rather than running
+// fteqcc again. The version changes with every compile that finishes.
+uint64_t GetResultVersion();
+std::shared_ptr<const compileresult_t> GetResult();
+
+// Whether a result came from a compile that succeeded and left a progs.dat
+bool Succeeded(const compileresult_t &compiled);
+
+} // namespace QuakePrism::Compiler
@@ -0,0 +1,93 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#include "jobs.h"
+#include <algorithm>
+#include <vector>
+
+namespace QuakePrism::Jobs {
+
+unsigned int WorkerCount() {
+	const unsigned int count = std::thread::hardware_concurrency();
+	return count == 0 ? 4 : count;
+}
+
+void ParallelFor(const size_t count, const std::function<void(size_t)> &fn,
+				 const std::atomic<bool> *cancel) {
+	if (count == 0)
+		return;
+
+	std::atomic<size_t> next{0};
+	auto worker = [&]() {
+		for (;;) {
+			if (cancel && *cancel)
+				return;
+			const size_t i = next++;
+			if (i >= count)
+				return;
+			fn(i);
+		}
+	};
+
+	// the calling thread does its share so a single item never spawns
+	const size_t threadCount =
+		std::min<size_t>(WorkerCount(), count) - 1;
+	std::vector<std::thread> threads;
+	threads.reserve(threadCount);
+	for (size_t i = 0; i < threadCount; ++i)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &thread : threads)
+		thread.join();
+}
+
+Task::~Task() {
+	Cancel();
+	Wait();
+}
+
+bool Task::Start(std::function<void(Task &)> work) {
+	if (running)
+		return false;
+	Wait();
+
+	cancelled = false;
+	done = 0;
+	total = 0;
+	running = true;
+	worker = std::thread([this, work = std::move(work)]() {
+		work(*this);
+		running = false;
+	});
+	return true;
+}
+
+void Task::Wait() {
+	if (worker.joinable())
+		worker.join();
+}
+
+float Task::GetProgress() const {
+	const size_t count = total;
+	if (count == 0)
+		return 0.0f;
+	return static_cast<float>(done) / static_cast<float>(count);
+}
+
+} // namespace QuakePrism::Jobs
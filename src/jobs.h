@@ -0,0 +1,71 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <thread>
+
+namespace QuakePrism::Jobs {
+
+// Number of threads ParallelFor spreads work across
+unsigned int WorkerCount();
+
+// Calls fn(i) for every i in [0, count) on a pool of worker threads and
+// returns once all of them are done. Workers stop taking new items as soon
+// as cancel is set.
+void ParallelFor(const size_t count, const std::function<void(size_t)> &fn,
+				 const std::atomic<bool> *cancel = nullptr);
+
+// A single piece of background work the UI can poll for progress.
+// Destroying a Task cancels it and joins its worker. Statics are destroyed
+// in the reverse order they are declared, so a static Task goes after the
+// statics its work uses and is stopped before any of them are torn down.
+class Task {
+  public:
+	Task() = default;
+	Task(const Task &) = delete;
+	Task &operator=(const Task &) = delete;
+	~Task();
+
+	// Returns false if the previous run has not finished yet
+	bool Start(std::function<void(Task &)> work);
+	void Cancel() { cancelled = true; }
+	void Wait();
+
+	bool IsRunning() const { return running; }
+	bool IsCancelled() const { return cancelled; }
+	const std::atomic<bool> *CancelFlag() const { return &cancelled; }
+
+	void SetTotal(const size_t count) { total = count; }
+	void Advance(const size_t count = 1) { done += count; }
+	size_t GetDone() const { return done; }
+	size_t GetTotal() const { return total; }
+	float GetProgress() const;
+
+  private:
+	std::thread worker;
+	std::atomic<bool> running{false};
+	std::atomic<bool> cancelled{false};
+	std::atomic<size_t> done{0};
+	std::atomic<size_t> total{0};
+};
+
+} // namespace QuakePrism::Jobs
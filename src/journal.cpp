@@ -0,0 +1,318 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#include "journal.h"
+#include "atomicfile.h"
+#include "binaryio.h"
+#include "jobs.h"
+#include "mappedfile.h"
+#include "util.h"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+
+namespace QuakePrism::Journal {
+
+// bump whenever the layout of a journal file changes
+static constexpr uint32_t journalVersion = 1;
+static constexpr char journalMagic[4] = {'Q', 'P', 'J', 'L'};
+
+// the writer gathers edits for this long, so typing costs a single write
+// every so often rather than one per key
+static constexpr auto flushInterval = std::chrono::milliseconds(250);
+
+// bytes of edits after which a journal is started over from a snapshot
+static constexpr size_t compactSize = 1 << 20;
+
+// what an edit takes up in a journal besides its text
+static constexpr size_t editSize =
+	sizeof(uint8_t) + 2 * sizeof(uint64_t) + 8 * sizeof(int32_t);
+
+typedef struct {
+	std::filesystem::path journal;
+	std::filesystem::path file;
+	// a snapshot replaces the journal, edits are appended to it
+	std::shared_ptr<const TextEditor::Lines> snapshot;
+	TextEditor::Edits edits;
+	bool discard;
+} entry_t;
+
+typedef enum { WRITE_APPEND, WRITE_REPLACE, WRITE_REMOVE } writemode_t;
+
+typedef struct {
+	writemode_t mode;
+	std::string data;
+} pendingwrite_t;
+
+// only touched on the UI thread
+static std::filesystem::path journalDir;
+static std::unordered_map<std::string, size_t> editBytes; // since snapshots
+
+static std::mutex queueMutex;
+static std::vector<entry_t> queue;
+static std::mutex writeMutex; // held by whichever thread is writing
+static Jobs::Task writerTask;
+
+static std::filesystem::path GetJournalPath(const std::filesystem::path &file) {
+	const std::string name = file.lexically_normal().string();
+	char hash[17];
+	snprintf(hash, sizeof(hash), "%016" PRIx64,
+			 HashBytes(name.data(), name.size()));
+	return journalDir / (std::string(hash) + ".journal");
+}
+
+static void AppendCoordinates(std::string &data,
+							  const TextEditor::Coordinates &coordinates) {
+	AppendValue<int32_t>(data, coordinates.mLine);
+	AppendValue<int32_t>(data, coordinates.mColumn);
+}
+
+static void AppendEdits(std::string &data, const TextEditor::Edits &edits) {
+	for (const auto &edit : edits) {
+		AppendValue<uint8_t>(data, edit.mUndo);
+		AppendString<uint64_t>(data, edit.mAdded);
+		AppendCoordinates(data, edit.mAddedStart);
+		AppendCoordinates(data, edit.mAddedEnd);
+		AppendString<uint64_t>(data, edit.mRemoved);
+		AppendCoordinates(data, edit.mRemovedStart);
+		AppendCoordinates(data, edit.mRemovedEnd);
+	}
+}
+
+static void AppendSnapshot(std::string &data, const entry_t &entry) {
+	const auto &lines = *entry.snapshot;
+	size_t size = 0;
+	for (size_t i = 0; i < lines.size(); ++i)
+		size += lines[i].size() + 1;
+
+	data.reserve(size + 256);
+	data.append(journalMagic, sizeof(journalMagic));
+	AppendValue<uint32_t>(data, journalVersion);
+	AppendString<uint64_t>(data, entry.file.lexically_normal().string());
+	AppendValue<uint64_t>(data, size > 0 ? size - 1 : 0);
+	for (size_t i = 0; i < lines.size(); ++i) {
+		if (i > 0)
+			data.push_back('\n');
+		data.append(lines[i].GetText());
+	}
+}
+
+static void WriteQueued() {
+	std::lock_guard<std::mutex> writeLock(writeMutex);
+	std::vector<entry_t> entries;
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		entries.swap(queue);
+	}
+
+	// everything queued for one journal goes out in a single write
+	std::unordered_map<std::string, pendingwrite_t> writes;
+	for (const auto &entry : entries) {
+		auto &write = writes[entry.journal.string()];
+		if (entry.discard) {
+			write.mode = WRITE_REMOVE;
+			write.data.clear();
+		} else if (entry.snapshot) {
+			write.mode = WRITE_REPLACE;
+			write.data.clear();
+			AppendSnapshot(write.data, entry);
+		} else if (write.mode != WRITE_REMOVE)
+			AppendEdits(write.data, entry.edits);
+	}
+
+	std::error_code ec;
+	for (const auto &[journal, write] : writes) {
+		if (write.mode == WRITE_REMOVE) {
+			std::filesystem::remove(journal, ec);
+		} else if (write.mode == WRITE_REPLACE) {
+			std::filesystem::create_directories(
+				std::filesystem::path(journal).parent_path(), ec);
+			WriteFileAtomic(journal, write.data.data(), write.data.size());
+		} else if (!write.data.empty()) {
+			FILE *fp = fopen(journal.c_str(), "ab");
+			if (fp == nullptr)
+				continue;
+			fwrite(write.data.data(), 1, write.data.size(), fp);
+			fclose(fp);
+		}
+	}
+}
+
+static TextEditor::Coordinates ReadCoordinates(reader_t &reader) {
+	const int32_t line = ReadValue<int32_t>(reader);
+	const int32_t column = ReadValue<int32_t>(reader);
+	return TextEditor::Coordinates(std::max(0, line), std::max(0, column));
+}
+
+// Replays a journal onto its snapshot. An edit cut short by a crash in the
+// middle of writing it is left out.
+static bool ReadJournal(const std::filesystem::path &journal,
+						recovered_t &recovered) {
+	MappedFile mapped;
+	if (!mapped.Open(journal))
+		return false;
+
+	reader_t reader = {mapped.Data(), mapped.Data() + mapped.Size(), false};
+	char magic[sizeof(journalMagic)];
+	if (!ReadBytes(reader, magic, sizeof(magic)) ||
+		memcmp(magic, journalMagic, sizeof(magic)) != 0 ||
+		ReadValue<uint32_t>(reader) != journalVersion)
+		return false;
+	recovered.file = ReadString<uint64_t>(reader);
+	const std::string snapshot = ReadString<uint64_t>(reader);
+	if (reader.failed)
+		return false;
+
+	TextEditor::Edits edits;
+	while (reader.p != reader.end) {
+		TextEditor::Edit edit;
+		edit.mUndo = ReadValue<uint8_t>(reader) != 0;
+		edit.mAdded = ReadString<uint64_t>(reader);
+		edit.mAddedStart = ReadCoordinates(reader);
+		edit.mAddedEnd = ReadCoordinates(reader);
+		edit.mRemoved = ReadString<uint64_t>(reader);
+		edit.mRemovedStart = ReadCoordinates(reader);
+		edit.mRemovedEnd = ReadCoordinates(reader);
+		if (reader.failed)
+			break;
+		edits.push_back(std::move(edit));
+	}
+
+	TextEditor editor;
+	editor.SetText(snapshot);
+	editor.ApplyEdits(edits);
+	const auto lines = editor.GetTextLines();
+	recovered.text.clear();
+	for (size_t i = 0; i < lines.size(); ++i) {
+		if (i > 0)
+			recovered.text.push_back('\n');
+		recovered.text.append(lines[i]);
+	}
+	return true;
+}
+
+// Text the way saving leaves it, so a journal that only differs from the
+// file on disk by line endings or trailing blanks counts as unchanged
+static std::string Normalize(std::string text) {
+	text.erase(std::remove(text.begin(), text.end(), '\r'), text.end());
+	const size_t end = text.find_last_not_of(" \t\n");
+	text.resize(end == std::string::npos ? 0 : end + 1);
+	return text;
+}
+
+static bool MatchesDisk(const recovered_t &recovered) {
+	MappedFile mapped;
+	if (!mapped.Open(recovered.file))
+		return false;
+	const char *data = reinterpret_cast<const char *>(mapped.Data());
+	return Normalize(std::string(data, data + mapped.Size())) ==
+		   Normalize(recovered.text);
+}
+
+std::vector<recovered_t> Open(const std::filesystem::path &projectDir) {
+	// anything still queued belongs to the project that was open before
+	Flush();
+	editBytes.clear();
+	journalDir = projectDir / ".qprism" / "journal";
+
+	if (!writerTask.IsRunning()) {
+		writerTask.Start([](Jobs::Task &task) {
+			while (!task.IsCancelled()) {
+				std::this_thread::sleep_for(flushInterval);
+				WriteQueued();
+			}
+			WriteQueued();
+		});
+	}
+
+	std::vector<recovered_t> recovered;
+	std::error_code ec;
+	for (const auto &entry :
+		 std::filesystem::directory_iterator(journalDir, ec)) {
+		if (entry.path().extension() != ".journal")
+			continue;
+		recovered_t journal;
+		if (ReadJournal(entry.path(), journal) && !MatchesDisk(journal))
+			recovered.push_back(std::move(journal));
+		else
+			std::filesystem::remove(entry.path(), ec);
+	}
+	std::sort(recovered.begin(), recovered.end(),
+			  [](const recovered_t &a, const recovered_t &b) {
+				  return a.file < b.file;
+			  });
+	return recovered;
+}
+
+void Record(const std::filesystem::path &file, TextEditor &editor) {
+	// the text is only whole once the file has finished loading
+	if (journalDir.empty() || editor.IsLoading())
+		return;
+	TextEditor::Edits edits;
+	editor.TakeEdits(edits);
+	if (edits.empty())
+		return;
+
+	entry_t entry;
+	entry.journal = GetJournalPath(file);
+	entry.file = file;
+	entry.discard = false;
+
+	size_t size = 0;
+	for (const auto &edit : edits)
+		size += edit.mAdded.size() + edit.mRemoved.size() + editSize;
+	auto bytes = editBytes.find(entry.journal.string());
+	if (bytes == editBytes.end() || bytes->second + size > compactSize) {
+		// the snapshot already has these edits in it
+		entry.snapshot =
+			std::make_shared<const TextEditor::Lines>(editor.GetLines());
+		editBytes[entry.journal.string()] = 0;
+	} else {
+		entry.edits = std::move(edits);
+		bytes->second += size;
+	}
+
+	std::lock_guard<std::mutex> lock(queueMutex);
+	queue.push_back(std::move(entry));
+}
+
+void Discard(const std::filesystem::path &file) {
+	if (journalDir.empty())
+		return;
+	entry_t entry;
+	entry.journal = GetJournalPath(file);
+	entry.file = file;
+	entry.discard = true;
+	editBytes.erase(entry.journal.string());
+
+	std::lock_guard<std::mutex> lock(queueMutex);
+	queue.push_back(std::move(entry));
+}
+
+void Flush() { WriteQueued(); }
+
+} // namespace QuakePrism::Journal
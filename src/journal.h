@@ -0,0 +1,49 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#pragma once
+#include "TextEditor.h"
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace QuakePrism::Journal {
+
+typedef struct {
+	std::filesystem::path file;
+	std::string text; // what the file's tab held when the journal ended
+} recovered_t;
+
+// Keeps journals in the project's .qprism/journal folder from now on and
+// returns the unsaved work an earlier run left behind there
+std::vector<recovered_t> Open(const std::filesystem::path &projectDir);
+
+// Queues the edits made in a file's tab since the last call for the writer
+// task, which appends them to the file's journal in batches. A journal
+// starts from a snapshot of the text and is started over from a new one
+// once enough edits have piled up after it.
+void Record(const std::filesystem::path &file, TextEditor &editor);
+
+// Drops the journal of a file whose tab has been saved or closed
+void Discard(const std::filesystem::path &file);
+
+// Writes out everything queued right away
+void Flush();
+
+} // namespace QuakePrism::Journal
@@ -18,11 +18,10 @@ along with this program.
 */
 
 #pragma once
-#include <string>
 
 namespace QuakePrism {
-std::string getCompilerOutputString();
-
+// Sets the error markers of every open tab from the last compile, leaving
+// tabs with unsaved changes clear
 void createTextEditorDiagnostics();
 
 } // namespace QuakePrism
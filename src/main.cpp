@@ -17,6 +17,7 @@ along with this program.
 
 */
 
+#include "bsp.h"
 #include "framebuffer.h"
 #include "imgui.h"
 #include "imgui_impl_opengl3.h"
@@ -27,8 +28,13 @@ along with this program.
 #include "util.h"
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
+#include <algorithm>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <stdio.h>
+#include <string>
+#include <vector>
 #ifndef _WIN32
 #include "stb_image.h"
 #include <SDL2/SDL_image.h>
@@ -51,8 +57,118 @@ SDL_Surface *LoadSurface(const char *path) {
 }
 #endif
 
+static void PrintUsage() {
+	printf("usage: QuakePrism --build-wad <directory|manifest> <output.wad> "
+		   "[--mip] [--palette <palette.lmp>]\n"
+		   "       QuakePrism --extract-bsp <directory|map.bsp> "
+		   "<output.wad>\n"
+		   "       QuakePrism --analyze-wad <input.wad> <project> "
+		   "[<compacted.wad>]\n");
+}
+
+// A directory picks up every image inside it, anything else is read as a
+// manifest listing one image per line relative to the manifest
+static bool CollectImages(const std::filesystem::path &source,
+						  std::vector<std::filesystem::path> &images) {
+	if (std::filesystem::is_directory(source)) {
+		for (const auto &entry : std::filesystem::directory_iterator(source)) {
+			std::string ext = entry.path().extension().string();
+			std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+			if (ext == ".png" || ext == ".jpg" || ext == ".tga")
+				images.push_back(entry.path());
+		}
+		std::sort(images.begin(), images.end());
+		return true;
+	}
+
+	std::ifstream manifest(source);
+	if (!manifest) {
+		fprintf(stderr, "Failed to open %s\n", source.string().c_str());
+		return false;
+	}
+	std::string line;
+	while (std::getline(manifest, line)) {
+		line.erase(line.find_last_not_of(" \t\r") + 1);
+		if (line.empty() || line[0] == '#')
+			continue;
+		images.push_back(source.parent_path() / line);
+	}
+	return true;
+}
+
+// Batch tools run before SDL is touched so they work without a display
+static int RunBatchMode(int argc, char **argv) {
+	std::vector<std::string> args(argv + 1, argv + argc);
+	if (args[0] == "--extract-bsp" && args.size() == 3) {
+		std::vector<std::filesystem::path> maps =
+			QuakePrism::BSP::FindMaps(args[1]);
+		if (maps.empty()) {
+			fprintf(stderr, "No maps found in %s\n", args[1].c_str());
+			return 1;
+		}
+		return QuakePrism::BSP::ExtractTexturesToWad(maps, args[2]) ? 0 : 1;
+	}
+	if (args[0] == "--analyze-wad" && (args.size() == 3 || args.size() == 4)) {
+		QuakePrism::WAD::wadreport_t report;
+		if (!QuakePrism::WAD::AnalyzeWad(args[1], args[2], report))
+			return 1;
+		for (const auto &name : report.unreadable)
+			fprintf(stderr, "Failed to read map: %s\n", name.c_str());
+		for (const auto &name : report.unused)
+			printf("unused: %s\n", name.c_str());
+		for (const auto &name : report.duplicates)
+			printf("duplicate: %s\n", name.c_str());
+		printf("%zu unused, %zu duplicates across %d maps, %zu bytes can be "
+			   "saved\n",
+			   report.unused.size(), report.duplicates.size(),
+			   report.mapCount, report.savedSize);
+		if (args.size() == 4 &&
+			!QuakePrism::WAD::WriteLumps(args[3].c_str(), report.compacted))
+			return 1;
+		return 0;
+	}
+	if (args[0] != "--build-wad" || args.size() < 3) {
+		PrintUsage();
+		return 1;
+	}
+
+	bool isMip = false;
+	for (size_t i = 3; i < args.size(); ++i) {
+		if (args[i] == "--mip") {
+			isMip = true;
+		} else if (args[i] == "--palette" && i + 1 < args.size()) {
+			FILE *fp = fopen(args[++i].c_str(), "rb");
+			if (!fp || fread(QuakePrism::colormap, 1,
+							 sizeof(QuakePrism::colormap),
+							 fp) != sizeof(QuakePrism::colormap)) {
+				fprintf(stderr, "Failed to read palette %s\n",
+						args[i].c_str());
+				if (fp)
+					fclose(fp);
+				return 1;
+			}
+			fclose(fp);
+		} else {
+			PrintUsage();
+			return 1;
+		}
+	}
+
+	std::vector<std::filesystem::path> images;
+	if (!CollectImages(args[1], images))
+		return 1;
+	if (images.empty()) {
+		fprintf(stderr, "No images found in %s\n", args[1].c_str());
+		return 1;
+	}
+	return QuakePrism::WAD::BuildWad(images, args[2], isMip) ? 0 : 1;
+}
+
 // Main code
-int main(int, char **) {
+int main(int argc, char **argv) {
+	if (argc > 1 && strncmp(argv[1], "--", 2) == 0)
+		return RunBatchMode(argc, argv);
+
 	// Setup SDL
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_GAMECONTROLLER) !=
 		0) {
@@ -155,6 +271,8 @@ int main(int, char **) {
 		ImGui_ImplOpenGL3_NewFrame();
 		ImGui_ImplSDL2_NewFrame();
 		ImGui::NewFrame();
+		QuakePrism::HandleFileChanges();
+		QuakePrism::HandleCompileResults();
 		ImGui::PushFont(QuakePrism::notoSansFont);
 		QuakePrism::DrawMenuBar();
 		ImGui::DockSpaceOverViewport();
@@ -177,6 +295,7 @@ int main(int, char **) {
 		QuakePrism::DrawStartupPopup();
 		QuakePrism::DrawAboutPopup();
 		QuakePrism::DrawErrorPopup();
+		QuakePrism::DrawRecoverPopup();
 		QuakePrism::DrawOpenProjectPopup();
 		QuakePrism::DrawNewProjectPopup();
 
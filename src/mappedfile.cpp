@@ -0,0 +1,110 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#include "mappedfile.h"
+#include <fstream>
+#include <iterator>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace QuakePrism {
+
+bool MappedFile::Open(const std::filesystem::path &filename) {
+	Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileW(filename.wstring().c_str(), GENERIC_READ,
+							  FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+							  FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+		HANDLE mapping =
+			CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping != nullptr) {
+			void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			if (view != nullptr) {
+				data = static_cast<const unsigned char *>(view);
+				size = static_cast<size_t>(fileSize.QuadPart);
+				mappingHandle = mapping;
+				mapped = true;
+			} else {
+				CloseHandle(mapping);
+			}
+		}
+	}
+	CloseHandle(file);
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	if (fstat(fd, &info) == 0 && info.st_size > 0) {
+		void *view =
+			mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view != MAP_FAILED) {
+			madvise(view, info.st_size, MADV_SEQUENTIAL);
+			data = static_cast<const unsigned char *>(view);
+			size = static_cast<size_t>(info.st_size);
+			mapped = true;
+		}
+	}
+	// the mapping stays valid after the descriptor is closed
+	close(fd);
+#endif
+	if (mapped)
+		return true;
+
+	// empty files and filesystems without mmap support end up here
+	std::ifstream input(filename, std::ios::binary);
+	if (!input)
+		return false;
+	buffer.assign(std::istreambuf_iterator<char>(input),
+				  std::istreambuf_iterator<char>());
+	data = buffer.data();
+	size = buffer.size();
+	return true;
+}
+
+void MappedFile::Close() {
+	if (mapped) {
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+		CloseHandle(mappingHandle);
+		mappingHandle = nullptr;
+#else
+		munmap(const_cast<unsigned char *>(data), size);
+#endif
+	}
+	buffer.clear();
+	buffer.shrink_to_fit();
+	data = nullptr;
+	size = 0;
+	mapped = false;
+}
+
+} // namespace QuakePrism
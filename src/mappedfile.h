@@ -0,0 +1,52 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <vector>
+
+namespace QuakePrism {
+
+// Read-only view of a whole file. The file is memory mapped where the
+// platform allows it and read once into a buffer otherwise.
+class MappedFile {
+  public:
+	MappedFile() = default;
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+	~MappedFile() { Close(); }
+
+	bool Open(const std::filesystem::path &filename);
+	void Close();
+
+	const unsigned char *Data() const { return data; }
+	size_t Size() const { return size; }
+
+  private:
+	const unsigned char *data = nullptr;
+	size_t size = 0;
+	bool mapped = false;
+	std::vector<unsigned char> buffer;
+#ifdef _WIN32
+	void *mappingHandle = nullptr;
+#endif
+};
+
+} // namespace QuakePrism
@@ -316,12 +316,12 @@ bool ReadMDLModel(const char *filename, struct mdl_model_t *mdl,
  */
 void FreeModel(struct mdl_model_t *mdl) {
 
-	for (int i = 0; i < mdl->header.num_skins; ++i) {
-		free(mdl->skins[i].data);
-		mdl->skins[i].data = NULL;
-	}
-
 	if (mdl->skins) {
+		for (int i = 0; i < mdl->header.num_skins; ++i) {
+			free(mdl->skins[i].data);
+			mdl->skins[i].data = NULL;
+		}
+
 		free(mdl->skins);
 		mdl->skins = NULL;
 	}
@@ -543,7 +543,18 @@ bool mdlTextureExport(std::filesystem::path modelPath) {
 	return ExportTextureToImg(imgFilename.c_str(), &mdlfile);
 }
 
-void cleanup() { FreeModel(&mdlfile); }
+// The model render() last read, which it keeps until one of these changes
+static std::filesystem::path loadedPath;
+static bool loadedFiltering = false;
+static bool modelLoaded = false;
+
+void ReloadModel() { loadedPath.clear(); }
+
+void cleanup() {
+	FreeModel(&mdlfile);
+	loadedPath.clear();
+	modelLoaded = false;
+}
 
 void reshape(int w, int h) {
 	if (h == 0)
@@ -568,7 +579,14 @@ void render(const std::filesystem::path modelPath, const int mode,
 	if (modelPath.empty())
 		return;
 
-	if (!ReadMDLModel(modelPath.string().c_str(), &mdlfile, filteringEnabled))
+	if (modelPath != loadedPath || filteringEnabled != loadedFiltering) {
+		FreeModel(&mdlfile);
+		loadedPath = modelPath;
+		loadedFiltering = filteringEnabled;
+		modelLoaded = ReadMDLModel(modelPath.string().c_str(), &mdlfile,
+								   filteringEnabled);
+	}
+	if (!modelLoaded)
 		return;
 
 	totalFrames = mdlfile.header.num_frames;
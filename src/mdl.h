@@ -77,6 +77,9 @@ bool mdlTextureExport(std::filesystem::path modelPath);
 
 void cleanup();
 
+// Makes the next render() read the model from disk again
+void ReloadModel();
+
 void reshape(int w, int h);
 
 void render(const std::filesystem::path modelPath, const int mode,
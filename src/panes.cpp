@@ -19,19 +19,26 @@ along with this program.
 
 #include "panes.h"
 #include "TextEditor.h"
+#include "bsp.h"
+#include "compiler.h"
 #include "framebuffer.h"
 #include "imfilebrowser.h"
 #include "imgui.h"
 #include "imgui_internal.h"
+#include "journal.h"
 #include "linter.h"
 #include "lmp.h"
 #include "mdl.h"
 #include "pak.h"
 #include "resources.h"
+#include "search.h"
 #include "spr.h"
+#include "symbols.h"
 #include "util.h"
 #include "wad.h"
+#include "watcher.h"
 #include <algorithm>
+#include <cassert>
 #include <chrono>
 #include <cstdint>
 #include <cstdio>
@@ -40,6 +47,7 @@ along with this program.
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <map>
 #include <stdexcept>
 #include <string>
 #ifdef _WIN32
@@ -62,12 +70,67 @@ bool isErrorOpen = false;
 bool isOpenProjectOpen = false;
 bool isNewProjectOpen = false;
 bool isLauncherOpen = true;
-bool isCompiling = false;
 bool palLoaded = false;
-bool newTabOpened = false;
+int focusTabIndex = -1;
 
 namespace QuakePrism {
 
+static bool compileQueued = false;	 // another compile after the running one
+static bool queuedFromMenu = false;	 // and it has to run fteqcc
+static bool runAfterCompile = false; // run the game if the compile succeeds
+static bool showConsole = false;	 // compiles from the menu bring it up
+
+// Compiles the project in the background, or again once the running compile
+// is done. Only asking from the menu reports a missing compiler and always
+// runs fteqcc, quiet compiles after saves may reuse the last one.
+static bool RequestCompile(const bool quiet) {
+	const auto srcDir = baseDirectory / "src";
+	if (!std::filesystem::exists(Compiler::GetCompilerPath(srcDir))) {
+		if (!quiet) {
+			isErrorOpen = true;
+			userError = MISSING_COMPILER;
+		}
+		return false;
+	}
+	showConsole |= !quiet;
+	if (!Compiler::StartCompile(srcDir, !quiet)) {
+		compileQueued = true;
+		queuedFromMenu |= !quiet;
+	}
+	return true;
+}
+
+// The last compile of this project, if there has been one
+static std::shared_ptr<const Compiler::compileresult_t> GetCompileResult() {
+	auto result = Compiler::GetResult();
+	if (result && result->srcDir != baseDirectory / "src")
+		result.reset();
+	return result;
+}
+
+void HandleCompileResults() {
+	static uint64_t resultVersion = 0;
+	if (Compiler::IsCompiling())
+		return;
+	if (Compiler::GetResultVersion() != resultVersion) {
+		resultVersion = Compiler::GetResultVersion();
+		createTextEditorDiagnostics();
+	}
+	if (compileQueued) {
+		const bool quiet = !queuedFromMenu;
+		compileQueued = queuedFromMenu = false;
+		RequestCompile(quiet);
+		return;
+	}
+	// the console already shows why a compile failed
+	if (runAfterCompile) {
+		runAfterCompile = false;
+		const auto result = GetCompileResult();
+		if (result && Compiler::Succeeded(*result))
+			RunProject();
+	}
+}
+
 void DrawMenuBar() {
 	if (ImGui::BeginMainMenuBar()) {
 		const bool newEnabled = !baseDirectory.empty();
@@ -123,16 +186,14 @@ void DrawMenuBar() {
 
 		if (ImGui::BeginMenu("Run")) {
 			if (ImGui::MenuItem("Compile", NULL, false, newEnabled)) {
-				isCompiling = true;
+				RequestCompile(false);
 			}
 			if (ImGui::MenuItem("Run", NULL, false, newEnabled)) {
 				RunProject();
 			}
 			if (ImGui::MenuItem("Compile and Run", NULL, false, newEnabled)) {
-				// this is done to ensure compiling finishes before running
-				isCompiling = true;
-				CompileProject();
-				RunProject();
+				// the game starts once the compile has succeeded
+				runAfterCompile = RequestCompile(false);
 			}
 			ImGui::EndMenu();
 		}
@@ -179,6 +240,58 @@ void DrawMenuBar() {
 	}
 }
 
+// files the panes wrote themselves, so the watcher does not hand them back as
+// changes made by another program
+static std::map<std::filesystem::path, Watcher::filestamp_t> ownWrites;
+
+// open files another program changed, true if it deleted them
+static std::map<std::filesystem::path, bool> externalChanges;
+
+// map whose embedded textures are open in the WAD tools, they have no WAD
+// until the first save picks one
+static std::filesystem::path previewMapPath;
+
+static bool reloadTexture = false;
+
+// Returns path when nothing is there yet, otherwise the first free
+// name_2.ext, name_3.ext, ... beside it so an existing file is never replaced
+static std::filesystem::path GetUnusedPath(const std::filesystem::path &path) {
+	std::error_code ec;
+	std::filesystem::path candidate = path;
+	for (int i = 2; std::filesystem::exists(candidate, ec); ++i) {
+		candidate.replace_filename(path.stem().string() + "_" +
+								   std::to_string(i) +
+								   path.extension().string());
+	}
+	return candidate;
+}
+
+static void NoteOwnWrite(const std::filesystem::path &file) {
+	ownWrites[file] = Watcher::GetStamp(file);
+}
+
+// Tells the user an open file was changed by another program. Returns true
+// once they choose to reload it.
+static bool DrawDiskChangeBar(const std::filesystem::path &file) {
+	auto change = externalChanges.find(file);
+	if (change == externalChanges.end())
+		return false;
+
+	const bool removed = change->second;
+	ImGui::TextColored(ImVec4(0.9f, 0.6f, 0.2f, 1.0f), "%s was %s on disk",
+					   file.filename().string().c_str(),
+					   removed ? "deleted" : "changed");
+	bool reload = false;
+	if (!removed) {
+		ImGui::SameLine();
+		reload = ImGui::SmallButton("Reload");
+	}
+	ImGui::SameLine();
+	if (ImGui::SmallButton("Keep Mine") || reload)
+		externalChanges.erase(change);
+	return reload;
+}
+
 void DrawModelViewer(GLuint &texture_id, GLuint &RBO, GLuint &FBO) {
 
 	ImGui::Begin("Model Viewer", nullptr, ImGuiWindowFlags_NoMove);
@@ -328,6 +441,8 @@ void DrawModelViewer(GLuint &texture_id, GLuint &RBO, GLuint &FBO) {
 			isErrorOpen = true;
 			userError = LOAD_FAILED;
 		}
+		NoteOwnWrite(currentModelName);
+		MDL::ReloadModel();
 		texImportBrowser.ClearSelected();
 	}
 
@@ -336,7 +451,6 @@ void DrawModelViewer(GLuint &texture_id, GLuint &RBO, GLuint &FBO) {
 
 		QuakePrism::bindFramebuffer(FBO);
 
-		MDL::cleanup();
 		MDL::reshape(window_width * renderScale, window_height * renderScale);
 		MDL::render(currentModelName, textureMode, paused, lerpEnabled,
 					filteringEnabled);
@@ -353,7 +467,9 @@ void DrawTextureViewer() {
 		static int width, height;
 		static int xOff, yOff = 0;
 		static float scale = 0.9f;
-		if (localTextureName != currentTextureName.string()) {
+		if (localTextureName != currentTextureName.string() ||
+			reloadTexture) {
+			reloadTexture = false;
 			localTextureName = currentTextureName.string();
 			glDeleteTextures(1, &currentTexViewID);
 			currentTexViewID = 0;
@@ -533,8 +649,15 @@ void DrawSpriteTool() {
 	}
 	ImGui::PopButtonRepeat();
 
+	if (DrawDiskChangeBar(currentSpritePath)) {
+		activeSpriteFrame = 0;
+		SPR::CleanupSprite();
+		SPR::OpenSprite(currentSpritePath.string().c_str());
+	}
 	if (ImGui::Button("Save Sprite")) {
 		SPR::WriteSprite(currentSpritePath.string().c_str());
+		NoteOwnWrite(currentSpritePath);
+		externalChanges.erase(currentSpritePath);
 	}
 	ImGui::SameLine();
 	// File browser is for import texture
@@ -633,8 +756,41 @@ void DrawWADTool() {
 				ImGui::GetCursorScreenPos().y + 28.0f),
 		ImColor(255, 225, 135, 30));
 	
+	if (DrawDiskChangeBar(currentWadPath)) {
+		WAD::CleanupWad();
+		WAD::OpenWad(currentWadPath.string().c_str());
+	}
+	// A map's embedded textures have no WAD of their own yet, so the first
+	// save asks where to write them
+	static ImGui::FileBrowser saveWadBrowser(
+		ImGuiFileBrowserFlags_EnterNewFilename |
+		ImGuiFileBrowserFlags_CreateNewDir);
+	saveWadBrowser.SetTitle("Save WAD As");
+	saveWadBrowser.SetTypeFilters({".wad"});
+	if (!saveWadBrowser.IsOpened())
+		saveWadBrowser.SetPwd(previewMapPath.empty()
+								  ? baseDirectory
+								  : previewMapPath.parent_path());
+	bool saveWad = false;
 	if (ImGui::Button("Save WAD")) {
+		if (currentWadPath.empty())
+			saveWadBrowser.Open();
+		else
+			saveWad = true;
+	}
+	saveWadBrowser.Display();
+	if (saveWadBrowser.HasSelected()) {
+		currentWadPath = saveWadBrowser.GetSelected();
+		if (currentWadPath.extension() != ".wad")
+			currentWadPath += ".wad";
+		previewMapPath.clear();
+		saveWadBrowser.ClearSelected();
+		saveWad = true;
+	}
+	if (saveWad) {
 		WAD::WriteWad(currentWadPath.string().c_str());
+		NoteOwnWrite(currentWadPath);
+		externalChanges.erase(currentWadPath);
 	}
 	ImGui::SameLine();
 	
@@ -665,10 +821,34 @@ void DrawWADTool() {
 	}
 	
 	ImGui::SameLine();
-	if(ImGui::Button("Export WAD")) {
-		WAD::ExportAsImages();
+	static int pngCompression = 8;
+	if (WAD::IsExporting()) {
+		ImGui::ProgressBar(WAD::GetExportProgress(), ImVec2(120.0f, 0.0f));
+		ImGui::SameLine();
+		if (ImGui::Button("Cancel Export")) {
+			WAD::CancelExport();
+		}
+	} else if (ImGui::Button("Export WAD") &&
+			   !WAD::ExportAsImages(pngCompression)) {
+		isErrorOpen = true;
+		userError = SAVE_FAILED;
+	}
+	ImGui::SameLine();
+	static WAD::wadreport_t wadReport;
+	if (ImGui::Button("Analyze WAD")) {
+		if (WAD::AnalyzeWad(currentWadPath, baseDirectory, wadReport)) {
+			ImGui::OpenPopup("WAD Report");
+		} else {
+			isErrorOpen = true;
+			userError = LOAD_FAILED;
+		}
 	}
 	ImGui::SameLine();
+	ImGui::SetNextItemWidth(80.0f);
+	ImGui::SliderInt("##pngcompression", &pngCompression, 1, 9);
+	ImGui::SetItemTooltip("PNG compression level, higher is smaller but "
+						  "slower to export");
+	ImGui::SameLine();
 	
 	// File browser is for import texture
 	static ImGui::FileBrowser texImportBrowser;
@@ -731,6 +911,55 @@ void DrawWADTool() {
 		}
 		ImGui::EndGroup();
 	}
+	if (ImGui::BeginPopupModal("WAD Report", nullptr,
+							   ImGuiWindowFlags_AlwaysAutoResize)) {
+		ImGui::Text("Checked against %d maps", wadReport.mapCount);
+		if (!wadReport.unreadable.empty())
+			ImGui::TextColored(ImVec4(0.9f, 0.6f, 0.2f, 1.0f),
+							   "%zu maps could not be read, unused textures "
+							   "were not checked",
+							   wadReport.unreadable.size());
+		ImGui::Text("%zu unused, %zu duplicates", wadReport.unused.size(),
+					wadReport.duplicates.size());
+		ImGui::Text("%zu bytes can be saved", wadReport.savedSize);
+		ImGui::BeginChild("##wadreport", ImVec2(360.0f, 200.0f), true);
+		for (const auto &name : wadReport.unreadable) {
+			ImGui::Text("unreadable: %s", name.c_str());
+		}
+		for (const auto &name : wadReport.unused) {
+			ImGui::Text("unused: %s", name.c_str());
+		}
+		for (const auto &name : wadReport.duplicates) {
+			ImGui::Text("duplicate: %s", name.c_str());
+		}
+		ImGui::EndChild();
+
+		if (ImGui::Button("Write Compacted WAD")) {
+			std::filesystem::path compactPath = currentWadPath;
+			compactPath.replace_filename(currentWadPath.stem().string() +
+										 "-compact.wad");
+			compactPath = GetUnusedPath(compactPath);
+			if (WAD::WriteLumps(compactPath.string().c_str(),
+								wadReport.compacted)) {
+				NoteOwnWrite(compactPath);
+				externalChanges.erase(compactPath);
+				currentWadPath = compactPath;
+				WAD::CleanupWad();
+				WAD::OpenWad(compactPath.string().c_str());
+			} else {
+				isErrorOpen = true;
+				userError = SAVE_FAILED;
+			}
+			wadReport = {};
+			ImGui::CloseCurrentPopup();
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Close")) {
+			wadReport = {};
+			ImGui::CloseCurrentPopup();
+		}
+		ImGui::EndPopup();
+	}
 	if (ImGui::BeginPopup("Wad Menu")) {
 		if (ImGui::MenuItem("Remove")) {
 			WAD::RemoveImage(selectedEntry);
@@ -745,57 +974,102 @@ void DrawWADTool() {
 
 void DrawDebugConsole() {
 	static bool consoleOpen = true;
-	if (isCompiling)
+	if (showConsole) {
 		consoleOpen = true;
+		showConsole = false;
+	}
 	if (consoleOpen) {
 		ImGui::Begin("Console", &consoleOpen, ImGuiWindowFlags_NoMove);
 		static std::string consoleText = "";
-		if (isCompiling) {
-			consoleText = getCompilerOutputString();
-			isCompiling = false;
+		static uint64_t consoleVersion = 0;
+
+		if (Compiler::IsCompiling()) {
+			ImGui::Text("Compiling... %.1fs", Compiler::GetElapsedSeconds());
+			ImGui::SameLine();
+			if (ImGui::Button("Cancel"))
+				Compiler::CancelCompile();
+		} else if (consoleVersion != 0)
+			ImGui::TextDisabled("Compiled in %.1fs",
+								Compiler::GetElapsedSeconds());
+
+		// output streams in while fteqcc runs, follow it if at the bottom
+		ImGui::BeginChild("ConsoleOutput");
+		const bool atBottom = ImGui::GetScrollY() >= ImGui::GetScrollMaxY();
+		const uint64_t version = Compiler::GetOutputVersion();
+		if (version != consoleVersion) {
+			consoleText = Compiler::GetOutput();
+			consoleVersion = version;
 		}
 		ImGui::TextUnformatted(consoleText.c_str());
+		if (atBottom)
+			ImGui::SetScrollHereY(1.0f);
+		ImGui::EndChild();
 		ImGui::End();
 	}
 }
 
-static void SaveQuakeCFile(std::string textToSave,
-						   const std::filesystem::path &currentFile) {
-	// had issue with extra whitespace so this cleans that
-	size_t end = textToSave.find_last_not_of(" \t\n\r");
-	if (end == std::string::npos) {
-		textToSave = ""; // All characters are whitespace or newlines
-	}
-	textToSave = textToSave.substr(0, end + 1);
-	std::ofstream output(currentFile);
-	if (output.is_open()) {
-		output << textToSave;
-		output.close();
-	} else {
+void SaveFromEditor(TextEditor *editor) {
+	for (int i = 0; i < editorList.size(); ++i) {
+		if (editorList.at(i).get() == editor) {
+			editor->SaveFile(currentQCFileNames.at(i).string());
+			break;
+		}
+	}
+}
+
+// Picks up a background save of a tab once it has been written out
+static void FinishSave(const int tab) {
+	TextEditor &editor = *editorList.at(tab);
+	if (!editor.PollSave())
+		return;
+	if (editor.GetSaveState() == TextEditor::SaveState::Failed) {
 		isErrorOpen = true;
 		userError = SAVE_FAILED;
+		return;
 	}
+	NoteOwnWrite(currentQCFileNames.at(tab));
+	externalChanges.erase(currentQCFileNames.at(tab));
+	// edits made while the file was written still need their journal
+	if (!editor.IsUnsaved())
+		Journal::Discard(currentQCFileNames.at(tab));
+	Symbols::UpdateFile(currentQCFileNames.at(tab));
+	RequestCompile(true);
 }
 
-void SaveFromEditor(TextEditor *editor) {
-	std::string textToSave = editor->GetText();
-	for (int i = 0; i < editorList.size(); ++i) {
-		if (&editorList.at(i) == editor) {
-			SaveQuakeCFile(textToSave, currentQCFileNames.at(i));
-			createTextEditorDiagnostics();
-			break;
-		}
+static const char *GetSaveStatus(const TextEditor &editor) {
+	switch (editor.GetSaveState()) {
+	case TextEditor::SaveState::Saving:
+		return "Saving...";
+	case TextEditor::SaveState::Failed:
+		return "Save failed";
+	case TextEditor::SaveState::Saved:
+		return editor.IsUnsaved() ? "*" : "Saved";
+	default:
+		return editor.IsUnsaved() ? "*" : " ";
 	}
 }
 
+// Reads a tab's file again, keeping the cursor on the same line
+static void ReloadTab(TextEditor &editor, const std::filesystem::path &file) {
+	auto cursor = editor.GetCursorPosition();
+	if (!editor.LoadFile(file.string())) {
+		isErrorOpen = true;
+		userError = LOAD_FAILED;
+		return;
+	}
+	// the disk contents replace the edits, so there is nothing left to save
+	assert(!editor.IsUnsaved());
+	Journal::Discard(file);
+	cursor.mLine = std::min(cursor.mLine, editor.GetTotalLines() - 1);
+	editor.SetCursorPosition(cursor);
+}
+
 static void DrawTextTab(TextEditor &editor,
 						const std::filesystem::path &currentFile, bool &tabOpen,
 						const bool focused, const bool isFindOpen) {
-	auto lang = TextEditor::LanguageDefinition::QuakeC();
-	editor.SetLanguageDefinition(lang);
 	ImGuiTabItemFlags flags = ImGuiTabItemFlags_None;
 	if (focused) {
-		newTabOpened = false;
+		focusTabIndex = -1;
 		flags = ImGuiTabItemFlags_SetSelected;
 	}
 	if (ImGui::BeginTabItem(currentFile.filename().string().c_str(), &tabOpen,
@@ -809,31 +1083,269 @@ static void DrawTextTab(TextEditor &editor,
 				   ImGui::GetCursorScreenPos().y + 28.0f),
 			ImColor(255, 225, 135, 30));
 
-		ImGui::Text("%6d/%-6d %6d lines  | %s | %s | %s ", cpos.mLine + 1,
+		ImGui::Text("%6d/%-6d %6d lines%s | %s | %s | %s ", cpos.mLine + 1,
 					cpos.mColumn + 1, editor.GetTotalLines(),
+					editor.IsLoading() ? "..." : "  ",
 					editor.IsOverwrite() ? "Ovr" : "Ins",
-					editor.IsUnsaved() ? "*" : " ",
+					GetSaveStatus(editor),
 					editor.GetLanguageDefinition().mName.c_str());
+		const auto &function = editor.GetCurrentFunction();
+		if (!function.empty()) {
+			ImGui::SameLine();
+			ImGui::TextDisabled("in %s()", function.c_str());
+		}
+		if (DrawDiskChangeBar(currentFile))
+			ReloadTab(editor, currentFile);
 		if (isFindOpen) {
+			static char expr[256] = "";
+			static TextEditor::FindOptions options;
+			bool edited = false;
+
 			ImGui::SameLine();
 			ImGui::SetNextItemWidth(256.0f);
-			static char expr[32] = "";
-			ImGui::InputText("##expr", expr, IM_ARRAYSIZE(expr));
+			edited |= ImGui::InputText("##expr", expr, IM_ARRAYSIZE(expr));
+			// enter jumps to the next match and keeps the box focused
+			const bool enter = ImGui::IsItemDeactivated() &&
+							   ImGui::IsKeyPressed(ImGuiKey_Enter);
+			if (enter)
+				ImGui::SetKeyboardFocusHere(-1);
 			ImGui::SameLine();
-			if (ImGui::Button("Next")) {
-				editor.SelectNextOccurrenceOf(expr, strlen(expr));
-			}
-		}
+			edited |= ImGui::Checkbox("Aa", &options.mCaseSensitive);
+			ImGui::SameLine();
+			edited |= ImGui::Checkbox("Word", &options.mWholeWord);
+			ImGui::SameLine();
+			edited |= ImGui::Checkbox(".*", &options.mRegex);
+
+			// every tab shares the query, so switching tabs keeps the search
+			editor.SetFindQuery(expr, options);
+			if (edited)
+				editor.SelectNextMatch(false, true);
+
+			ImGui::SameLine();
+			if (ImGui::Button("Prev"))
+				editor.SelectNextMatch(true);
+			ImGui::SameLine();
+			if (ImGui::Button("Next") || enter)
+				editor.SelectNextMatch(ImGui::GetIO().KeyShift);
+
+			ImGui::SameLine();
+			const auto &matches = editor.GetFindMatches();
+			if (!editor.GetFindError().empty())
+				ImGui::TextColored(ImVec4(0.9f, 0.4f, 0.3f, 1.0f), "%s",
+								   editor.GetFindError().c_str());
+			else if (expr[0] != '\0' && matches.empty())
+				ImGui::TextUnformatted("No results");
+			else if (!matches.empty())
+				ImGui::Text("%d of %d", editor.GetCurrentFindMatch() + 1,
+							(int)matches.size());
+		} else
+			editor.SetFindQuery("", TextEditor::FindOptions());
 		editor.Render("TextEditor");
 		ImGui::EndTabItem();
 	}
 }
 
-static void RemoveEditorTab(int index) {
+// Opens a file in a new editor tab, or brings its tab to the front if it is
+// already open. Returns the index of the tab or -1 if it could not be read.
+static int OpenTextFile(const std::filesystem::path &path) {
+	auto open =
+		std::find(currentQCFileNames.begin(), currentQCFileNames.end(), path);
+	if (open != currentQCFileNames.end()) {
+		focusTabIndex = open - currentQCFileNames.begin();
+		return focusTabIndex;
+	}
+
+	auto editor = std::make_unique<TextEditor>();
+	if (!editor->LoadFile(path.string())) {
+		isErrorOpen = true;
+		userError = LOAD_FAILED;
+		return -1;
+	}
+
+	currentQCFileNames.push_back(path);
+	editor->SetFileName(path.filename().string());
+	editor->SetRecordEdits(true);
+	if (editorTheme == "prism-dark") {
+		editor->SetPalette(TextEditor::GetDarkPalette());
+	} else if (editorTheme == "prism-light") {
+		editor->SetPalette(TextEditor::GetLightPalette());
+	} else if (editorTheme == "prism-retro") {
+		editor->SetPalette(TextEditor::GetRetroBluePalette());
+	}
+	editorList.push_back(std::move(editor));
+	// markers come from the last compile, or a first one if there was none
+	if (GetCompileResult())
+		createTextEditorDiagnostics();
+	else if (!Compiler::IsCompiling())
+		RequestCompile(true);
+	focusTabIndex = editorList.size() - 1;
+	return focusTabIndex;
+}
+
+// Opens a file and selects a span of one of its lines
+static void SelectInFile(const std::filesystem::path &path, const int line,
+						 const int start, const int end) {
+	const int tab = OpenTextFile(path);
+	if (tab < 0)
+		return;
+	TextEditor &editor = *editorList.at(tab);
+	const auto selectionStart = editor.IndexToCoordinates(line, start);
+	const auto selectionEnd = editor.IndexToCoordinates(line, end);
+	editor.SetSelection(selectionStart, selectionEnd);
+	editor.SetCursorPosition(selectionEnd);
+}
+
+void GoToDefinition(const std::string &name) {
+	Symbols::symbol_t symbol;
+	if (!name.empty() && Symbols::FindDefinition(name, symbol))
+		SelectInFile(symbol.file, symbol.line, symbol.start, symbol.end);
+}
+
+// the Find in Files pane lists either search results or references
+static std::vector<Search::searchresult_t> findResults;
+static std::string referencesName;
+
+void ShowReferences(const std::string &name) {
+	if (name.empty())
+		return;
+	// an empty search stops the running one and drops what it found
+	std::string error;
+	Search::StartSearch("", Search::searchoptions_t(), baseDirectory, error);
+	findResults = Symbols::FindReferences(name);
+	referencesName = name;
+	isFindInFilesOpen = true;
+}
+
+static void DrawFindInFiles() {
+	if (!isFindInFilesOpen)
+		return;
+	if (!ImGui::Begin("Find in Files", &isFindInFilesOpen,
+					  ImGuiWindowFlags_NoMove)) {
+		ImGui::End();
+		return;
+	}
+
+	static char pattern[256] = "";
+	static Search::searchoptions_t options = {};
+	static std::string searchError;
+	auto &results = findResults;
+
+	ImGui::SetNextItemWidth(256.0f);
+	bool start = ImGui::InputText("##findinfiles", pattern,
+								  IM_ARRAYSIZE(pattern),
+								  ImGuiInputTextFlags_EnterReturnsTrue);
+	ImGui::SameLine();
+	start |= ImGui::Button("Search");
+	ImGui::SameLine();
+	ImGui::Checkbox("Aa", &options.caseSensitive);
+	ImGui::SameLine();
+	ImGui::Checkbox("Word", &options.wholeWord);
+	ImGui::SameLine();
+	ImGui::Checkbox(".*", &options.regex);
+	ImGui::SameLine();
+	ImGui::Checkbox("Whole Project", &options.wholeProject);
+	ImGui::SetItemTooltip("Search every file of the project instead of "
+						  "just the src folder");
+
+	if (start) {
+		results.clear();
+		referencesName.clear();
+		searchError.clear();
+		Search::StartSearch(pattern, options, baseDirectory, searchError);
+	}
+	Search::TakeResults(results);
+
+	if (Search::IsSearching()) {
+		ImGui::SameLine();
+		ImGui::ProgressBar(Search::GetSearchProgress(), ImVec2(120.0f, 0.0f));
+		ImGui::SameLine();
+		if (ImGui::Button("Cancel"))
+			Search::CancelSearch();
+	}
+
+	if (!searchError.empty())
+		ImGui::TextColored(ImVec4(0.9f, 0.4f, 0.3f, 1.0f), "%s",
+						   searchError.c_str());
+	else if (!referencesName.empty())
+		ImGui::Text("%zu references to %s%s", results.size(),
+					referencesName.c_str(),
+					Symbols::IsIndexing() ? ", still indexing" : "");
+	else
+		ImGui::Text("%zu results in %zu files%s", results.size(),
+					Search::GetFilesSearched(),
+					Search::IsTruncated() ? ", stopped early" : "");
+
+	// only the rows in view are laid out, so huge result lists stay cheap
+	ImGui::BeginChild("##findresults");
+	ImGuiListClipper clipper;
+	clipper.Begin(static_cast<int>(results.size()));
+	while (clipper.Step()) {
+		for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+			const auto &result = results[i];
+			const std::string label =
+				result.file.lexically_relative(baseDirectory).string() + ":" +
+				std::to_string(result.line + 1) + ": " + result.text;
+			ImGui::PushID(i);
+			if (ImGui::Selectable(label.c_str()))
+				SelectInFile(result.file, result.line, result.start,
+							 result.end);
+			ImGui::PopID();
+		}
+	}
+	clipper.End();
+	ImGui::EndChild();
+	ImGui::End();
+}
+
+// unsaved work found in the journals of the project that was just opened
+static std::vector<Journal::recovered_t> recoveredFiles;
+
+// A tab's save, and one queued behind it, reach the disk before the tab
+// goes. Returns false and keeps the tab if that save failed, so its journal
+// is still there.
+static bool RemoveEditorTab(int index) {
 	if (index >= 0 && index < editorList.size()) {
+		TextEditor &editor = *editorList.at(index);
+		const bool saving =
+			editor.GetSaveState() == TextEditor::SaveState::Saving;
+		editor.WaitForSave();
+		FinishSave(index);
+		if (saving && editor.GetSaveState() == TextEditor::SaveState::Failed)
+			return false;
+
+		// the menu bar uses the current editor before the tabs pick the next
+		// one, so it moves to a neighbour right away
+		const bool current = &editor == currentTextEditor;
+		Journal::Discard(currentQCFileNames.at(index));
+		externalChanges.erase(currentQCFileNames.at(index));
 		editorList.erase(editorList.begin() + index);
 		currentQCFileNames.erase(currentQCFileNames.begin() + index);
+		if (current && editorList.empty())
+			currentTextEditor = nullptr;
+		else if (current)
+			currentTextEditor =
+				editorList.at(std::min<size_t>(index, editorList.size() - 1))
+					.get();
+	}
+	return true;
+}
+
+static void RemoveAllEditorTabs() {
+	for (int i = 0; i < editorList.size(); ++i) {
+		// the files belong to the project being left, so only the journal
+		// is brought up to date once their saves are written
+		TextEditor &editor = *editorList.at(i);
+		editor.WaitForSave();
+		if (editor.PollSave() &&
+			editor.GetSaveState() == TextEditor::SaveState::Saved &&
+			!editor.IsUnsaved())
+			Journal::Discard(currentQCFileNames.at(i));
+		externalChanges.erase(currentQCFileNames.at(i));
 	}
+	editorList.clear();
+	currentQCFileNames.clear();
+	currentTextEditor = nullptr;
+	focusTabIndex = -1;
 }
 
 void DrawTextEditor() {
@@ -856,6 +1368,7 @@ void DrawTextEditor() {
 
 	ImGui::DockBuilderDockWindow("Editor", dock_id_up);
 	ImGui::DockBuilderDockWindow("Console", dock_id_down);
+	ImGui::DockBuilderDockWindow("Find in Files", dock_id_down);
 
 	ImGui::DockBuilderFinish(dockspace_id);
 	ImGui::End();
@@ -886,6 +1399,13 @@ void DrawTextEditor() {
 				if (ImGui::MenuItem("Find", "Ctrl-F")) {
 					isFindOpen = !isFindOpen;
 				}
+				if (ImGui::MenuItem("Find in Files", "Ctrl-Shift-F")) {
+					isFindInFilesOpen = true;
+				}
+				if (ImGui::MenuItem("Go to Definition", "F12"))
+					GoToDefinition(currentTextEditor->GetWordUnderCursor());
+				if (ImGui::MenuItem("Find References", "Shift-F12"))
+					ShowReferences(currentTextEditor->GetWordUnderCursor());
 
 				ImGui::Separator();
 
@@ -919,21 +1439,21 @@ void DrawTextEditor() {
 				editorTheme = "prism-dark";
 				UpdateQProjectFile();
 				for (auto &editor : editorList) {
-					editor.SetPalette(TextEditor::GetDarkPalette());
+					editor->SetPalette(TextEditor::GetDarkPalette());
 				}
 			}
 			if (ImGui::MenuItem("Light Mode")) {
 				editorTheme = "prism-light";
 				UpdateQProjectFile();
 				for (auto &editor : editorList) {
-					editor.SetPalette(TextEditor::GetLightPalette());
+					editor->SetPalette(TextEditor::GetLightPalette());
 				}
 			}
 			if (ImGui::MenuItem("Retro Mode")) {
 				editorTheme = "prism-retro";
 				UpdateQProjectFile();
 				for (auto &editor : editorList) {
-					editor.SetPalette(TextEditor::GetRetroBluePalette());
+					editor->SetPalette(TextEditor::GetRetroBluePalette());
 				}
 			}
 			ImGui::EndMenu();
@@ -944,23 +1464,19 @@ void DrawTextEditor() {
 	if (ImGui::BeginTabBar("Tab Bar")) {
 		for (int i = 0; i < editorList.size(); ++i) {
 			bool tabOpen = true;
-			if ((i == editorList.size() - 1) && newTabOpened) {
-				DrawTextTab(editorList.at(i), currentQCFileNames.at(i), tabOpen,
-							true, isFindOpen);
-			} else {
-				DrawTextTab(editorList.at(i), currentQCFileNames.at(i), tabOpen,
-							false, isFindOpen);
-			}
-			if (!tabOpen) {
-				RemoveEditorTab(i);
+			FinishSave(i);
+			Journal::Record(currentQCFileNames.at(i), *editorList.at(i));
+			DrawTextTab(*editorList.at(i), currentQCFileNames.at(i), tabOpen,
+						i == focusTabIndex, isFindOpen);
+			if (!tabOpen && RemoveEditorTab(i))
 				--i;
-			}
 		}
 		ImGui::EndTabBar();
 	}
 	ImGui::End();
 
 	DrawDebugConsole();
+	DrawFindInFiles();
 }
 
 static bool AlphabeticalComparator(const std::filesystem::directory_entry &a,
@@ -968,39 +1484,74 @@ static bool AlphabeticalComparator(const std::filesystem::directory_entry &a,
 	return a.path().filename().string() < b.path().filename().string();
 }
 
-static void DrawFileTree(const std::filesystem::path &currentPath) {
-	if (!currentPath.empty()) {
-		std::vector<std::filesystem::directory_entry> directoryEntries;
+// the sorted contents of each folder the Project Browser has shown, until
+// the watcher sees something come or go in it
+static std::map<std::filesystem::path,
+				std::vector<std::filesystem::directory_entry>>
+	folderListings;
+
+// Drops the listing of a folder and of every folder under it
+static void ForgetListings(const std::filesystem::path &folder) {
+	const std::string prefix = folder.string();
+	for (auto it = folderListings.lower_bound(folder);
+		 it != folderListings.end();) {
+		const std::string path = it->first.string();
+		if (path.compare(0, prefix.size(), prefix) != 0)
+			break;
+		if (path.size() == prefix.size() ||
+			path[prefix.size()] == std::filesystem::path::preferred_separator)
+			it = folderListings.erase(it);
+		else
+			++it;
+	}
+}
 
-		// Collect all entries (both directories and files) in the current
-		// path
-		for (auto &directoryEntry :
-			 std::filesystem::directory_iterator(currentPath)) {
-			directoryEntries.push_back(directoryEntry);
-		}
+static std::vector<std::filesystem::directory_entry>
+ListFolder(const std::filesystem::path &currentPath) {
+	std::vector<std::filesystem::directory_entry> directoryEntries;
 
-		// Sort entries alphabetically
-		std::sort(directoryEntries.begin(), directoryEntries.end(),
-				  AlphabeticalComparator);
+	// Collect all entries (both directories and files) in the current path
+	std::error_code ec;
+	for (auto it = std::filesystem::directory_iterator(currentPath, ec);
+		 !ec && it != std::filesystem::directory_iterator();
+		 it.increment(ec)) {
+		directoryEntries.push_back(*it);
+	}
 
-		// Separate directories and files
-		std::vector<std::filesystem::directory_entry> directories;
-		std::vector<std::filesystem::directory_entry> files;
+	// Sort entries alphabetically
+	std::sort(directoryEntries.begin(), directoryEntries.end(),
+			  AlphabeticalComparator);
 
-		for (const auto &entry : directoryEntries) {
-			if (entry.is_directory()) {
-				directories.push_back(entry);
-			} else {
-				files.push_back(entry);
-			}
+	// Separate directories and files
+	std::vector<std::filesystem::directory_entry> directories;
+	std::vector<std::filesystem::directory_entry> files;
+
+	for (const auto &entry : directoryEntries) {
+		if (entry.is_directory()) {
+			directories.push_back(entry);
+		} else {
+			files.push_back(entry);
 		}
+	}
 
-		// Merge directories and files back into the entryList
-		directoryEntries.clear();
-		directoryEntries.insert(directoryEntries.end(), directories.begin(),
-								directories.end());
-		directoryEntries.insert(directoryEntries.end(), files.begin(),
-								files.end());
+	// Merge directories and files back into the entryList
+	directoryEntries.clear();
+	directoryEntries.insert(directoryEntries.end(), directories.begin(),
+							directories.end());
+	directoryEntries.insert(directoryEntries.end(), files.begin(),
+							files.end());
+	return directoryEntries;
+}
+
+static void DrawFileTree(const std::filesystem::path &currentPath) {
+	if (!currentPath.empty()) {
+		auto listing = folderListings.find(currentPath);
+		if (listing == folderListings.end())
+			listing = folderListings
+						  .emplace(currentPath, ListFolder(currentPath))
+						  .first;
+		// map nodes stay put while the folders below add their own
+		const auto &directoryEntries = listing->second;
 
 		for (auto &directoryEntry : directoryEntries) {
 			const auto &path = directoryEntry.path();
@@ -1074,6 +1625,25 @@ static void DrawFileTree(const std::filesystem::path &currentPath) {
 				if (ImGui::MenuItem("Delete")) {
 					std::filesystem::remove_all(path);
 				}
+				if ((directoryEntry.is_directory() ||
+					 path.extension() == ".bsp") &&
+					ImGui::MenuItem("Extract Textures")) {
+					std::filesystem::path wadPath = path;
+					wadPath.replace_extension(".wad");
+					wadPath = GetUnusedPath(wadPath);
+					if (BSP::ExtractTexturesToWad(BSP::FindMaps(path),
+												  wadPath)) {
+						NoteOwnWrite(wadPath);
+						externalChanges.erase(wadPath);
+						currentWadPath = wadPath;
+						WAD::CleanupWad();
+						WAD::OpenWad(wadPath.string().c_str());
+						ImGui::SetWindowFocus("WAD Tools");
+					} else {
+						isErrorOpen = true;
+						userError = SAVE_FAILED;
+					}
+				}
 				ImGui::EndPopup();
 			}
 
@@ -1081,37 +1651,7 @@ static void DrawFileTree(const std::filesystem::path &currentPath) {
 				// Handle file loading based on extension
 				if (path.extension() == ".qc" || path.extension() == ".src" ||
 					path.extension() == ".rc" || path.extension() == ".cfg") {
-					std::ifstream input(path);
-					if (input.good()) {
-						// prevent duplicate tabs from being opened
-						if (std::find(currentQCFileNames.begin(),
-									  currentQCFileNames.end(),
-									  path) == currentQCFileNames.end()) {
-							currentQCFileNames.push_back(path);
-							newTabOpened = true;
-							std::string str(
-								(std::istreambuf_iterator<char>(input)),
-								std::istreambuf_iterator<char>());
-							TextEditor editor;
-							editor.SetText(str);
-							editor.SetFileName(path.filename().string());
-							if (editorTheme == "prism-dark") {
-								editor.SetPalette(TextEditor::GetDarkPalette());
-							} else if (editorTheme == "prism-light") {
-								editor.SetPalette(
-									TextEditor::GetLightPalette());
-							} else if (editorTheme == "prism-retro") {
-								editor.SetPalette(
-									TextEditor::GetRetroBluePalette());
-							}
-							createTextEditorDiagnostics();
-							editorList.push_back(editor);
-						}
-					} else {
-						isErrorOpen = true;
-						userError = LOAD_FAILED;
-					}
-					input.close();
+					OpenTextFile(path);
 					ImGui::SetWindowFocus("QuakeC Editor");
 				} else if (path.extension() == ".mdl") {
 					std::ifstream input(path);
@@ -1148,6 +1688,7 @@ static void DrawFileTree(const std::filesystem::path &currentPath) {
 					if (input.good()) {
 						activeSpriteFrame = 0;
 						currentSpritePath = path;
+						externalChanges.erase(path);
 						SPR::CleanupSprite();
 						SPR::OpenSprite(path.string().c_str());
 					} else {
@@ -1159,6 +1700,7 @@ static void DrawFileTree(const std::filesystem::path &currentPath) {
 					std::ifstream input(path);
 					if (input.good()) {
 						currentWadPath = path;
+						externalChanges.erase(path);
 						WAD::CleanupWad();
 						WAD::OpenWad(path.string().c_str());
 					} else {
@@ -1166,6 +1708,20 @@ static void DrawFileTree(const std::filesystem::path &currentPath) {
 						userError = LOAD_FAILED;
 					}
 					ImGui::SetWindowFocus("WAD Tools");
+				} else if (path.extension() == ".bsp") {
+					// opens the embedded textures, saving asks where to
+					// write them out as a WAD
+					std::vector<WAD::wadlump_t> textures;
+					if (BSP::ReadTextures(path, textures)) {
+						currentWadPath.clear();
+						previewMapPath = path;
+						WAD::CleanupWad();
+						WAD::OpenLumps(textures);
+					} else {
+						isErrorOpen = true;
+						userError = LOAD_FAILED;
+					}
+					ImGui::SetWindowFocus("WAD Tools");
 				}
 			}
 
@@ -1184,11 +1740,6 @@ static void DrawFileTree(const std::filesystem::path &currentPath) {
 void DrawFileExplorer() {
 
 	ImGui::Begin("Project Browser", nullptr, ImGuiWindowFlags_NoMove);
-	// prevents crash if user deletes a project folder and then tries to
-	// open it for some reason
-	if (!std::filesystem::exists(baseDirectory)) {
-		baseDirectory.clear();
-	}
 	if (baseDirectory.empty()) {
 		if (ImGui::Button("New Project")) {
 			isNewProjectOpen = true;
@@ -1204,6 +1755,77 @@ void DrawFileExplorer() {
 	ImGui::End();
 }
 
+// Brings what is open up to date with a file another program changed
+static void HandleFileChange(const std::filesystem::path &path,
+							 const Watcher::fileeventkind_t kind) {
+	if (path.empty())
+		return;
+	const bool removed = kind == Watcher::FILE_REMOVED;
+	if (path == currentModelName)
+		MDL::ReloadModel();
+	if (path == currentTextureName)
+		reloadTexture = true;
+	// the sprite and WAD tools may hold changes not written out yet
+	if (path == currentSpritePath || path == currentWadPath)
+		externalChanges[path] = removed;
+
+	for (int i = 0; i < editorList.size(); ++i) {
+		if (currentQCFileNames.at(i) != path)
+			continue;
+		TextEditor &editor = *editorList.at(i);
+		if (editor.GetSaveState() == TextEditor::SaveState::Saving)
+			continue;
+		if (!removed && !editor.IsUnsaved())
+			ReloadTab(editor, path);
+		else
+			externalChanges[path] = removed;
+	}
+}
+
+void HandleFileChanges() {
+	static std::filesystem::path watchedDirectory;
+	if (baseDirectory != watchedDirectory) {
+		// prevents crash if user deletes a project folder and then tries to
+		// open it for some reason
+		if (!baseDirectory.empty() && !std::filesystem::exists(baseDirectory))
+			baseDirectory.clear();
+		watchedDirectory = baseDirectory;
+		Watcher::StartWatching(baseDirectory);
+		folderListings.clear();
+		ownWrites.clear();
+	}
+
+	for (const auto &event : Watcher::TakeEvents()) {
+		if (event.path == baseDirectory) {
+			if (event.kind == Watcher::FILE_REMOVED) {
+				baseDirectory.clear();
+				return;
+			}
+			// the watcher lost track, so anything open may be stale
+			folderListings.clear();
+			for (const auto &file : currentQCFileNames)
+				HandleFileChange(file, Watcher::FILE_CHANGED);
+			for (const auto &file : {currentModelName, currentTextureName,
+									 currentSpritePath, currentWadPath})
+				HandleFileChange(file, Watcher::FILE_CHANGED);
+			continue;
+		}
+
+		if (event.kind != Watcher::FILE_CHANGED) {
+			ForgetListings(event.path.parent_path());
+			ForgetListings(event.path);
+		}
+		auto own = ownWrites.find(event.path);
+		if (own != ownWrites.end() &&
+			Watcher::SameStamp(own->second, Watcher::GetStamp(event.path)))
+			continue;
+
+		// the index also picks up sources the compiler or git rewrote
+		Symbols::UpdateFile(event.path);
+		HandleFileChange(event.path, event.kind);
+	}
+}
+
 void DrawPaletteTool() {
 	static float colors[256][3];
 	if (!palLoaded) {
@@ -1304,8 +1926,10 @@ void DrawOpenProjectPopup() {
 			// Handle qproj file
 			CreateQProjectFile(); // only will work if the file DNE
 			ReadQProjectFile();
+			Symbols::StartIndexing(baseDirectory);
 
-			currentQCFileNames.clear();
+			RemoveAllEditorTabs();
+			recoveredFiles = Journal::Open(baseDirectory);
 			currentModelName.clear();
 			currentTextureName.clear();
 			loadColormap();
@@ -1326,8 +1950,10 @@ void DrawOpenProjectPopup() {
 				// Handle qproj file
 				CreateQProjectFile(); // only will work if the file DNE
 				ReadQProjectFile();
+				Symbols::StartIndexing(baseDirectory);
 
-				currentQCFileNames.clear();
+				RemoveAllEditorTabs();
+				recoveredFiles = Journal::Open(baseDirectory);
 				currentModelName.clear();
 				currentTextureName.clear();
 				loadColormap();
@@ -1587,9 +2213,11 @@ void DrawNewProjectPopup() {
 				// Handle qproj file
 				CreateQProjectFile(); // only will work if the file DNE
 				ReadQProjectFile();
+				Symbols::StartIndexing(baseDirectory);
 
 				selectedProjectDirecory.clear();
-				currentQCFileNames.clear();
+				RemoveAllEditorTabs();
+				recoveredFiles = Journal::Open(baseDirectory);
 				currentModelName.clear();
 				currentTextureName.clear();
 				projectName[0] = '\0';
@@ -1699,6 +2327,43 @@ void DrawStartupPopup() {
 	}
 }
 
+void DrawRecoverPopup() {
+	if (recoveredFiles.empty())
+		return;
+
+	ImGui::OpenPopup("Recover Unsaved Changes");
+	if (ImGui::BeginPopupModal("Recover Unsaved Changes", nullptr,
+							   ImGuiWindowFlags_AlwaysAutoResize)) {
+		ImGui::Text("These files had unsaved changes when Quake Prism last "
+					"closed:");
+		for (const auto &recovered : recoveredFiles) {
+			const auto name = recovered.file.lexically_relative(baseDirectory);
+			ImGui::BulletText("%s", name.string().c_str());
+		}
+
+		if (ImGui::Button("Restore")) {
+			for (const auto &recovered : recoveredFiles) {
+				const int tab = OpenTextFile(recovered.file);
+				if (tab >= 0)
+					editorList.at(tab)->ReplaceText(recovered.text);
+				else
+					Journal::Discard(recovered.file);
+			}
+			recoveredFiles.clear();
+			ImGui::CloseCurrentPopup();
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Discard")) {
+			for (const auto &recovered : recoveredFiles)
+				Journal::Discard(recovered.file);
+			recoveredFiles.clear();
+			ImGui::CloseCurrentPopup();
+		}
+
+		ImGui::EndPopup();
+	}
+}
+
 void DrawErrorPopup() {
 	if (!isErrorOpen)
 		return;
@@ -21,9 +21,20 @@ along with this program.
 #include <GL/glew.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
+#include <string>
 
 namespace QuakePrism {
 
+// Starts watching the project once it is opened and updates open files,
+// the model and texture views and the Project Browser with what changed on
+// disk. Call once a frame before drawing.
+void HandleFileChanges();
+
+// Applies a finished compile to the error markers of the open tabs, starts
+// the compile a save asked for while another was running and launches the
+// game after Compile and Run. Call once a frame before drawing.
+void HandleCompileResults();
+
 void DrawMenuBar();
 
 void DrawModelViewer(GLuint &texture_id, GLuint &RBO, GLuint &FBO);
@@ -40,6 +51,9 @@ void DrawTextEditor();
 
 void DrawErrorPopup();
 
+// Offers to bring back the unsaved work of the last session
+void DrawRecoverPopup();
+
 void DrawAboutPopup();
 
 void DrawStartupPopup();
@@ -54,4 +68,10 @@ void DrawNewProjectPopup();
 
 void SaveFromEditor(TextEditor *editor);
 
+// Opens the file that defines a global and selects its name
+void GoToDefinition(const std::string &name);
+
+// Lists every use of a name in the Find in Files pane
+void ShowReferences(const std::string &name);
+
 } // namespace QuakePrism
@@ -77,8 +77,9 @@ GLuint importCard;
 GLuint libreCard;
 
 // Text Editor
-std::vector<TextEditor> editorList;
+std::vector<std::unique_ptr<TextEditor>> editorList;
 bool isFindOpen = false;
+bool isFindInFilesOpen = false;
 std::string editorTheme = "prism-dark";
 
 // Config Files
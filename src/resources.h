@@ -25,6 +25,7 @@ along with this program.
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
 #include <filesystem>
+#include <memory>
 #include <vector>
 
 namespace QuakePrism {
@@ -73,8 +74,10 @@ extern GLuint importCard;
 extern GLuint libreCard;
 
 // Text Editor Info
-extern std::vector<TextEditor> editorList;
+// each editor stays at the same address until its tab is closed
+extern std::vector<std::unique_ptr<TextEditor>> editorList;
 extern bool isFindOpen;
+extern bool isFindInFilesOpen;
 extern std::string editorTheme;
 
 // Config Assets
@@ -0,0 +1,358 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#include "search.h"
+#include "jobs.h"
+#include "mappedfile.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <system_error>
+
+namespace QuakePrism::Search {
+
+// more than this and the list stops being useful anyway
+static constexpr size_t maxResults = 100000;
+
+// long lines are cut down to this much text around the match
+static constexpr size_t maxPreviewLength = 256;
+
+// fuzzy matching only looks this far into a name
+static constexpr size_t maxFuzzyLength = 128;
+
+static std::mutex resultsMutex;
+static std::vector<searchresult_t> pendingResults;
+static std::atomic<size_t> resultCount{0};
+
+static Jobs::Task searchTask;
+
+LiteralFinder::LiteralFinder(const std::string &pattern,
+							 const bool caseSensitive)
+	: pattern(pattern), caseSensitive(caseSensitive) {
+	for (int c = 0; c < 256; ++c)
+		fold[c] = caseSensitive ? c : tolower(c);
+	for (auto &c : this->pattern)
+		c = fold[static_cast<unsigned char>(c)];
+
+	const size_t size = this->pattern.size();
+	skip.fill(size);
+	for (size_t i = 0; i + 1 < size; ++i)
+		skip[static_cast<unsigned char>(this->pattern[i])] = size - 1 - i;
+}
+
+const char *LiteralFinder::Find(const char *begin, const char *end) const {
+	const size_t size = pattern.size();
+	if (size == 0 || static_cast<size_t>(end - begin) < size)
+		return nullptr;
+
+	if (caseSensitive) {
+		const char *last = end - size;
+		for (const char *p = begin; p <= last; ++p) {
+			p = static_cast<const char *>(memchr(p, pattern[0], last - p + 1));
+			if (p == nullptr)
+				return nullptr;
+			if (memcmp(p + 1, pattern.data() + 1, size - 1) == 0)
+				return p;
+		}
+		return nullptr;
+	}
+
+	const unsigned char back = pattern[size - 1];
+	for (const char *p = begin; p + size <= end;) {
+		const unsigned char c = fold[static_cast<unsigned char>(p[size - 1])];
+		if (c == back) {
+			size_t i = 0;
+			while (i + 1 < size &&
+				   fold[static_cast<unsigned char>(p[i])] ==
+					   static_cast<unsigned char>(pattern[i]))
+				++i;
+			if (i + 1 == size)
+				return p;
+		}
+		p += skip[c];
+	}
+	return nullptr;
+}
+
+static bool IsWordChar(const char c) {
+	return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+bool IsWholeWord(const char *lineBegin, const char *lineEnd,
+				 const char *matchBegin, const char *matchEnd) {
+	return (matchBegin == lineBegin || !IsWordChar(matchBegin[-1])) &&
+		   (matchEnd == lineEnd || !IsWordChar(*matchEnd));
+}
+
+static unsigned char FoldCase(const unsigned char c) {
+	return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+int FuzzyScore(const std::string &pattern, const std::string &name) {
+	const size_t patternSize = pattern.size();
+	const size_t nameSize = std::min(name.size(), maxFuzzyLength);
+	if (patternSize > nameSize)
+		return -1;
+
+	// cheap check that the letters are there at all before scoring
+	size_t p = 0;
+	for (size_t i = 0; i < nameSize && p < patternSize; ++i) {
+		if (FoldCase(name[i]) == FoldCase(pattern[p]))
+			++p;
+	}
+	if (p < patternSize)
+		return -1;
+
+	// best[j] is the highest score of the pattern so far with its last
+	// letter matched at name[j], or -1 if it cannot end there
+	int best[maxFuzzyLength];
+	int next[maxFuzzyLength];
+	int total = 0;
+	for (size_t i = 0; i < patternSize; ++i) {
+		const unsigned char c = pattern[i];
+		int before = -1; // best of best[0 .. j - 2]
+		total = -1;
+		for (size_t j = 0; j < nameSize; ++j) {
+			if (i > 0 && j >= 2)
+				before = std::max(before, best[j - 2]);
+			next[j] = -1;
+			const unsigned char n = name[j];
+			if (FoldCase(n) != FoldCase(c))
+				continue;
+
+			int bonus = 1;
+			if (j == 0)
+				bonus += 8;
+			else if (name[j - 1] == '_' ||
+					 (islower(static_cast<unsigned char>(name[j - 1])) &&
+					  isupper(n)))
+				bonus += 6;
+			if (n == c)
+				bonus += 1;
+
+			int previous = 0;
+			if (i > 0) {
+				previous = before;
+				if (j >= 1 && best[j - 1] >= 0)
+					previous = std::max(previous, best[j - 1] + 6);
+				if (previous < 0)
+					continue;
+			}
+			next[j] = previous + bonus;
+			total = std::max(total, next[j]);
+		}
+		if (total < 0)
+			return -1;
+		std::copy(next, next + nameSize, best);
+	}
+	return total * 8 - static_cast<int>(name.size() - patternSize);
+}
+
+static bool IsSearchedFile(const std::filesystem::path &path) {
+	const auto extension = path.extension();
+	return extension == ".qc" || extension == ".qh" || extension == ".src" ||
+		   extension == ".cfg" || extension == ".rc";
+}
+
+static void AddResult(const std::filesystem::path &file, const int line,
+					  const char *lineBegin, const char *lineEnd,
+					  const char *matchBegin, const char *matchEnd,
+					  std::vector<searchresult_t> &results) {
+	searchresult_t result;
+	result.file = file;
+	result.line = line;
+	result.start = static_cast<int>(matchBegin - lineBegin);
+	result.end = static_cast<int>(matchEnd - lineBegin);
+
+	// only a window around the match is kept of very long lines
+	const char *first = lineBegin;
+	const char *last = lineEnd;
+	if (static_cast<size_t>(last - first) > maxPreviewLength) {
+		first = std::max(lineBegin, matchBegin - 64);
+		last = std::min(lineEnd, first + maxPreviewLength);
+	}
+	while (first < last && isspace(static_cast<unsigned char>(*first)))
+		++first;
+	result.text.assign(first, last);
+	results.push_back(std::move(result));
+}
+
+static void SearchFile(const std::filesystem::path &file,
+					   const LiteralFinder &finder, const std::regex *regex,
+					   const bool wholeWord,
+					   std::vector<searchresult_t> &results) {
+	MappedFile mapped;
+	if (!mapped.Open(file) || mapped.Size() == 0)
+		return;
+
+	const char *data = reinterpret_cast<const char *>(mapped.Data());
+	const char *end = data + mapped.Size();
+
+	// a NUL near the start means this is not a text file after all
+	if (memchr(data, '\0', std::min<size_t>(mapped.Size(), 4096)) != nullptr)
+		return;
+
+	auto lineEndOf = [end](const char *p) {
+		const char *newline =
+			static_cast<const char *>(memchr(p, '\n', end - p));
+		const char *lineEnd = newline != nullptr ? newline : end;
+		if (lineEnd > p && lineEnd[-1] == '\r')
+			--lineEnd;
+		return lineEnd;
+	};
+
+	if (regex != nullptr) {
+		int line = 0;
+		for (const char *p = data; p < end; ++line) {
+			const char *lineEnd = lineEndOf(p);
+			for (std::cregex_iterator it(p, lineEnd, *regex), last; it != last;
+				 ++it) {
+				const char *matchBegin = p + it->position();
+				const char *matchEnd = matchBegin + it->length();
+				if (matchBegin != matchEnd &&
+					(!wholeWord ||
+					 IsWholeWord(p, lineEnd, matchBegin, matchEnd)))
+					AddResult(file, line, p, lineEnd, matchBegin, matchEnd,
+							  results);
+			}
+			const char *newline =
+				static_cast<const char *>(memchr(lineEnd, '\n', end - lineEnd));
+			p = newline != nullptr ? newline + 1 : end;
+		}
+		return;
+	}
+
+	// the whole file is searched at once, lines are only counted up to each
+	// match so files without one are never split into lines at all
+	int line = 0;
+	const char *lineBegin = data;
+	for (const char *p = data; (p = finder.Find(p, end)) != nullptr;) {
+		for (;;) {
+			const char *newline =
+				static_cast<const char *>(memchr(lineBegin, '\n', p - lineBegin));
+			if (newline == nullptr)
+				break;
+			++line;
+			lineBegin = newline + 1;
+		}
+
+		const char *lineEnd = lineEndOf(p);
+		const char *matchEnd = p + finder.Size();
+		if (matchEnd > lineEnd ||
+			(wholeWord && !IsWholeWord(lineBegin, lineEnd, p, matchEnd))) {
+			++p;
+			continue;
+		}
+		AddResult(file, line, lineBegin, lineEnd, p, matchEnd, results);
+		p = matchEnd;
+	}
+}
+
+bool StartSearch(const std::string &pattern, const searchoptions_t &options,
+				 const std::filesystem::path &projectDir, std::string &error) {
+	CancelSearch();
+	searchTask.Wait();
+	{
+		std::lock_guard<std::mutex> lock(resultsMutex);
+		pendingResults.clear();
+	}
+	resultCount = 0;
+	if (pattern.empty() || projectDir.empty())
+		return true;
+
+	std::shared_ptr<const std::regex> regex;
+	if (options.regex) {
+		auto flags = std::regex_constants::ECMAScript;
+		if (!options.caseSensitive)
+			flags |= std::regex_constants::icase;
+		try {
+			regex = std::make_shared<const std::regex>(pattern, flags);
+		} catch (const std::regex_error &e) {
+			error = e.what();
+			return false;
+		}
+	}
+
+	// sources live in src, fall back to the whole project if there is none
+	std::filesystem::path root = projectDir / "src";
+	if (options.wholeProject || !std::filesystem::is_directory(root))
+		root = projectDir;
+
+	return searchTask.Start([pattern, options, regex, root](Jobs::Task &task) {
+		std::vector<std::filesystem::path> files;
+		std::error_code ec;
+		for (std::filesystem::recursive_directory_iterator
+				 it(root,
+					std::filesystem::directory_options::skip_permission_denied,
+					ec),
+			 last;
+			 !ec && it != last; it.increment(ec)) {
+			if (task.IsCancelled())
+				return;
+			if (it->is_regular_file(ec) && IsSearchedFile(it->path()))
+				files.push_back(it->path());
+		}
+		std::sort(files.begin(), files.end());
+		task.SetTotal(files.size());
+
+		const LiteralFinder finder(pattern, options.caseSensitive);
+		Jobs::ParallelFor(
+			files.size(),
+			[&](size_t i) {
+				if (resultCount < maxResults) {
+					std::vector<searchresult_t> found;
+					SearchFile(files[i], finder, regex.get(),
+							   options.wholeWord, found);
+					if (!found.empty()) {
+						resultCount += found.size();
+						std::lock_guard<std::mutex> lock(resultsMutex);
+						std::move(found.begin(), found.end(),
+								  std::back_inserter(pendingResults));
+					}
+				}
+				task.Advance();
+			},
+			task.CancelFlag());
+	});
+}
+
+bool IsSearching() { return searchTask.IsRunning(); }
+
+float GetSearchProgress() { return searchTask.GetProgress(); }
+
+void CancelSearch() { searchTask.Cancel(); }
+
+size_t GetFilesSearched() { return searchTask.GetDone(); }
+
+bool IsTruncated() { return resultCount >= maxResults; }
+
+size_t TakeResults(std::vector<searchresult_t> &results) {
+	std::lock_guard<std::mutex> lock(resultsMutex);
+	const size_t count = pendingResults.size();
+	std::move(pendingResults.begin(), pendingResults.end(),
+			  std::back_inserter(results));
+	pendingResults.clear();
+	return count;
+}
+
+} // namespace QuakePrism::Search
@@ -0,0 +1,86 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#pragma once
+#include <array>
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace QuakePrism::Search {
+
+// Substring search over raw bytes. Case-sensitive patterns jump between
+// candidates with memchr on their first byte, case-insensitive ones use
+// Boyer-Moore-Horspool with both sides folded through a table.
+class LiteralFinder {
+  public:
+	LiteralFinder(const std::string &pattern, const bool caseSensitive);
+
+	// Start of the first match in [begin, end), or nullptr
+	const char *Find(const char *begin, const char *end) const;
+	size_t Size() const { return pattern.size(); }
+
+  private:
+	std::string pattern;
+	bool caseSensitive;
+	std::array<unsigned char, 256> fold;
+	std::array<size_t, 256> skip;
+};
+
+typedef struct {
+	bool caseSensitive;
+	bool wholeWord;
+	bool regex;
+	bool wholeProject; // search the whole project instead of just src
+} searchoptions_t;
+
+typedef struct {
+	std::filesystem::path file;
+	int line;		  // zero based
+	int start, end;	  // byte offsets of the match within the line
+	std::string text; // the line, or the part around the match if it is long
+} searchresult_t;
+
+// Whether an identifier character sits right before or after a match
+bool IsWholeWord(const char *lineBegin, const char *lineEnd,
+				 const char *matchBegin, const char *matchEnd);
+
+// Scores name against a pattern whose letters must all appear in it in order,
+// ignoring case. Matches at the start of the name or of a word inside it,
+// runs of consecutive letters and the same case score higher, and shorter
+// names win ties. Returns -1 if the pattern does not match.
+int FuzzyScore(const std::string &pattern, const std::string &name);
+
+// Searches every QuakeC source of the project on a background task,
+// cancelling any search that is still running. Fails with a message when the
+// pattern is not a valid regular expression.
+bool StartSearch(const std::string &pattern, const searchoptions_t &options,
+				 const std::filesystem::path &projectDir, std::string &error);
+bool IsSearching();
+float GetSearchProgress();
+void CancelSearch();
+size_t GetFilesSearched();
+bool IsTruncated(); // stopped collecting after too many results
+
+// Appends the results found since the last call, a file's results always
+// arrive together and in order
+size_t TakeResults(std::vector<searchresult_t> &results);
+
+} // namespace QuakePrism::Search
@@ -0,0 +1,1009 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#include "symbols.h"
+#include "atomicfile.h"
+#include "binaryio.h"
+#include "jobs.h"
+#include "mappedfile.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+namespace QuakePrism::Symbols {
+
+// bump whenever the layout of the cache file changes
+static constexpr uint32_t cacheVersion = 1;
+static constexpr char cacheMagic[4] = {'Q', 'P', 'S', 'I'};
+
+// how much of a comment block above a definition makes it into tooltips
+static constexpr int maxCommentLines = 8;
+
+// initial values longer than this are cut short in declarations
+static constexpr size_t maxValueLength = 48;
+
+// long lines are cut down to this much text around a reference
+static constexpr size_t maxPreviewLength = 256;
+
+typedef struct {
+	int line, start;
+} position_t;
+
+typedef struct {
+	std::filesystem::path file;
+	uintmax_t size;
+	int64_t modified;
+	std::vector<symbol_t> symbols;
+	std::unordered_map<std::string, std::vector<position_t>> references;
+} fileindex_t;
+
+typedef struct {
+	std::string folded; // lower case, what the names are sorted by
+	uint32_t letters;	// which characters appear, see LetterMask
+	const symbol_t *symbol;
+} namekey_t;
+
+typedef struct {
+	std::filesystem::path projectDir;
+	std::vector<std::shared_ptr<const fileindex_t>> files; // progs.src order
+	std::unordered_map<std::string, std::vector<const symbol_t *>> definitions;
+	std::vector<namekey_t> names; // every defined name once, for completion
+} index_t;
+
+typedef enum {
+	TOKEN_NAME,
+	TOKEN_NUMBER,
+	TOKEN_STRING,
+	TOKEN_PUNCT
+} tokentype_t;
+
+typedef struct {
+	tokentype_t type;
+	const char *begin, *end;
+	int line, start;
+	bool firstOnLine;
+} token_t;
+
+typedef struct {
+	int line;
+	bool ownLine; // nothing but the comment on its line
+	const char *begin, *end;
+} comment_t;
+
+static const std::unordered_set<std::string_view> typeNames = {
+	"void", "float", "vector", "string", "entity", "int", "integer",
+	"__variant", "variant", "__int", "__float"};
+
+static const std::unordered_set<std::string_view> modifierNames = {
+	"var",	  "const",	 "nosave",	   "shared", "static",	 "nonstatic",
+	"noref",  "extern",	 "inline",	   "strip",	 "__inline", "__used",
+	"__weak", "__unused", "__accumulate", "__wrap"};
+
+// never worth listing as references
+static const std::unordered_set<std::string_view> keywordNames = {
+	"if",	  "else",	  "while",	"do",	   "for",	  "return", "local",
+	"break",  "continue", "switch", "case",	   "default", "goto",	"typedef",
+	"enum",	  "struct",	  "union",	"class",   "void",	  "float",	"vector",
+	"string", "entity",	  "int",	"integer", "var",	  "const",	"nosave",
+	"shared", "static",	  "extern", "inline",  "noref",	  "__variant"};
+
+static std::mutex indexMutex;
+static std::shared_ptr<const index_t> currentIndex;
+static std::vector<std::filesystem::path> queuedFiles;
+static bool indexing = false; // until the queue of saved files drains
+static std::filesystem::path indexedProject;
+
+static Jobs::Task indexTask;
+
+static bool IsNameStart(const unsigned char c) {
+	return isalpha(c) || c == '_' || c >= 0x80;
+}
+
+static bool IsNameChar(const unsigned char c) {
+	return isalnum(c) || c == '_' || c >= 0x80;
+}
+
+static std::string_view View(const token_t &token) {
+	return std::string_view(token.begin, token.end - token.begin);
+}
+
+static bool Is(const token_t &token, const char *text) {
+	return View(token) == text;
+}
+
+static void Tokenize(const char *data, const char *end,
+					 std::vector<token_t> &tokens,
+					 std::vector<comment_t> &comments) {
+	int line = 0;
+	const char *lineBegin = data;
+	bool firstOnLine = true;
+	for (const char *p = data; p < end;) {
+		const unsigned char c = *p;
+		if (c == '\n') {
+			++line;
+			lineBegin = ++p;
+			firstOnLine = true;
+			continue;
+		}
+		if (isspace(c)) {
+			++p;
+			continue;
+		}
+		if (c == '/' && p + 1 < end && p[1] == '/') {
+			const char *newline =
+				static_cast<const char *>(memchr(p, '\n', end - p));
+			const char *commentEnd = newline != nullptr ? newline : end;
+			comments.push_back({line, firstOnLine, p + 2, commentEnd});
+			p = commentEnd;
+			continue;
+		}
+		if (c == '/' && p + 1 < end && p[1] == '*') {
+			for (p += 2;
+				 p < end && !(p[0] == '*' && p + 1 < end && p[1] == '/'); ++p) {
+				if (*p == '\n') {
+					++line;
+					lineBegin = p + 1;
+				}
+			}
+			p = std::min(p + 2, end);
+			continue;
+		}
+
+		token_t token;
+		token.begin = p;
+		token.line = line;
+		token.start = static_cast<int>(p - lineBegin);
+		token.firstOnLine = firstOnLine;
+		firstOnLine = false;
+		if (c == '"' || c == '\'') {
+			// single quotes hold vector literals
+			for (++p; p < end && *p != c && *p != '\n'; ++p) {
+				if (*p == '\\' && p + 1 < end && p[1] != '\n')
+					++p;
+			}
+			if (p < end && *p == c)
+				++p;
+			token.type = TOKEN_STRING;
+		} else if (isdigit(c) ||
+				   (c == '.' && p + 1 < end &&
+					isdigit(static_cast<unsigned char>(p[1])))) {
+			while (p < end && (IsNameChar(*p) || *p == '.'))
+				++p;
+			token.type = TOKEN_NUMBER;
+		} else if (IsNameStart(c)) {
+			while (p < end && IsNameChar(*p))
+				++p;
+			token.type = TOKEN_NAME;
+		} else {
+			++p;
+			token.type = TOKEN_PUNCT;
+		}
+		token.end = p;
+		tokens.push_back(token);
+	}
+}
+
+// Copies source text with every run of whitespace turned into one space
+static std::string Collapse(const char *begin, const char *end) {
+	std::string text;
+	bool space = false;
+	for (const char *p = begin; p < end; ++p) {
+		if (isspace(static_cast<unsigned char>(*p))) {
+			space = !text.empty();
+			continue;
+		}
+		if (space)
+			text.push_back(' ');
+		space = false;
+		text.push_back(*p);
+	}
+	return text;
+}
+
+// The comment after a definition on its line, or else the block of comment
+// lines right above it
+static std::string CommentFor(const std::vector<comment_t> &comments,
+							  const int line) {
+	auto it = std::lower_bound(
+		comments.begin(), comments.end(), line,
+		[](const comment_t &comment, int line) { return comment.line < line; });
+	if (it != comments.end() && it->line == line && !it->ownLine)
+		return Collapse(it->begin, it->end);
+
+	std::string text;
+	int expected = line - 1;
+	for (int count = 0; it != comments.begin() && count < maxCommentLines;
+		 ++count) {
+		--it;
+		if (it->line != expected || !it->ownLine)
+			break;
+		const std::string comment = Collapse(it->begin, it->end);
+		text = text.empty() ? comment : comment + "\n" + text;
+		--expected;
+	}
+	return text;
+}
+
+// Steps over a bracketed group, nested ones included, starting at its opener
+static size_t SkipGroup(const std::vector<token_t> &tokens, size_t i) {
+	int depth = 0;
+	for (; i < tokens.size(); ++i) {
+		const char c = *tokens[i].begin;
+		if (tokens[i].type != TOKEN_PUNCT)
+			continue;
+		if (c == '(' || c == '[' || c == '{')
+			++depth;
+		else if ((c == ')' || c == ']' || c == '}') && --depth <= 0)
+			return i + 1;
+	}
+	return i;
+}
+
+// Steps over a statement this parser does not understand, up to its ';' or
+// the end of its body
+static size_t SkipStatement(const std::vector<token_t> &tokens, size_t i) {
+	const size_t first = i;
+	while (i < tokens.size()) {
+		const token_t &token = tokens[i];
+		if (token.type == TOKEN_PUNCT && Is(token, ";"))
+			return i + 1;
+		if (token.type == TOKEN_PUNCT && Is(token, "{"))
+			return SkipGroup(tokens, i);
+		if (token.type == TOKEN_PUNCT &&
+			(Is(token, "(") || Is(token, "[")))
+			i = SkipGroup(tokens, i);
+		else
+			++i;
+	}
+	return std::max(i, first + 1);
+}
+
+static void AddSymbol(fileindex_t &index, const token_t &name,
+					  const symbolkind_t kind, const bool hasBody,
+					  std::string declaration,
+					  const std::vector<comment_t> &comments) {
+	symbol_t symbol;
+	symbol.name.assign(name.begin, name.end);
+	symbol.kind = kind;
+	symbol.hasBody = hasBody;
+	const std::string comment = CommentFor(comments, name.line);
+	symbol.declaration =
+		comment.empty() ? std::move(declaration) : declaration + "\n" + comment;
+	symbol.file = index.file;
+	symbol.line = name.line;
+	symbol.start = name.start;
+	symbol.end = name.start + static_cast<int>(name.end - name.begin);
+	index.symbols.push_back(std::move(symbol));
+}
+
+// Parses one global statement such as
+//   .float health;
+//   float FL_FLY = 1, FL_SWIM = 2;
+//   void(entity attacker, float damage) T_Damage = { ... };
+//   void() ogre_stand1 = [$stand1, ogre_stand2] { ... };
+//   float vlen(vector v) = #12;
+static size_t ParseStatement(const std::vector<token_t> &tokens, size_t i,
+							 const std::vector<comment_t> &comments,
+							 fileindex_t &index) {
+	const size_t count = tokens.size();
+	const size_t first = i;
+	bool isVar = false;
+	while (i < count && tokens[i].type == TOKEN_NAME &&
+		   modifierNames.count(View(tokens[i])) != 0) {
+		isVar |= Is(tokens[i], "var");
+		++i;
+	}
+	bool field = false;
+	while (i < count && Is(tokens[i], ".")) {
+		field = true;
+		++i;
+	}
+	if (i >= count || tokens[i].type != TOKEN_NAME ||
+		typeNames.count(View(tokens[i])) == 0)
+		return SkipStatement(tokens, first);
+	++i;
+
+	bool function = false;
+	if (i < count && Is(tokens[i], "(")) {
+		i = SkipGroup(tokens, i);
+		function = true;
+	}
+	const std::string type =
+		Collapse(tokens[first].begin, tokens[i - 1].end) + " ";
+
+	while (i < count && tokens[i].type == TOKEN_NAME) {
+		const token_t &name = tokens[i++];
+		std::string declaration = type + std::string(View(name));
+
+		// C style parameters after the name
+		bool isFunction = function;
+		if (!field && i < count && Is(tokens[i], "(")) {
+			const size_t params = i;
+			i = SkipGroup(tokens, i);
+			declaration += Collapse(tokens[params].begin, tokens[i - 1].end);
+			isFunction = true;
+		}
+
+		bool hasBody = false;
+		bool initialized = false;
+		if (i < count && Is(tokens[i], "=")) {
+			++i;
+			if (i < count && (Is(tokens[i], "[") || Is(tokens[i], "{"))) {
+				if (Is(tokens[i], "["))
+					i = SkipGroup(tokens, i);
+				if (i < count && Is(tokens[i], "{"))
+					i = SkipGroup(tokens, i);
+				hasBody = true;
+			} else {
+				// a value, or #number for a builtin
+				const size_t value = i;
+				while (i < count && !Is(tokens[i], ",") &&
+					   !Is(tokens[i], ";")) {
+					if (Is(tokens[i], "(") || Is(tokens[i], "[") ||
+						Is(tokens[i], "{"))
+						i = SkipGroup(tokens, i);
+					else
+						++i;
+				}
+				if (i > value) {
+					std::string text =
+						Collapse(tokens[value].begin, tokens[i - 1].end);
+					if (text.size() > maxValueLength)
+						text = text.substr(0, maxValueLength) + "...";
+					declaration += " = " + text;
+				}
+				hasBody = isFunction;
+				initialized = true;
+			}
+		} else if (i < count && (Is(tokens[i], "[") || Is(tokens[i], "{"))) {
+			if (Is(tokens[i], "["))
+				i = SkipGroup(tokens, i);
+			if (i < count && Is(tokens[i], "{"))
+				i = SkipGroup(tokens, i);
+			hasBody = true;
+		}
+
+		symbolkind_t kind = SYMBOL_GLOBAL;
+		if (field)
+			kind = SYMBOL_FIELD;
+		else if (isFunction)
+			kind = SYMBOL_FUNCTION;
+		else if (initialized && !isVar)
+			kind = SYMBOL_CONSTANT;
+		AddSymbol(index, name, kind, hasBody && isFunction,
+				  std::move(declaration), comments);
+
+		if (i < count && Is(tokens[i], ",")) {
+			++i;
+			continue;
+		}
+		if (i < count && Is(tokens[i], ";"))
+			++i;
+		break;
+	}
+	return std::max(i, first + 1);
+}
+
+static void ParseDefinitions(const std::vector<token_t> &tokens,
+							 const std::vector<comment_t> &comments,
+							 const char *end, fileindex_t &index) {
+	const size_t count = tokens.size();
+	for (size_t i = 0; i < count;) {
+		const token_t &token = tokens[i];
+		const bool directive =
+			token.firstOnLine && (Is(token, "#") || Is(token, "$")) &&
+			i + 1 < count && tokens[i + 1].type == TOKEN_NAME &&
+			tokens[i + 1].line == token.line;
+		if (!directive) {
+			i = ParseStatement(tokens, i, comments, index);
+			continue;
+		}
+
+		// directives take up the rest of their line
+		const token_t &name = tokens[i + 1];
+		size_t next = i + 2;
+		if (Is(token, "#") && Is(name, "define") && next < count &&
+			tokens[next].type == TOKEN_NAME &&
+			tokens[next].line == token.line) {
+			const char *newline = static_cast<const char *>(
+				memchr(token.begin, '\n', end - token.begin));
+			AddSymbol(index, tokens[next], SYMBOL_CONSTANT, false,
+					  Collapse(token.begin, newline != nullptr ? newline : end),
+					  comments);
+		} else if (Is(token, "$") && Is(name, "frame")) {
+			for (; next < count && tokens[next].line == token.line; ++next) {
+				if (tokens[next].type == TOKEN_NAME)
+					AddSymbol(index, tokens[next], SYMBOL_FRAME, false,
+							  "$frame " + std::string(View(tokens[next])),
+							  comments);
+			}
+		}
+		while (i < count && tokens[i].line == token.line)
+			++i;
+	}
+}
+
+static void CollectReferences(const std::vector<token_t> &tokens,
+							  fileindex_t &index) {
+	// keyed by views into the file until the end, so every use does not
+	// cost a string
+	std::unordered_map<std::string_view, std::vector<position_t>> references;
+	int skipLine = -1;
+	for (size_t i = 0; i < tokens.size(); ++i) {
+		const token_t &token = tokens[i];
+		if (token.line == skipLine)
+			continue;
+		if (token.firstOnLine && (Is(token, "#") || Is(token, "$")) &&
+			i + 1 < tokens.size() && tokens[i + 1].line == token.line) {
+			// $cd, $origin and the like only hold paths and numbers
+			if (Is(token, "$") && !Is(tokens[i + 1], "frame"))
+				skipLine = token.line;
+			++i;
+			continue;
+		}
+		if (token.type != TOKEN_NAME || keywordNames.count(View(token)) != 0)
+			continue;
+		references[View(token)].push_back({token.line, token.start});
+	}
+
+	index.references.reserve(references.size());
+	for (auto &[name, positions] : references)
+		index.references.emplace(std::string(name), std::move(positions));
+}
+
+static std::shared_ptr<const fileindex_t>
+ParseFile(const std::filesystem::path &file, const uintmax_t size,
+		  const int64_t modified) {
+	MappedFile mapped;
+	if (!mapped.Open(file))
+		return nullptr;
+
+	auto index = std::make_shared<fileindex_t>();
+	index->file = file;
+	index->size = size;
+	index->modified = modified;
+
+	const char *data = reinterpret_cast<const char *>(mapped.Data());
+	const char *end = data + mapped.Size();
+	std::vector<token_t> tokens;
+	std::vector<comment_t> comments;
+	Tokenize(data, end, tokens, comments);
+	ParseDefinitions(tokens, comments, end, *index);
+	CollectReferences(tokens, *index);
+	return index;
+}
+
+static bool Stat(const std::filesystem::path &file, uintmax_t &size,
+				 int64_t &modified) {
+	std::error_code ec;
+	size = std::filesystem::file_size(file, ec);
+	if (ec)
+		return false;
+	const auto time = std::filesystem::last_write_time(file, ec);
+	if (ec)
+		return false;
+	modified = static_cast<int64_t>(time.time_since_epoch().count());
+	return true;
+}
+
+static bool IsSourceFile(const std::filesystem::path &path) {
+	const auto extension = path.extension();
+	return extension == ".qc" || extension == ".qh";
+}
+
+std::vector<std::filesystem::path>
+ReadProgsSrc(const std::filesystem::path &srcDir,
+			 std::filesystem::path *outputFile) {
+	std::vector<std::filesystem::path> files;
+	MappedFile mapped;
+	if (mapped.Open(srcDir / "progs.src")) {
+		const char *data = reinterpret_cast<const char *>(mapped.Data());
+		std::vector<token_t> tokens;
+		std::vector<comment_t> comments;
+		Tokenize(data, data + mapped.Size(), tokens, comments);
+
+		bool output = true;
+		for (size_t i = 0; i < tokens.size();) {
+			const token_t &token = tokens[i];
+			std::string name;
+			if (token.firstOnLine && Is(token, "#")) {
+				// fteqcc also takes #include "file.qc" lines
+				const int line = token.line;
+				for (; i < tokens.size() && tokens[i].line == line; ++i) {
+					if (tokens[i].type == TOKEN_STRING && name.empty())
+						name.assign(tokens[i].begin + 1, tokens[i].end - 1);
+				}
+				if (name.empty())
+					continue;
+			} else {
+				// a file name is everything up to the next whitespace
+				const token_t *last = &tokens[i];
+				for (++i; i < tokens.size() && tokens[i].line == last->line &&
+						  tokens[i].begin == last->end;
+					 ++i)
+					last = &tokens[i];
+				name.assign(token.begin, last->end);
+				if (token.type == TOKEN_STRING && name.size() >= 2)
+					name = name.substr(1, name.size() - 2);
+				if (output) {
+					output = false;
+					if (outputFile) {
+						std::replace(name.begin(), name.end(), '\\', '/');
+						*outputFile = (srcDir / name).lexically_normal();
+					}
+					continue;
+				}
+			}
+			std::replace(name.begin(), name.end(), '\\', '/');
+			files.push_back((srcDir / name).lexically_normal());
+		}
+	}
+	if (!files.empty())
+		return files;
+
+	std::error_code ec;
+	for (std::filesystem::recursive_directory_iterator
+			 it(srcDir,
+				std::filesystem::directory_options::skip_permission_denied, ec),
+		 last;
+		 !ec && it != last; it.increment(ec)) {
+		if (it->is_regular_file(ec) && IsSourceFile(it->path()))
+			files.push_back(it->path().lexically_normal());
+	}
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+static std::string Fold(const std::string &text) {
+	std::string folded = text;
+	for (auto &c : folded)
+		c = tolower(static_cast<unsigned char>(c));
+	return folded;
+}
+
+// One bit per letter, one for digits, one for underscores and one for
+// anything else, so names missing part of a pattern are skipped early
+static uint32_t LetterMask(const std::string &folded) {
+	uint32_t mask = 0;
+	for (const unsigned char c : folded) {
+		if (c >= 'a' && c <= 'z')
+			mask |= 1u << (c - 'a');
+		else if (isdigit(c))
+			mask |= 1u << 26;
+		else if (c == '_')
+			mask |= 1u << 27;
+		else
+			mask |= 1u << 28;
+	}
+	return mask;
+}
+
+// The definition lookups are built here, on the indexing task, so the UI
+// thread only ever swaps in a finished index
+static void Publish(const std::shared_ptr<index_t> &index) {
+	for (const auto &file : index->files) {
+		for (const auto &symbol : file->symbols)
+			index->definitions[symbol.name].push_back(&symbol);
+	}
+	index->names.reserve(index->definitions.size());
+	for (const auto &[name, symbols] : index->definitions) {
+		std::string folded = Fold(name);
+		const uint32_t letters = LetterMask(folded);
+		index->names.push_back({std::move(folded), letters, symbols.front()});
+	}
+	std::sort(index->names.begin(), index->names.end(),
+			  [](const namekey_t &a, const namekey_t &b) {
+				  return a.folded != b.folded ? a.folded < b.folded
+											  : a.symbol->name < b.symbol->name;
+			  });
+	std::lock_guard<std::mutex> lock(indexMutex);
+	currentIndex = index;
+}
+
+static std::shared_ptr<const index_t> GetIndex() {
+	std::lock_guard<std::mutex> lock(indexMutex);
+	return currentIndex;
+}
+
+static void SaveCache(const index_t &index) {
+	std::string data(cacheMagic, sizeof(cacheMagic));
+	AppendValue<uint32_t>(data, cacheVersion);
+	AppendValue<uint32_t>(data, index.files.size());
+	for (const auto &file : index.files) {
+		AppendString<uint32_t>(
+			data, file->file.lexically_relative(index.projectDir).string());
+		AppendValue<uint64_t>(data, file->size);
+		AppendValue<int64_t>(data, file->modified);
+		AppendValue<uint32_t>(data, file->symbols.size());
+		for (const auto &symbol : file->symbols) {
+			AppendString<uint32_t>(data, symbol.name);
+			AppendValue<uint8_t>(data, symbol.kind);
+			AppendValue<uint8_t>(data, symbol.hasBody);
+			AppendValue<int32_t>(data, symbol.line);
+			AppendValue<int32_t>(data, symbol.start);
+			AppendString<uint32_t>(data, symbol.declaration);
+		}
+		AppendValue<uint32_t>(data, file->references.size());
+		for (const auto &[name, positions] : file->references) {
+			AppendString<uint32_t>(data, name);
+			AppendValue<uint32_t>(data, positions.size());
+			data.append(reinterpret_cast<const char *>(positions.data()),
+						positions.size() * sizeof(position_t));
+		}
+	}
+
+	const auto dir = index.projectDir / ".qprism";
+	std::error_code ec;
+	std::filesystem::create_directories(dir, ec);
+	WriteFileAtomic(dir / "symbols.cache", data.data(), data.size());
+}
+
+// Reads the index saved by an earlier run, keyed by file. A cache that is
+// damaged or from another version is ignored as a whole.
+static std::unordered_map<std::string, std::shared_ptr<const fileindex_t>>
+LoadCache(const std::filesystem::path &projectDir) {
+	std::unordered_map<std::string, std::shared_ptr<const fileindex_t>> cached;
+	MappedFile mapped;
+	if (!mapped.Open(projectDir / ".qprism" / "symbols.cache"))
+		return cached;
+
+	reader_t reader = {mapped.Data(), mapped.Data() + mapped.Size(), false};
+	char magic[sizeof(cacheMagic)];
+	if (!ReadBytes(reader, magic, sizeof(magic)) ||
+		memcmp(magic, cacheMagic, sizeof(magic)) != 0 ||
+		ReadValue<uint32_t>(reader) != cacheVersion)
+		return cached;
+
+	const uint32_t fileCount = ReadValue<uint32_t>(reader);
+	for (uint32_t i = 0; i < fileCount && !reader.failed; ++i) {
+		auto file = std::make_shared<fileindex_t>();
+		file->file =
+			(projectDir / ReadString<uint32_t>(reader)).lexically_normal();
+		file->size = ReadValue<uint64_t>(reader);
+		file->modified = ReadValue<int64_t>(reader);
+
+		const uint32_t symbolCount = ReadValue<uint32_t>(reader);
+		for (uint32_t j = 0; j < symbolCount && !reader.failed; ++j) {
+			symbol_t symbol;
+			symbol.name = ReadString<uint32_t>(reader);
+			symbol.kind = static_cast<symbolkind_t>(ReadValue<uint8_t>(reader));
+			symbol.hasBody = ReadValue<uint8_t>(reader) != 0;
+			symbol.line = ReadValue<int32_t>(reader);
+			symbol.start = ReadValue<int32_t>(reader);
+			symbol.end = symbol.start + static_cast<int>(symbol.name.size());
+			symbol.declaration = ReadString<uint32_t>(reader);
+			symbol.file = file->file;
+			file->symbols.push_back(std::move(symbol));
+		}
+
+		const uint32_t nameCount = ReadValue<uint32_t>(reader);
+		file->references.reserve(nameCount);
+		for (uint32_t j = 0; j < nameCount && !reader.failed; ++j) {
+			std::string name = ReadString<uint32_t>(reader);
+			const uint32_t positionCount = ReadValue<uint32_t>(reader);
+			const size_t left = reader.end - reader.p;
+			if (left / sizeof(position_t) < positionCount) {
+				reader.failed = true;
+				break;
+			}
+			std::vector<position_t> positions(positionCount);
+			ReadBytes(reader, positions.data(),
+					  positionCount * sizeof(position_t));
+			file->references.emplace(std::move(name), std::move(positions));
+		}
+		cached.emplace(file->file.string(), std::move(file));
+	}
+	if (reader.failed)
+		cached.clear();
+	return cached;
+}
+
+static void IndexProject(Jobs::Task &task,
+						 const std::filesystem::path &projectDir) {
+	const auto cached = LoadCache(projectDir);
+	const auto files = ReadProgsSrc(projectDir / "src");
+	task.SetTotal(files.size());
+
+	// whatever was saved last time is good enough until the files that
+	// changed since have been parsed again
+	auto index = std::make_shared<index_t>();
+	index->projectDir = projectDir;
+	for (const auto &file : files) {
+		auto it = cached.find(file.string());
+		if (it != cached.end())
+			index->files.push_back(it->second);
+	}
+	Publish(index);
+
+	std::vector<std::shared_ptr<const fileindex_t>> indexed(files.size());
+	std::atomic<bool> changed{cached.size() != index->files.size()};
+	Jobs::ParallelFor(
+		files.size(),
+		[&](size_t i) {
+			uintmax_t size;
+			int64_t modified;
+			if (Stat(files[i], size, modified)) {
+				auto it = cached.find(files[i].string());
+				if (it != cached.end() && it->second->size == size &&
+					it->second->modified == modified) {
+					indexed[i] = it->second;
+				} else {
+					indexed[i] = ParseFile(files[i], size, modified);
+					changed = true;
+				}
+			}
+			task.Advance();
+		},
+		task.CancelFlag());
+	if (task.IsCancelled())
+		return;
+
+	index = std::make_shared<index_t>();
+	index->projectDir = projectDir;
+	for (auto &file : indexed) {
+		if (file != nullptr)
+			index->files.push_back(std::move(file));
+	}
+	changed = changed || index->files.size() != cached.size();
+	Publish(index);
+	if (changed)
+		SaveCache(*index);
+}
+
+static bool TakeQueuedFiles(std::vector<std::filesystem::path> &files) {
+	std::lock_guard<std::mutex> lock(indexMutex);
+	files.clear();
+	files.swap(queuedFiles);
+	if (files.empty())
+		indexing = false;
+	return !files.empty();
+}
+
+// Parses the saved files again until there are none left
+static void UpdateQueuedFiles(Jobs::Task &task) {
+	std::vector<std::filesystem::path> files;
+	while (TakeQueuedFiles(files)) {
+		const auto current = GetIndex();
+		if (task.IsCancelled() || current == nullptr)
+			continue;
+
+		auto index = std::make_shared<index_t>();
+		index->projectDir = current->projectDir;
+		index->files = current->files;
+		bool changed = false;
+		for (const auto &file : files) {
+			auto it = std::find_if(
+				index->files.begin(), index->files.end(),
+				[&file](const auto &indexed) { return indexed->file == file; });
+			uintmax_t size;
+			int64_t modified;
+			if (it == index->files.end() || !Stat(file, size, modified))
+				continue;
+			if (auto parsed = ParseFile(file, size, modified)) {
+				*it = std::move(parsed);
+				changed = true;
+			}
+		}
+		if (changed) {
+			Publish(index);
+			SaveCache(*index);
+		}
+	}
+}
+
+void StartIndexing(const std::filesystem::path &projectDir) {
+	indexTask.Cancel();
+	indexTask.Wait();
+	{
+		std::lock_guard<std::mutex> lock(indexMutex);
+		currentIndex = nullptr;
+		queuedFiles.clear();
+		indexing = !projectDir.empty();
+	}
+	indexedProject = projectDir.lexically_normal();
+	if (projectDir.empty())
+		return;
+
+	indexTask.Start([projectDir = indexedProject](Jobs::Task &task) {
+		IndexProject(task, projectDir);
+		UpdateQueuedFiles(task);
+	});
+}
+
+bool IsIndexing() { return indexTask.IsRunning(); }
+
+float GetIndexProgress() { return indexTask.GetProgress(); }
+
+void UpdateFile(const std::filesystem::path &file) {
+	if (indexedProject.empty())
+		return;
+	// a changed file list means starting over
+	if (file.filename() == "progs.src") {
+		StartIndexing(indexedProject);
+		return;
+	}
+	if (!IsSourceFile(file))
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(indexMutex);
+		queuedFiles.push_back(file.lexically_normal());
+		if (indexing)
+			return;
+		indexing = true;
+	}
+	indexTask.Wait();
+	indexTask.Start(UpdateQueuedFiles);
+}
+
+bool FindDefinition(const std::string &name, symbol_t &symbol) {
+	const auto index = GetIndex();
+	if (index == nullptr)
+		return false;
+	auto it = index->definitions.find(name);
+	if (it == index->definitions.end())
+		return false;
+
+	const auto &symbols = it->second;
+	auto body = std::find_if(symbols.begin(), symbols.end(),
+							 [](const symbol_t *s) { return s->hasBody; });
+	symbol = body != symbols.end() ? **body : *symbols.front();
+
+	// bodies often go without the comment their prototype has
+	if (symbol.declaration.find('\n') == std::string::npos) {
+		for (const symbol_t *other : symbols) {
+			const size_t comment = other->declaration.find('\n');
+			if (comment != std::string::npos) {
+				symbol.declaration += other->declaration.substr(comment);
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+std::vector<Search::searchresult_t> FindReferences(const std::string &name) {
+	std::vector<Search::searchresult_t> results;
+	const auto index = GetIndex();
+	if (index == nullptr)
+		return results;
+
+	for (const auto &file : index->files) {
+		auto it = file->references.find(name);
+		if (it == file->references.end())
+			continue;
+		MappedFile mapped;
+		if (!mapped.Open(file->file))
+			continue;
+
+		// positions are in file order, so lines are only walked once
+		const char *p = reinterpret_cast<const char *>(mapped.Data());
+		const char *end = p + mapped.Size();
+		int line = 0;
+		for (const auto &position : it->second) {
+			while (line < position.line && p < end) {
+				const char *newline =
+					static_cast<const char *>(memchr(p, '\n', end - p));
+				p = newline != nullptr ? newline + 1 : end;
+				++line;
+			}
+			if (line != position.line || p == end)
+				break;
+			const char *newline =
+				static_cast<const char *>(memchr(p, '\n', end - p));
+			const char *lineEnd = newline != nullptr ? newline : end;
+			if (lineEnd > p && lineEnd[-1] == '\r')
+				--lineEnd;
+			if (position.start + name.size() >
+				static_cast<size_t>(lineEnd - p))
+				continue;
+
+			Search::searchresult_t result;
+			result.file = file->file;
+			result.line = position.line;
+			result.start = position.start;
+			result.end = position.start + static_cast<int>(name.size());
+			const char *first = p;
+			const char *last = std::min(lineEnd, p + maxPreviewLength);
+			while (first < last && isspace(static_cast<unsigned char>(*first)))
+				++first;
+			result.text.assign(first, last);
+			results.push_back(std::move(result));
+		}
+	}
+	return results;
+}
+
+static bool IsSubsequence(const std::string &pattern, const std::string &text) {
+	size_t p = 0;
+	for (size_t i = 0; i < text.size() && p < pattern.size(); ++i) {
+		if (text[i] == pattern[p])
+			++p;
+	}
+	return p == pattern.size();
+}
+
+std::vector<completion_t> Complete(const std::string &prefix,
+								   const size_t maxResults) {
+	std::vector<completion_t> completions;
+	const auto index = GetIndex();
+	if (index == nullptr)
+		return completions;
+
+	// names are only copied out for the winners
+	std::vector<std::pair<int, const symbol_t *>> scored;
+	const std::string folded = Fold(prefix);
+	const uint32_t letters = LetterMask(folded);
+	auto add = [&](auto begin, auto end) {
+		for (auto it = begin; it != end; ++it) {
+			if ((it->letters & letters) != letters ||
+				!IsSubsequence(folded, it->folded))
+				continue;
+			const int score = Search::FuzzyScore(prefix, it->symbol->name);
+			if (score >= 0)
+				scored.emplace_back(score, it->symbol);
+		}
+	};
+
+	// names starting with the same letter sit together in the sorted list
+	// and are scored first, the rest only when they come up short
+	const auto &names = index->names;
+	auto first = names.begin();
+	auto last = names.end();
+	if (!prefix.empty()) {
+		const unsigned char c = tolower(static_cast<unsigned char>(prefix[0]));
+		auto byFirst = [](const namekey_t &key, const unsigned char c) {
+			return static_cast<unsigned char>(key.folded[0]) < c;
+		};
+		first = std::lower_bound(names.begin(), names.end(), c, byFirst);
+		last = std::partition_point(first, names.end(),
+									[c](const namekey_t &key) {
+										return static_cast<unsigned char>(
+												   key.folded[0]) == c;
+									});
+	}
+	add(first, last);
+	if (scored.size() < maxResults) {
+		add(names.begin(), first);
+		add(last, names.end());
+	}
+
+	const size_t count = std::min(maxResults, scored.size());
+	std::partial_sort(scored.begin(), scored.begin() + count, scored.end(),
+					  [](const auto &a, const auto &b) {
+						  return a.first != b.first
+									 ? a.first > b.first
+									 : a.second->name < b.second->name;
+					  });
+	completions.reserve(count);
+	for (size_t i = 0; i < count; ++i)
+		completions.push_back(
+			{scored[i].second->name, scored[i].second->kind, scored[i].first});
+	return completions;
+}
+
+} // namespace QuakePrism::Symbols
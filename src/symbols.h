@@ -0,0 +1,83 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#pragma once
+#include "search.h"
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace QuakePrism::Symbols {
+
+typedef enum {
+	SYMBOL_GLOBAL,
+	SYMBOL_CONSTANT, // a global with an initial value or a #define
+	SYMBOL_FIELD,
+	SYMBOL_FUNCTION,
+	SYMBOL_FRAME // a $frame macro, named without the $
+} symbolkind_t;
+
+typedef struct {
+	std::string name;
+	symbolkind_t kind;
+	bool hasBody;			 // a function defined here, not just prototyped
+	std::string declaration; // the definition and the comment above it
+	std::filesystem::path file;
+	int line;		// zero based
+	int start, end; // byte offsets of the name within the line
+} symbol_t;
+
+// Indexes the global definitions of every QuakeC file in progs.src order on
+// a background task, along with every place each name is used. The index is
+// kept in the project's .qprism folder so the last one is available right
+// away and only files changed since then are parsed again.
+void StartIndexing(const std::filesystem::path &projectDir);
+bool IsIndexing();
+float GetIndexProgress();
+
+// The sources progs.src lists, in the order the compiler reads them, with
+// the progs.dat it names as its first entry stored in outputFile. Without a
+// usable progs.src every QuakeC file under src is listed instead.
+std::vector<std::filesystem::path>
+ReadProgsSrc(const std::filesystem::path &srcDir,
+			 std::filesystem::path *outputFile = nullptr);
+
+// Parses a single file again, call after saving it
+void UpdateFile(const std::filesystem::path &file);
+
+// Looks up a global by name, preferring the body of a function over its
+// prototypes
+bool FindDefinition(const std::string &name, symbol_t &symbol);
+
+// Every use of a name across the project, definitions included
+std::vector<Search::searchresult_t> FindReferences(const std::string &name);
+
+typedef struct {
+	std::string name;
+	symbolkind_t kind;
+	int score;
+} completion_t;
+
+// The defined names that best fuzzy match what has been typed so far, best
+// first
+std::vector<completion_t> Complete(const std::string &prefix,
+								   const size_t maxResults);
+
+} // namespace QuakePrism::Symbols
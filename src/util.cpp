@@ -131,19 +131,22 @@ unsigned char *GetTexturePixels(GLuint textureID, int width, int height,
 	return rawData; // Don't forget to delete[] rawData when done
 }
 
-static float colorDistance(const unsigned char *color1,
-						   const unsigned char *color2) {
-	return std::sqrt(std::pow(color1[0] - color2[0], 2) +
-					 std::pow(color1[1] - color2[1], 2) +
-					 std::pow(color1[2] - color2[2], 2));
+// Squared distance is enough to find the closest color and keeps the
+// per-pixel palette search in integer math
+static int colorDistance(const unsigned char *color1,
+						 const unsigned char *color2) {
+	const int r = color1[0] - color2[0];
+	const int g = color1[1] - color2[1];
+	const int b = color1[2] - color2[2];
+	return r * r + g * g + b * b;
 }
 
 static int findClosestColorIndex(const unsigned char *color) {
-	float minDistance = std::numeric_limits<float>::max();
+	int minDistance = std::numeric_limits<int>::max();
 	int closestIndex = 0;
 
 	for (int i = 0; i < 256; ++i) {
-		float distance = colorDistance(color, colormap[i]);
+		int distance = colorDistance(color, colormap[i]);
 		if (distance < minDistance) {
 			minDistance = distance;
 			closestIndex = i;
@@ -185,6 +188,20 @@ void convertRGBAToImage(const char *filename, unsigned char *pixels,
 	stbi_write_png(filename, width, height, 4, pixels, width * 4);
 }
 
+void SetPNGCompressionLevel(const int level) {
+	stbi_write_png_compression_level = level;
+}
+
+// 64-bit FNV-1a, chain calls by passing the previous hash as the seed
+uint64_t HashBytes(const void *data, const size_t size, uint64_t seed) {
+	const unsigned char *bytes = static_cast<const unsigned char *>(data);
+	for (size_t i = 0; i < size; ++i) {
+		seed ^= bytes[i];
+		seed *= 1099511628211ULL;
+	}
+	return seed;
+}
+
 bool ImageTreeNode(const char *label, const GLuint icon) {
 	const ImGuiStyle &style = ImGui::GetStyle();
 	ImGuiStorage *storage = ImGui::GetStateStorage();
@@ -275,28 +292,6 @@ bool ButtonCentered(const char *label) {
 	return false;
 }
 
-bool CompileProject() {
-
-#ifdef _WIN32
-	_chdir((baseDirectory / "src").string().c_str());
-	STARTUPINFO si;
-	ZeroMemory(&si, sizeof(si));
-	si.cb = sizeof(si);
-
-	PROCESS_INFORMATION pi;
-	ZeroMemory(&pi, sizeof(pi));
-	std::wstring cmd = L"fteqcc64.exe";
-	bool result = CreateProcess(NULL, (LPWSTR)cmd.c_str(), NULL, NULL, FALSE,
-								CREATE_NO_WINDOW, NULL, NULL, &si, &pi);
-	_chdir(baseDirectory.string().c_str());
-#else
-	chdir((baseDirectory / "src").string().c_str());
-	bool result = system("./fteqcc64") != -1;
-	chdir(baseDirectory.string().c_str());
-#endif
-	return result;
-}
-
 bool RunProject() {
 
 #ifdef _WIN32
@@ -20,6 +20,8 @@ along with this program.
 #pragma once
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
 
 namespace QuakePrism {
@@ -37,6 +39,10 @@ void convertRGBToImage(const char *filename, unsigned char *pixels,
 					   const int width, const int height);
 void convertRGBAToImage(const char *filename, unsigned char *pixels,
 						const int width, const int height);
+void SetPNGCompressionLevel(const int level);
+
+uint64_t HashBytes(const void *data, const size_t size,
+				   uint64_t seed = 14695981039346656037ULL);
 
 bool ImageTreeNode(const char *label, const GLuint icon);
 
@@ -45,7 +51,6 @@ void HelpMarker(const char *desc);
 bool ButtonRight(const char *label, float offset_from_right);
 bool ButtonCentered(const char *label);
 
-bool CompileProject();
 bool RunProject();
 
 void CreateFile(const char *filename);
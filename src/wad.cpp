@@ -19,16 +19,39 @@ along with this program.
 
 #include "wad.h"
 #include "SDL_opengl.h"
+#include "bsp.h"
+#include "jobs.h"
+#include "mappedfile.h"
 #include "resources.h"
+#include "stb_image.h"
 #include "util.h"
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace QuakePrism::WAD {
 
+static Jobs::Task exportTask;
+
+// Expands palette indices into RGBA pixels, index 255 is transparent
+static void IndicesToRGBA(const unsigned char *indices, unsigned char *pixels,
+						  const int count, const unsigned char *palette) {
+	for (int j = 0; j < count; ++j) {
+		const int colorIndex = indices[j];
+		pixels[(j * 4) + 0] = palette[colorIndex * 3 + 0];
+		pixels[(j * 4) + 1] = palette[colorIndex * 3 + 1];
+		pixels[(j * 4) + 2] = palette[colorIndex * 3 + 2];
+		pixels[(j * 4) + 3] = colorIndex == 255 ? 0 : 255;
+	}
+}
+
 static void QPic2Tex(unsigned char *pixels, unsigned int &texID, int imgWidth,
 					 int imgHeight) {
 	// Create a OpenGL texture identifier
@@ -51,112 +74,129 @@ static void QPic2Tex(unsigned char *pixels, unsigned int &texID, int imgWidth,
 				 GL_UNSIGNED_BYTE, pixels);
 }
 
+// Decodes one qpic or miptex lump into a texture for the WAD pane, pixels
+// is scratch space reused across lumps
+static bool DecodeLump(const char type, const std::string &name,
+					   const unsigned char *lumpData, const size_t size,
+					   std::vector<unsigned char> &pixels, waddata_t &data,
+					   unsigned int &texID) {
+	int width, height;
+	const unsigned char *indices;
+	bool isMip;
+	if (type == 'B' || type == 'E') {
+		qpic_t pic;
+		if (size < sizeof(qpic_t))
+			return false;
+		memcpy(&pic, lumpData, sizeof(qpic_t));
+		width = pic.width;
+		height = pic.height;
+		indices = lumpData + sizeof(qpic_t);
+		isMip = false;
+	} else if (type == 'D') {
+		miptex_t miptex;
+		if (size < sizeof(miptex_t))
+			return false;
+		memcpy(&miptex, lumpData, sizeof(miptex_t));
+
+		// The largest miptex is the first one, offset is in
+		// miptex.offsets[0]
+		width = miptex.width;
+		height = miptex.height;
+		if (miptex.offsets[0] < 0)
+			return false;
+		indices = lumpData + miptex.offsets[0];
+		isMip = true;
+	} else {
+		return false;
+	}
+	if (width <= 0 || height <= 0 ||
+		indices + width * height > lumpData + size) {
+		std::cerr << "Failed to read lump data for " << name << std::endl;
+		return false;
+	}
+
+	pixels.resize(width * height * 4);
+	IndicesToRGBA(indices, pixels.data(), width * height, &colormap[0][0]);
+	QPic2Tex(pixels.data(), texID, width, height);
+	data.width = width;
+	data.height = height;
+	data.isMip = isMip;
+	data.name = name;
+	data.indices.assign(indices, indices + width * height);
+	return true;
+}
+
 bool OpenWad(const char *filename) {
-	std::ifstream file(filename, std::ios::binary);
-	if (!file) {
+	MappedFile file;
+	if (!file.Open(filename)) {
 		std::cerr << "Failed to open file: " << filename << std::endl;
 		return false;
 	}
 
 	// Read the header
-	file.read(reinterpret_cast<char *>(&currentWad), sizeof(wad_t));
-	if (!file) {
+	if (file.Size() < sizeof(wad_t)) {
 		std::cerr << "Failed to read WAD header." << std::endl;
 		return false;
 	}
+	memcpy(&currentWad, file.Data(), sizeof(wad_t));
 
-	// Resize the vector to hold the directory entries
-	currentWadEntries.resize(currentWad.numEntries);
-
-	// Seek to the directory and read it
-	file.seekg(currentWad.offset, std::ios::beg);
-	file.read(reinterpret_cast<char *>(currentWadEntries.data()),
-			  currentWad.numEntries * sizeof(wadentry_t));
-	if (!file) {
+	// Read the directory straight out of the mapped file
+	if (currentWad.numEntries < 0 || currentWad.offset < 0 ||
+		currentWad.offset + currentWad.numEntries * sizeof(wadentry_t) >
+			file.Size()) {
 		std::cerr << "Failed to read WAD directory." << std::endl;
 		return false;
 	}
-
-	// Read the lump data
-	for (size_t i = 0; i < currentWadEntries.size(); ++i) {
-		unsigned char *lumpData =
-			(unsigned char *)malloc(currentWadEntries[i].dirsize);
-
-		file.seekg(currentWadEntries[i].offset, std::ios::beg);
-		file.read(reinterpret_cast<char *>(lumpData),
-				  currentWadEntries[i].dirsize);
-		if (!file) {
-			std::cerr << "Failed to read lump data for "
-					  << currentWadEntries[i].name << std::endl;
-			return false;
+	currentWadEntries.resize(currentWad.numEntries);
+	memcpy(currentWadEntries.data(), file.Data() + currentWad.offset,
+		   currentWad.numEntries * sizeof(wadentry_t));
+
+	// Decode in file order so reads stay sequential, the pane still lists
+	// lumps in directory order
+	std::vector<int> order(currentWadEntries.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [](const int a, const int b) {
+		return currentWadEntries[a].offset < currentWadEntries[b].offset;
+	});
+
+	std::vector<waddata_t> decoded(currentWadEntries.size());
+	std::vector<unsigned int> texs(currentWadEntries.size(), 0);
+	std::vector<unsigned char> pixels;
+	for (const int i : order) {
+		const wadentry_t &entry = currentWadEntries[i];
+		if (entry.offset < 0 || entry.dirsize < 0 ||
+			static_cast<size_t>(entry.offset) + entry.dirsize > file.Size()) {
+			std::cerr << "Failed to read lump data for " << entry.name
+					  << std::endl;
+			continue;
 		}
+		DecodeLump(entry.type, std::string(entry.name, strnlen(entry.name, 16)),
+				   file.Data() + entry.offset, entry.dirsize, pixels,
+				   decoded[i], texs[i]);
+	}
 
-		if (currentWadEntries[i].type == 'B' ||
-			currentWadEntries[i].type == 'E') {
-			qpic_t pic;
-			memcpy(&pic, lumpData, sizeof(qpic_t));
-			unsigned char *pixels =
-				(unsigned char *)malloc(pic.width * pic.height * 4);
-			for (int j = 0; j < pic.width * pic.height; ++j) {
-				const int idx = sizeof(qpic_t) + j;
-				const int colorIndex = lumpData[idx];
-				pixels[(j * 4) + 0] = colormap[colorIndex][0];
-				pixels[(j * 4) + 1] = colormap[colorIndex][1];
-				pixels[(j * 4) + 2] = colormap[colorIndex][2];
-				if (colorIndex == 255) {
-					pixels[(j * 4) + 3] = 0;
-				} else {
-					pixels[(j * 4) + 3] = 255;
-				}
-			}
-			unsigned int texID;
-			QPic2Tex(pixels, texID, pic.width, pic.height);
-			currentWadTexs.push_back(texID);
-			waddata_t data;
-			data.width = pic.width;
-			data.height = pic.height;
-			data.isMip = false;
-			data.name = currentWadEntries[i].name;
-			currentWadData.push_back(data);
-			free(pixels);
-		} else if (currentWadEntries[i].type == 'D') {
-			miptex_t miptex;
-			memcpy(&miptex, lumpData, sizeof(miptex_t));
-
-			// The largest miptex is the first one, offset is in
-			// miptex.offsets[0]
-			int mipWidth = miptex.width;
-			int mipHeight = miptex.height;
-
-			unsigned char *pixels =
-				(unsigned char *)malloc(mipWidth * mipHeight * 4);
-			for (int j = 0; j < mipWidth * mipHeight; ++j) {
-				const int idx = sizeof(miptex_t) + j;
-				const int colorIndex = lumpData[idx];
-				pixels[(j * 4) + 0] = colormap[colorIndex][0];
-				pixels[(j * 4) + 1] = colormap[colorIndex][1];
-				pixels[(j * 4) + 2] = colormap[colorIndex][2];
-				if (colorIndex == 255) {
-					pixels[(j * 4) + 3] = 0;
-				} else {
-					pixels[(j * 4) + 3] = 255;
-				}
-			}
-			unsigned int texID;
-			QPic2Tex(pixels, texID, mipWidth, mipHeight);
+	for (size_t i = 0; i < decoded.size(); ++i) {
+		if (texs[i] == 0)
+			continue;
+		currentWadTexs.push_back(texs[i]);
+		currentWadData.push_back(std::move(decoded[i]));
+	}
+	return true;
+}
+
+void OpenLumps(const std::vector<wadlump_t> &lumps) {
+	std::vector<unsigned char> pixels;
+	for (const auto &lump : lumps) {
+		waddata_t data;
+		unsigned int texID;
+		if (DecodeLump(lump.type, lump.name, lump.data.data(),
+					   lump.data.size(), pixels, data, texID)) {
 			currentWadTexs.push_back(texID);
-			waddata_t data;
-			data.width = mipWidth;
-			data.height = mipHeight;
-			data.isMip = true;
-			data.name = currentWadEntries[i].name;
-			currentWadData.push_back(data);
-			free(pixels);
+			currentWadData.push_back(std::move(data));
 		}
-		free(lumpData);
 	}
-
-	return true;
 }
 
 // Helper to align length to 4-byte boundary
@@ -164,195 +204,469 @@ static int AlignLen(int len) {
     return (len + 3) & ~3;
 }
 
-// Write lump data and apply padding if necessary
-static void WriteLumpData(std::ofstream &outFile, unsigned char* data, int length) {
-    outFile.write(reinterpret_cast<char*>(data), length);
-
-    int padding = AlignLen(length) - length;
-    if (padding > 0) {
-        static const unsigned char zeros[4] = {0};
-        outFile.write(reinterpret_cast<const char*>(zeros), padding);
-    }
+static wadlump_t MakeQpicLump(const std::string &name, const int width,
+							  const int height,
+							  const unsigned char *indices) {
+	wadlump_t lump;
+	lump.name = name;
+	lump.type = 'B';
+	lump.data.resize(sizeof(qpic_t) + width * height);
+
+	qpic_t qpic = {};
+	qpic.width = width;
+	qpic.height = height;
+	memcpy(lump.data.data(), &qpic, sizeof(qpic_t));
+	memcpy(lump.data.data() + sizeof(qpic_t), indices, width * height);
+	return lump;
 }
 
-// Finalize lump data
-static void FinalizeLump(wadentry_t &entry, int dataLength) {
-    entry.size = AlignLen(dataLength);  // Include padding in the size
-    entry.dirsize = entry.size;
-}
-
-static unsigned char* generateQpicIndices(int idx, int width, int height) {
-	unsigned char *rgbaPixels = GetTexturePixels(currentWadTexs[idx], width, height, GL_RGBA, GL_UNSIGNED_BYTE);
-
-	// Allocate memory for indexed color data
-	unsigned char *indices = new unsigned char[width * height];
-
-	// Convert RGBA to indexed color
-	convertRGBAToIndices(rgbaPixels, indices, width * height);
+static wadlump_t MakeMipLump(const std::string &name, const int width,
+							 const int height, const unsigned char *indices) {
+	miptex_t miptex = {};
+	strncpy(miptex.name, name.c_str(), 15);
+	miptex.width = width;
+	miptex.height = height;
+
+	int dataOffset = sizeof(miptex_t);
+	for (int mip = 0; mip < 4; ++mip) {
+		miptex.offsets[mip] = dataOffset;
+		dataOffset += AlignLen((width >> mip) * (height >> mip));
+	}
 
-	free(rgbaPixels);
-	return indices;
+	wadlump_t lump;
+	lump.name = name;
+	lump.type = 'D';
+	lump.data.resize(dataOffset);
+	memcpy(lump.data.data(), &miptex, sizeof(miptex_t));
+
+	// Simple nearest neighbor downsampling for each mip level
+	for (int mip = 0; mip < 4; ++mip) {
+		const int mipWidth = width >> mip;
+		const int mipHeight = height >> mip;
+		unsigned char *mipData = lump.data.data() + miptex.offsets[mip];
+		for (int y = 0; y < mipHeight; ++y) {
+			for (int x = 0; x < mipWidth; ++x) {
+				mipData[y * mipWidth + x] =
+					indices[(y << mip) * width + (x << mip)];
+			}
+		}
+	}
+	return lump;
 }
 
-static unsigned char* generateMipIndices(int idx, int width, int height, int mipLevel) {
-    int mipWidth = width >> mipLevel;
-    int mipHeight = height >> mipLevel;
+bool WriteLumps(const char *filename, const std::vector<wadlump_t> &lumps) {
+	std::ofstream outFile(filename, std::ios::binary);
+	if (!outFile.is_open()) {
+		std::cerr << "Failed to open file: " << filename << std::endl;
+		return false;
+	}
 
-    if (mipWidth <= 0) mipWidth = 1;
-    if (mipHeight <= 0) mipHeight = 1;
+	// Every size is known up front so the file is written in a single
+	// forward pass with no seeking back to patch the header
+	std::vector<wadentry_t> directoryEntries(lumps.size());
+	int offset = sizeof(wad_t);
+	for (size_t i = 0; i < lumps.size(); ++i) {
+		wadentry_t &entry = directoryEntries[i];
+		entry = {};
+		entry.offset = offset;
+		entry.size = AlignLen(lumps[i].data.size());
+		entry.dirsize = entry.size;
+		entry.type = lumps[i].type;
+		strncpy(entry.name, lumps[i].name.c_str(), 15);
+		offset += entry.size;
+	}
 
+	wad_t header;
+	header.id = WADID;
+	header.numEntries = lumps.size();
+	header.offset = offset;
+	outFile.write(reinterpret_cast<char *>(&header), sizeof(wad_t));
+
+	static const char zeros[4] = {0};
+	for (size_t i = 0; i < lumps.size(); ++i) {
+		outFile.write(reinterpret_cast<const char *>(lumps[i].data.data()),
+					  lumps[i].data.size());
+		outFile.write(zeros, directoryEntries[i].size - lumps[i].data.size());
+	}
+	outFile.write(reinterpret_cast<char *>(directoryEntries.data()),
+				  sizeof(wadentry_t) * directoryEntries.size());
 
-	unsigned char* originalData = generateQpicIndices(idx, width, height);
+	if (!outFile) {
+		std::cerr << "Failed to write WAD: " << filename << std::endl;
+		return false;
+	}
+	return true;
+}
 
-    unsigned char* mipData = new unsigned char[mipWidth * mipHeight];
+bool ReadLumps(const char *filename, std::vector<wadlump_t> &lumps) {
+	MappedFile file;
+	if (!file.Open(filename)) {
+		std::cerr << "Failed to open file: " << filename << std::endl;
+		return false;
+	}
 
-    for (int y = 0; y < mipHeight; ++y) {
-        for (int x = 0; x < mipWidth; ++x) {
-            // Simple nearest neighbor downsampling
-            int srcX = x << mipLevel;
-            int srcY = y << mipLevel;
+	wad_t header;
+	if (file.Size() < sizeof(wad_t)) {
+		std::cerr << "Failed to read WAD header." << std::endl;
+		return false;
+	}
+	memcpy(&header, file.Data(), sizeof(wad_t));
+	if (header.numEntries < 0 || header.offset < 0 ||
+		header.offset + header.numEntries * sizeof(wadentry_t) >
+			file.Size()) {
+		std::cerr << "Failed to read WAD directory." << std::endl;
+		return false;
+	}
 
-            mipData[y * mipWidth + x] = originalData[srcY * width + srcX];
-        }
-    }
-	delete[] originalData;
-    return mipData;
+	lumps.clear();
+	lumps.reserve(header.numEntries);
+	for (int i = 0; i < header.numEntries; ++i) {
+		wadentry_t entry;
+		memcpy(&entry, file.Data() + header.offset + i * sizeof(wadentry_t),
+			   sizeof(wadentry_t));
+		if (entry.offset < 0 || entry.dirsize < 0 ||
+			static_cast<size_t>(entry.offset) + entry.dirsize > file.Size()) {
+			std::cerr << "Failed to read lump data for " << entry.name
+					  << std::endl;
+			return false;
+		}
+		wadlump_t lump;
+		lump.name = std::string(entry.name, strnlen(entry.name, 16));
+		lump.type = entry.type;
+		lump.data.assign(file.Data() + entry.offset,
+						 file.Data() + entry.offset + entry.dirsize);
+		lumps.push_back(std::move(lump));
+	}
+	return true;
 }
 
-
 // Main function to write the WAD file
 bool WriteWad(const char *filename) {
-    std::ofstream outFile(filename, std::ios::binary);
-    if (!outFile.is_open()) {
-        return false;
-    }
-
-    // Write a dummy WAD header
-    wad_t dummyHeader = {};
-    outFile.write(reinterpret_cast<char*>(&dummyHeader), sizeof(wad_t));
-
-    std::vector<wadentry_t> directoryEntries(currentWadData.size());
-
-    for (size_t i = 0; i < currentWadData.size(); ++i) {
-        waddata_t &data = currentWadData[i];
-        wadentry_t entry = {};
-
-        entry.offset = static_cast<int>(outFile.tellp()); // Record the current offset
-
-        if (data.isMip) {
-            // Handle miptex lump
-            miptex_t miptex = {};
-            strncpy(miptex.name, data.name.c_str(), 16);
-            miptex.width = data.width;
-            miptex.height = data.height;
-
-            int pixelCount = data.width * data.height;
-            int mipSizes[4] = {pixelCount, (data.width / 2) * (data.height / 2), (data.width / 4) * (data.height / 4), (data.width / 8) * (data.height / 8)};
-            int dataOffset = sizeof(miptex_t);
-
-            for (int mip = 0; mip < 4; ++mip) {
-                miptex.offsets[mip] = dataOffset;
-                dataOffset += AlignLen(mipSizes[mip]);
-            }
-
-            // Write miptex header
-            outFile.write(reinterpret_cast<char*>(&miptex), sizeof(miptex_t));
-
-            // Write mip levels with padding
-            for (int mip = 0; mip < 4; ++mip) {
-                unsigned char* mipIndices = generateMipIndices(i, data.width, data.height, mip);
-                WriteLumpData(outFile, mipIndices, mipSizes[mip]);
-                delete[] mipIndices;
-            }
-
-            FinalizeLump(entry, dataOffset);
+	std::vector<wadlump_t> lumps;
+	lumps.reserve(currentWadData.size());
+	for (const waddata_t &data : currentWadData) {
+		if (static_cast<int>(data.indices.size()) < data.width * data.height)
+			continue;
+		if (data.isMip) {
+			lumps.push_back(MakeMipLump(data.name, data.width, data.height,
+										data.indices.data()));
+		} else {
+			lumps.push_back(MakeQpicLump(data.name, data.width, data.height,
+										 data.indices.data()));
+		}
+	}
+	return WriteLumps(filename, lumps);
+}
 
-        } else {
-            // Handle qpic lump
-            qpic_t qpic = {};
-            qpic.width = data.width;
-            qpic.height = data.height;
+static size_t WadSize(const std::vector<wadlump_t> &lumps) {
+	size_t size = sizeof(wad_t) + lumps.size() * sizeof(wadentry_t);
+	for (const auto &lump : lumps) {
+		size += AlignLen(lump.data.size());
+	}
+	return size;
+}
 
-            int pixelCount = data.width * data.height;
+bool AnalyzeWad(const std::filesystem::path &wadPath,
+				const std::filesystem::path &projectDir, wadreport_t &report) {
+	std::vector<wadlump_t> lumps;
+	if (!ReadLumps(wadPath.string().c_str(), lumps))
+		return false;
 
-            // Write qpic header
-            outFile.write(reinterpret_cast<char*>(&qpic), sizeof(qpic_t));
+	std::vector<std::filesystem::path> maps =
+		BSP::FindMaps(projectDir, ".bsp");
+	std::vector<std::filesystem::path> sources =
+		BSP::FindMaps(projectDir, ".map");
+	maps.insert(maps.end(), sources.begin(), sources.end());
+
+	std::vector<std::vector<std::string>> mapNames(maps.size());
+	std::vector<char> read(maps.size(), 0);
+	Jobs::ParallelFor(maps.size(), [&](size_t i) {
+		if (maps[i].extension() == ".map") {
+			read[i] = BSP::ReadMapTextureNames(maps[i], mapNames[i]);
+		} else {
+			read[i] = BSP::ReadTextureNames(maps[i], mapNames[i]);
+		}
+	});
+
+	// texture lookups in the engine and map compilers ignore case
+	auto lower = [](std::string name) {
+		std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+		return name;
+	};
+	std::unordered_set<std::string> referenced;
+	for (const auto &names : mapNames) {
+		for (const auto &name : names) {
+			referenced.insert(lower(name));
+		}
+	}
 
-            unsigned char* indices = generateQpicIndices(i, data.width, data.height);
-            WriteLumpData(outFile, indices, pixelCount);
-            delete[] indices;
+	report = {};
+	for (size_t i = 0; i < maps.size(); ++i) {
+		if (read[i])
+			++report.mapCount;
+		else
+			report.unreadable.push_back(maps[i].string());
+	}
+	report.originalSize = std::filesystem::file_size(wadPath);
+	std::unordered_set<std::string> keptNames;
+	std::unordered_map<uint64_t, std::string> keptContent;
+	for (auto &lump : lumps) {
+		const std::string key = lower(lump.name);
+		// miptex carry their name in the header so it is left out of the
+		// hash, otherwise renamed copies would never match
+		const size_t skip =
+			lump.type == 'D' && lump.data.size() >= 16 ? 16 : 0;
+		const uint64_t hash =
+			HashBytes(lump.data.data() + skip, lump.data.size() - skip);
+
+		if (keptNames.count(key)) {
+			// only the first lump with a name can ever be looked up
+			report.duplicates.push_back(lump.name + " (repeated name)");
+			continue;
+		}
+		// UI lumps are looked up by the engine so only map textures can
+		// be orphaned, and with no maps there is nothing to check against.
+		// A map that could not be read may use any of them, so none are
+		// dropped then
+		if (lump.type == 'D' && report.mapCount > 0 &&
+			report.unreadable.empty() && !referenced.count(key)) {
+			report.unused.push_back(lump.name);
+			continue;
+		}
 
-			FinalizeLump(entry, sizeof(qpic_t) + AlignLen(pixelCount));
-        }
+		auto same = keptContent.find(hash);
+		if (same != keptContent.end()) {
+			// maps still refer to it by name so it has to stay
+			report.duplicates.push_back(lump.name + " = " + same->second);
+		} else {
+			keptContent[hash] = lump.name;
+		}
+		keptNames.insert(key);
+		report.compacted.push_back(std::move(lump));
+	}
+	report.compactedSize = WadSize(report.compacted);
+	// lumps are written padded, so a WAD saved without padding and with
+	// nothing to drop comes out bigger
+	report.savedSize = report.compactedSize < report.originalSize
+						   ? report.originalSize - report.compactedSize
+						   : 0;
+	return true;
+}
 
-        entry.dirsize = entry.size;
-        entry.type = data.isMip ? 'D' : 'B';
-        entry.compression = 0;
-        entry.dummy = 0;
-        strncpy(entry.name, data.name.c_str(), 16);
+// The build cache sits next to the WAD and maps each lump name to the hash
+// of the source image it was built from, so unchanged images can reuse the
+// lump from the previous build instead of being decoded and quantized again
+static std::unordered_map<std::string, uint64_t>
+ReadBuildCache(const std::filesystem::path &cacheFile) {
+	std::unordered_map<std::string, uint64_t> cache;
+	std::ifstream input(cacheFile);
+	std::string line;
+	while (std::getline(input, line)) {
+		const size_t split = line.find(' ');
+		if (split == std::string::npos)
+			continue;
+		cache[line.substr(split + 1)] =
+			strtoull(line.substr(0, split).c_str(), nullptr, 16);
+	}
+	return cache;
+}
 
-        directoryEntries[i] = entry;
-    }
+static void WriteBuildCache(const std::filesystem::path &cacheFile,
+							const std::vector<wadlump_t> &lumps,
+							const std::vector<uint64_t> &hashes) {
+	std::ofstream output(cacheFile);
+	for (size_t i = 0; i < lumps.size(); ++i) {
+		output << std::hex << hashes[i] << " " << lumps[i].name << "\n";
+	}
+}
 
-    // Write directory at the end of the file
-    int directoryOffset = static_cast<int>(outFile.tellp());
-    outFile.write(reinterpret_cast<char*>(directoryEntries.data()), sizeof(wadentry_t) * directoryEntries.size());
+bool BuildWad(const std::vector<std::filesystem::path> &images,
+			  const std::filesystem::path &output, const bool isMip) {
+	std::filesystem::path cacheFile = output;
+	cacheFile += ".cache";
+
+	// lumps from the last build are only trusted alongside its cache file
+	std::unordered_map<std::string, uint64_t> cache;
+	std::unordered_map<std::string, size_t> previousIndex;
+	std::vector<wadlump_t> previous;
+	if (std::filesystem::exists(cacheFile) &&
+		ReadLumps(output.string().c_str(), previous)) {
+		cache = ReadBuildCache(cacheFile);
+		for (size_t i = 0; i < previous.size(); ++i) {
+			previousIndex[previous[i].name] = i;
+		}
+	}
 
-    // Correct WAD header
-    currentWad.offset = directoryOffset;
-    currentWad.numEntries = directoryEntries.size();
+	// anything that changes the output bytes has to be part of the key
+	uint64_t settingsHash = HashBytes(&colormap[0][0], sizeof(colormap));
+	settingsHash = HashBytes(&isMip, sizeof(isMip), settingsHash);
+
+	std::vector<wadlump_t> lumps(images.size());
+	std::vector<uint64_t> hashes(images.size());
+	std::vector<char> failed(images.size(), 0);
+	std::atomic<int> reused{0};
+	Jobs::ParallelFor(images.size(), [&](size_t i) {
+		std::filesystem::path name = images[i].filename();
+		name.replace_extension("");
+		lumps[i].name = name.string().substr(0, 15);
+
+		std::ifstream input(images[i], std::ios::binary);
+		if (!input) {
+			failed[i] = 1;
+			return;
+		}
+		std::vector<unsigned char> bytes(
+			(std::istreambuf_iterator<char>(input)),
+			std::istreambuf_iterator<char>());
+		hashes[i] = HashBytes(bytes.data(), bytes.size(), settingsHash);
+
+		auto cached = cache.find(lumps[i].name);
+		auto prev = previousIndex.find(lumps[i].name);
+		if (cached != cache.end() && cached->second == hashes[i] &&
+			prev != previousIndex.end()) {
+			lumps[i] = previous[prev->second];
+			++reused;
+			return;
+		}
 
-    // Rewind and write the correct header
-    outFile.seekp(0, std::ios::beg);
-    outFile.write(reinterpret_cast<char*>(&currentWad), sizeof(wad_t));
+		int width, height;
+		unsigned char *pixels = stbi_load_from_memory(
+			bytes.data(), bytes.size(), &width, &height, nullptr, 4);
+		if (pixels == nullptr) {
+			failed[i] = 1;
+			return;
+		}
+		std::vector<unsigned char> indices(width * height);
+		convertRGBAToIndices(pixels, indices.data(), width * height);
+		stbi_image_free(pixels);
+
+		const std::string lumpName = lumps[i].name;
+		if (isMip) {
+			lumps[i] = MakeMipLump(lumpName, width, height, indices.data());
+		} else {
+			lumps[i] = MakeQpicLump(lumpName, width, height, indices.data());
+		}
+	});
+
+	// drop anything that failed to load so the WAD stays consistent. Lump
+	// names are the first 15 characters of the file name and engines look
+	// them up ignoring case, so of the images that cut down to the same name
+	// only the first one that loaded is kept
+	std::unordered_set<std::string> usedNames;
+	size_t count = 0;
+	for (size_t i = 0; i < images.size(); ++i) {
+		if (failed[i]) {
+			std::cerr << "Failed to load image: " << images[i].string()
+					  << std::endl;
+			continue;
+		}
+		std::string folded = lumps[i].name;
+		std::transform(folded.begin(), folded.end(), folded.begin(),
+					   ::tolower);
+		if (!usedNames.insert(folded).second) {
+			std::cerr << "Skipping " << images[i].string() << ", lump name "
+					  << lumps[i].name << " is already used" << std::endl;
+			continue;
+		}
+		if (count != i) {
+			lumps[count] = std::move(lumps[i]);
+			hashes[count] = hashes[i];
+		}
+		++count;
+	}
+	lumps.resize(count);
+	hashes.resize(count);
 
-    // Close the file
-    outFile.close();
-    return true;
+	if (!WriteLumps(output.string().c_str(), lumps))
+		return false;
+	WriteBuildCache(cacheFile, lumps, hashes);
+	std::cout << "Wrote " << lumps.size() << " lumps to " << output.string()
+			  << " (" << reused << " unchanged)" << std::endl;
+	return true;
 }
 
 void InsertImage(std::filesystem::path filename, const bool isMip) {
 	int width, height;
 	unsigned int texID;
-	LoadTextureFromFile(filename.string().c_str(), &texID, &width, &height);
+	if (!LoadTextureFromFile(filename.string().c_str(), &texID, &width,
+							 &height))
+		return;
 	waddata_t data;
 	data.width = width;
 	data.height = height;
 	data.isMip = isMip;
 	filename.replace_extension("");
 	data.name = filename.filename().string();
-	currentWadData.push_back(data);
+
+	// quantize once up front so exports never have to read back from GL
+	unsigned char *pixels = GetTexturePixels(texID, width, height);
+	data.indices.resize(width * height);
+	convertRGBAToIndices(pixels, data.indices.data(), width * height);
+	free(pixels);
+
+	currentWadData.push_back(std::move(data));
 	currentWadTexs.push_back(texID);
 }
 
-void ExportAsImages() {
-	std::filesystem::path outDir = currentWadPath.parent_path();	
+bool ExportAsImages(const int compressionLevel) {
+	if (exportTask.IsRunning() || currentWadPath.empty())
+		return false;
+
+	std::filesystem::path outDir = currentWadPath.parent_path();
 	outDir /= currentWadPath.filename();
 	outDir.replace_extension("");
 	// Create the output directory if it does not exist
 	if (!std::filesystem::exists(outDir)) {
 		std::filesystem::create_directory(outDir);
 	}
-	for (int i = 0; i < currentWadTexs.size(); ++i) {
-		std::filesystem::path outFile = outDir / currentWadData[i].name;
-		outFile.replace_extension(".png");
-		int width = currentWadData[i].width;
-		int height = currentWadData[i].height;
-		unsigned char *pixels = GetTexturePixels(currentWadTexs[i], width, height);
-		convertRGBAToImage(outFile.string().c_str(), pixels, width, height);
-	}	
-
+	SetPNGCompressionLevel(compressionLevel);
+
+	// the worker gets its own copy so the pane can keep editing the WAD
+	std::vector<unsigned char> palette(&colormap[0][0],
+									   &colormap[0][0] + sizeof(colormap));
+	std::vector<waddata_t> images = currentWadData;
+	return exportTask.Start([images, palette, outDir](Jobs::Task &task) {
+		task.SetTotal(images.size());
+		Jobs::ParallelFor(
+			images.size(),
+			[&](size_t i) {
+				const waddata_t &image = images[i];
+				const int count = image.width * image.height;
+				if (static_cast<int>(image.indices.size()) >= count) {
+					std::filesystem::path outFile = outDir / image.name;
+					outFile.replace_extension(".png");
+					std::vector<unsigned char> pixels(count * 4);
+					IndicesToRGBA(image.indices.data(), pixels.data(), count,
+								  palette.data());
+					convertRGBAToImage(outFile.string().c_str(),
+									   pixels.data(), image.width,
+									   image.height);
+				}
+				task.Advance();
+			},
+			task.CancelFlag());
+	});
 }
 
+bool IsExporting() { return exportTask.IsRunning(); }
+
+float GetExportProgress() { return exportTask.GetProgress(); }
+
+void CancelExport() { exportTask.Cancel(); }
+
 void ExportImage(const int index) {
+	const waddata_t &image = currentWadData[index];
+	const int count = image.width * image.height;
+	if (static_cast<int>(image.indices.size()) < count)
+		return;
 	std::string filename = currentWadPath.parent_path().string();
 	filename += "/";
-	filename += currentWadData[index].name;
+	filename += image.name;
 	filename += ".png";
-	int width = currentWadData[index].width;
-	int height = currentWadData[index].height;
-	unsigned char *pixels = GetTexturePixels(currentWadTexs[index], width, height);
-	convertRGBAToImage(filename.c_str(), pixels, width, height);	
+	std::vector<unsigned char> pixels(count * 4);
+	IndicesToRGBA(image.indices.data(), pixels.data(), count, &colormap[0][0]);
+	convertRGBAToImage(filename.c_str(), pixels.data(), image.width,
+					   image.height);
 }
 
 void RemoveImage(const int index) {
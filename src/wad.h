@@ -17,8 +17,9 @@ along with this program.
 
 */
 
-#include <vector>
 #include <filesystem>
+#include <string>
+#include <vector>
 
 #pragma once
 #define WADID                                                                  \
@@ -55,12 +56,40 @@ typedef struct {
 	int width, height;
 	bool isMip;
 	std::string name;
+	std::vector<unsigned char> indices; // palette indices of the full image
 } waddata_t;
 
+// Raw lump as stored in the WAD, data starts with the qpic_t/miptex_t header
+typedef struct {
+	std::string name;
+	char type;
+	std::vector<unsigned char> data;
+} wadlump_t;
+
+typedef struct {
+	int mapCount;						 // maps whose texture names were read
+	std::vector<std::string> unreadable; // maps that could not be read
+	std::vector<std::string> unused;	 // miptex no project map references
+	std::vector<std::string> duplicates; // lumps repeating earlier content
+	size_t originalSize, compactedSize;
+	size_t savedSize; // zero when compacting saves nothing
+	std::vector<wadlump_t> compacted;
+} wadreport_t;
+
 bool OpenWad(const char *filename);
+void OpenLumps(const std::vector<wadlump_t> &lumps);
 bool WriteWad(const char *filename);
+bool ReadLumps(const char *filename, std::vector<wadlump_t> &lumps);
+bool WriteLumps(const char *filename, const std::vector<wadlump_t> &lumps);
+bool AnalyzeWad(const std::filesystem::path &wadPath,
+				const std::filesystem::path &projectDir, wadreport_t &report);
+bool BuildWad(const std::vector<std::filesystem::path> &images,
+			  const std::filesystem::path &output, const bool isMip);
 void InsertImage(std::filesystem::path filename, const bool isMip);
-void ExportAsImages();
+bool ExportAsImages(const int compressionLevel);
+bool IsExporting();
+float GetExportProgress();
+void CancelExport();
 void ExportImage(const int index);
 void RemoveImage(const int index);
 void NewWadFromImages(std::vector<std::filesystem::path> files, const bool isMip);
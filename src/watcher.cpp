@@ -0,0 +1,288 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#include "watcher.h"
+#include "jobs.h"
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace QuakePrism::Watcher {
+
+// how often the fallback scans the project for changes
+static constexpr auto pollInterval = std::chrono::seconds(1);
+
+// how long the watch task waits for changes before checking for a cancel
+static constexpr int waitMilliseconds = 100;
+
+static std::mutex eventMutex;
+static std::vector<fileevent_t> events;
+static std::unordered_map<std::string, size_t> eventIndex; // path to events
+static Jobs::Task watchTask;
+
+static bool IsHidden(const std::filesystem::path &name) {
+	const std::string text = name.string();
+	return !text.empty() && text[0] == '.';
+}
+
+static void PushEvent(const std::filesystem::path &path,
+					  const fileeventkind_t kind) {
+	std::lock_guard<std::mutex> lock(eventMutex);
+	auto [it, inserted] = eventIndex.emplace(path.string(), events.size());
+	if (inserted) {
+		events.push_back({path, kind});
+		return;
+	}
+	// a file that was added and then written to is still new
+	auto &event = events[it->second];
+	if (event.kind != FILE_ADDED || kind != FILE_CHANGED)
+		event.kind = kind;
+}
+
+filestamp_t GetStamp(const std::filesystem::path &file) {
+	filestamp_t stamp = {0, 0};
+	std::error_code ec;
+	const uintmax_t size = std::filesystem::file_size(file, ec);
+	if (ec)
+		return stamp;
+	const auto modified = std::filesystem::last_write_time(file, ec);
+	if (ec)
+		return stamp;
+	stamp.size = size;
+	stamp.modified = modified.time_since_epoch().count();
+	return stamp;
+}
+
+bool SameStamp(const filestamp_t &a, const filestamp_t &b) {
+	return a.size == b.size && a.modified == b.modified;
+}
+
+typedef std::unordered_map<std::string, filestamp_t> snapshot_t;
+
+static void ScanFolder(const std::filesystem::path &projectDir,
+					   snapshot_t &files) {
+	std::error_code ec;
+	auto it = std::filesystem::recursive_directory_iterator(
+		projectDir, std::filesystem::directory_options::skip_permission_denied,
+		ec);
+	for (; !ec && it != std::filesystem::recursive_directory_iterator();
+		 it.increment(ec)) {
+		if (IsHidden(it->path().filename())) {
+			it.disable_recursion_pending();
+			continue;
+		}
+		// folders only matter for coming and going
+		std::error_code statError;
+		files[it->path().string()] = it->is_directory(statError)
+										 ? filestamp_t{0, 0}
+										 : GetStamp(it->path());
+	}
+}
+
+static void WatchByPolling(const std::filesystem::path &projectDir,
+						   Jobs::Task &task) {
+	snapshot_t previous;
+	ScanFolder(projectDir, previous);
+	while (!task.IsCancelled()) {
+		const auto next = std::chrono::steady_clock::now() + pollInterval;
+		while (!task.IsCancelled() && std::chrono::steady_clock::now() < next)
+			std::this_thread::sleep_for(
+				std::chrono::milliseconds(waitMilliseconds));
+		if (task.IsCancelled())
+			break;
+
+		std::error_code ec;
+		if (!std::filesystem::is_directory(projectDir, ec)) {
+			PushEvent(projectDir, FILE_REMOVED);
+			continue;
+		}
+		snapshot_t current;
+		ScanFolder(projectDir, current);
+		for (const auto &[path, stamp] : current) {
+			auto old = previous.find(path);
+			if (old == previous.end())
+				PushEvent(path, FILE_ADDED);
+			else if (!SameStamp(old->second, stamp))
+				PushEvent(path, FILE_CHANGED);
+		}
+		for (const auto &[path, stamp] : previous) {
+			if (current.find(path) == current.end())
+				PushEvent(path, FILE_REMOVED);
+		}
+		previous.swap(current);
+	}
+}
+
+#ifdef __linux__
+typedef struct {
+	int fd;
+	std::unordered_map<int, std::filesystem::path> folders;
+} inotify_t;
+
+// Returns false once the system runs out of watches
+static bool AddWatch(inotify_t &watch, const std::filesystem::path &folder) {
+	const uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+						  IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF |
+						  IN_MOVE_SELF | IN_ONLYDIR;
+	const int wd = inotify_add_watch(watch.fd, folder.c_str(), mask);
+	if (wd >= 0)
+		watch.folders[wd] = folder;
+	return wd >= 0 || errno != ENOSPC;
+}
+
+static bool AddWatches(inotify_t &watch, const std::filesystem::path &root) {
+	if (!AddWatch(watch, root))
+		return false;
+	std::error_code ec;
+	auto it = std::filesystem::recursive_directory_iterator(
+		root, std::filesystem::directory_options::skip_permission_denied, ec);
+	for (; !ec && it != std::filesystem::recursive_directory_iterator();
+		 it.increment(ec)) {
+		std::error_code statError;
+		if (!it->is_directory(statError))
+			continue;
+		if (IsHidden(it->path().filename()))
+			it.disable_recursion_pending();
+		else if (!AddWatch(watch, it->path()))
+			return false;
+	}
+	return true;
+}
+
+// a folder moved elsewhere keeps its watches, which would report its files
+// under the old path
+static void RemoveWatches(inotify_t &watch,
+						  const std::filesystem::path &root) {
+	const std::string prefix = root.string();
+	for (const auto &[wd, folder] : watch.folders) {
+		const std::string path = folder.string();
+		if (path.compare(0, prefix.size(), prefix) == 0 &&
+			(path.size() == prefix.size() || path[prefix.size()] == '/'))
+			inotify_rm_watch(watch.fd, wd);
+	}
+}
+
+static void ReadEvents(inotify_t &watch, const std::filesystem::path &root) {
+	alignas(inotify_event) char buffer[64 * 1024];
+	for (;;) {
+		const ssize_t size = read(watch.fd, buffer, sizeof(buffer));
+		if (size <= 0)
+			return;
+		for (const char *p = buffer; p < buffer + size;) {
+			const auto *event = reinterpret_cast<const inotify_event *>(p);
+			p += sizeof(inotify_event) + event->len;
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				PushEvent(root, FILE_CHANGED);
+				continue;
+			}
+			if (event->mask & IN_IGNORED) {
+				watch.folders.erase(event->wd);
+				continue;
+			}
+			auto folder = watch.folders.find(event->wd);
+			if (folder == watch.folders.end())
+				continue;
+			// other folders going away are reported by the one above them
+			if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+				if (folder->second == root)
+					PushEvent(root, FILE_REMOVED);
+				continue;
+			}
+			if (event->len == 0 || event->name[0] == '.')
+				continue;
+
+			const auto path = folder->second / event->name;
+			if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+				// files moved in along with a folder are found when it is
+				// listed
+				if (event->mask & IN_ISDIR)
+					AddWatches(watch, path);
+				PushEvent(path, FILE_ADDED);
+			} else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+				if (event->mask & IN_ISDIR)
+					RemoveWatches(watch, path);
+				PushEvent(path, FILE_REMOVED);
+			} else if (event->mask & IN_CLOSE_WRITE)
+				PushEvent(path, FILE_CHANGED);
+		}
+	}
+}
+
+// Returns false if inotify could not watch the whole project
+static bool WatchByInotify(const std::filesystem::path &projectDir,
+						   Jobs::Task &task) {
+	inotify_t watch;
+	watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch.fd < 0)
+		return false;
+	if (!AddWatches(watch, projectDir)) {
+		close(watch.fd);
+		return false;
+	}
+
+	while (!task.IsCancelled()) {
+		pollfd ready = {watch.fd, POLLIN, 0};
+		if (poll(&ready, 1, waitMilliseconds) > 0)
+			ReadEvents(watch, projectDir);
+	}
+	close(watch.fd);
+	return true;
+}
+#endif
+
+void StartWatching(const std::filesystem::path &projectDir) {
+	watchTask.Cancel();
+	watchTask.Wait();
+	{
+		std::lock_guard<std::mutex> lock(eventMutex);
+		events.clear();
+		eventIndex.clear();
+	}
+	if (projectDir.empty())
+		return;
+
+	watchTask.Start([projectDir](Jobs::Task &task) {
+#ifdef __linux__
+		if (WatchByInotify(projectDir, task))
+			return;
+#endif
+		WatchByPolling(projectDir, task);
+	});
+}
+
+std::vector<fileevent_t> TakeEvents() {
+	std::vector<fileevent_t> taken;
+	std::lock_guard<std::mutex> lock(eventMutex);
+	taken.swap(events);
+	eventIndex.clear();
+	return taken;
+}
+
+} // namespace QuakePrism::Watcher
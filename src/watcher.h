@@ -0,0 +1,53 @@
+/*
+Copyright (C) 2024 Lance Borden
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 3.0
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.
+
+*/
+
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace QuakePrism::Watcher {
+
+typedef enum { FILE_CHANGED, FILE_ADDED, FILE_REMOVED } fileeventkind_t;
+
+typedef struct {
+	std::filesystem::path path;
+	fileeventkind_t kind;
+} fileevent_t;
+
+typedef struct {
+	uintmax_t size;
+	int64_t modified;
+} filestamp_t;
+
+// Watches every file under the project on a background task, through
+// inotify where it is available and by scanning the folders every second
+// otherwise. Hidden files and folders such as .qprism and .git are left out.
+void StartWatching(const std::filesystem::path &projectDir);
+
+// The changes seen since the last call, one per path. The project folder
+// itself is reported removed when it goes away, and changed when changes
+// were lost and anything may differ.
+std::vector<fileevent_t> TakeEvents();
+
+// Size and modification time of a file, all zero if it is missing
+filestamp_t GetStamp(const std::filesystem::path &file);
+bool SameStamp(const filestamp_t &a, const filestamp_t &b);
+
+} // namespace QuakePrism::Watcher